@@ -47,4 +47,1138 @@ typedef xktimer_ptr_t  			XKTimerPtr;
 #define XKTimer_Handle        	xktimer_handle
 #define XKTimer_Task          	xktimer_task
 
+#if defined(__cplusplus) && __cplusplus >= 202002L
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#endif
+
+/**
+ * The maximum number of timeouts in one hyperperiod of an xk::StaticTimers
+ * schedule. The table of timeouts is built by the compiler, so a bigger
+ * limit costs compile time and flash, but no RAM.
+ */
+#ifndef XKTIMER_STATIC_MAX_EVENTS
+#define XKTIMER_STATIC_MAX_EVENTS	1024
+#endif
+
+/**
+ * \brief		C++ interface to the XKTimer module
+ *
+ * xk::Timer holds any callable, like a lambda with captures, the result of
+ * std::bind_front() for a member function or a std::move_only_function,
+ * inline in the timer object, without allocating memory. The timeouts are
+ * std::chrono durations.
+ *
+ * Timer::poll() and xk::poll() call the callable directly with its real type,
+ * so the call can be inlined, instead of going through the void (*)(int)
+ * callback of xktimer_t. An xk::TimerSet has its own xktimer_ctx_t, so it
+ * does not use the default context of the C functions. It takes the timers
+ * that timed out with xktimer_ctx_collect_expired() and calls each callable
+ * through a function generated for its type, in which the call is inlined.
+ *
+ * \code
+ * using namespace std::chrono_literals;
+ *
+ * xk::TimerSet timers;
+ * xk::Timer blink(xk::Type::Periodic, 500ms, [&led] { led.toggle(); });
+ * xk::Timer poll(1s, 100ms, std::bind_front(&Sensor::poll, &sensor));
+ *
+ * timers.add(blink);
+ * timers.add(poll);
+ * blink.start();
+ * poll.start();
+ *
+ * while (1) {
+ *     timers.task();
+ * }
+ * \endcode
+ */
+namespace xk {
+
+//! The timer types
+enum class Type : uint8_t {
+	SingleShot = XKTIMER_SINGLE_SHOT,
+	Periodic = XKTIMER_PERIODIC,
+	DualState = XKTIMER_DUAL_STATE,
+	Sequence = XKTIMER_SEQUENCE,
+};
+
+//! The overrun policies, please see xktimer_set_overrun()
+enum class Overrun : uint8_t {
+	Drift = XKTIMER_OVERRUN_DRIFT,
+	CatchUp = XKTIMER_OVERRUN_CATCH_UP,
+	Coalesce = XKTIMER_OVERRUN_COALESCE,
+	Skip = XKTIMER_OVERRUN_SKIP,
+};
+
+//! Convert a duration to the ms used by the XKTimer module, rounding up
+template <class Rep, class Period>
+constexpr uint32_t to_ms(std::chrono::duration<Rep, Period> d)
+{
+	return static_cast<uint32_t>(
+		std::chrono::ceil<std::chrono::milliseconds>(d).count());
+}
+
+//! The duration of one tick of xktimer_clock()
+using ticks = std::chrono::duration<xktimer_span_t,
+									std::ratio<1, XKTIMER_RESOLUTION>>;
+
+//! Convert a duration to ticks of XKTIMER_RESOLUTION, rounding up
+template <class Rep, class Period>
+constexpr xktimer_span_t to_ticks(std::chrono::duration<Rep, Period> d)
+{
+	return std::chrono::ceil<ticks>(d).count();
+}
+
+/**
+ * \brief		The type of an xk::Timer with a single timeout
+ *
+ * Only Type::SingleShot and Type::Periodic convert to it, which is checked at
+ * compile time. Dual-state and sequence timers have constructors of their
+ * own, because they need more than one timeout.
+ */
+class SingleType {
+public:
+	consteval SingleType(Type type) : type_(type)
+	{
+		// A throw is not a constant expression, so this does not compile
+		if (type != Type::SingleShot && type != Type::Periodic) {
+			throw "Use the dual-state or sequence constructor of xk::Timer";
+		}
+	}
+
+	constexpr operator Type() const { return type_; }
+
+private:
+	Type type_;
+};
+
+/**
+ * \brief		The part of xk::Timer that does not depend on the callable
+ *
+ * The xktimer_t is the first member, so a pointer to it can be turned back
+ * into a pointer to the TimerBase.
+ */
+class TimerBase {
+public:
+	TimerBase(const TimerBase &) = delete;
+	TimerBase & operator=(const TimerBase &) = delete;
+
+	//! Removes the timer from its set, if it was added to one
+	~TimerBase()
+	{
+		if (timer_.ctx != nullptr) {
+			xktimer_remove(&timer_);
+		}
+	}
+
+	//! Same as xktimer_start()
+	void start() { xktimer_start(&timer_); }
+
+	//! Same as xktimer_stop()
+	void stop() { xktimer_stop(&timer_); }
+
+	//! Same as xktimer_touch()
+	void touch() { xktimer_touch(&timer_); }
+
+	//! Same as xktimer_running()
+	bool running() const { return timer_.enabled; }
+
+	//! The state of a dual-state timer, 0 or 1, or the step of a sequence timer
+	int state() const { return timer_.state; }
+
+	//! Same as xktimer_set_timeout_ns()
+	template <class Rep, class Period>
+	void set_timeout(std::chrono::duration<Rep, Period> timeout)
+	{
+		xktimer_set_timeout_ns(&timer_, to_ns(timeout));
+	}
+
+	//! Same as xktimer_set_timeout_dual_ns()
+	template <class Rep, class Period, class Rep2, class Period2>
+	void set_timeout(std::chrono::duration<Rep, Period> timeout,
+					 std::chrono::duration<Rep2, Period2> timeout2)
+	{
+		xktimer_set_timeout_dual_ns(&timer_, to_ns(timeout), to_ns(timeout2));
+	}
+
+	//! Same as xktimer_set_slack()
+	template <class Rep, class Period>
+	void set_slack(std::chrono::duration<Rep, Period> slack)
+	{
+		xktimer_set_slack(&timer_, to_ms(slack));
+	}
+
+	//! Same as xktimer_set_overrun()
+	void set_overrun(Overrun policy)
+	{
+		xktimer_set_overrun(&timer_, static_cast<uint8_t>(policy));
+	}
+
+	//! Same as xktimer_missed()
+	uint32_t missed() const { return timer_.missed; }
+
+	//! The underlying C timer
+	xktimer_ptr_t get() { return &timer_; }
+
+protected:
+	//! The timeouts are in ticks
+	TimerBase(Type type,
+			  xktimer_span_t timeout,
+			  xktimer_span_t timeout2,
+			  void (*invoke)(TimerBase *, int))
+		: invoke_(invoke)
+	{
+		timer_.type = static_cast<uint8_t>(type);
+		timer_.timeout = timeout;
+		timer_.timeout2 = timeout2;
+	}
+
+	xktimer_t timer_ {};
+
+	//! Calls the callable of the xk::Timer this is part of
+	void (*invoke_)(TimerBase *, int);
+
+	friend class TimerSet;
+
+private:
+	template <class Rep, class Period>
+	static uint64_t to_ns(std::chrono::duration<Rep, Period> d)
+	{
+		return static_cast<uint64_t>(
+			std::chrono::ceil<std::chrono::nanoseconds>(d).count());
+	}
+};
+
+/**
+ * \brief		A timer that calls the given callable when it times out
+ *
+ * The callable can take the state of the timer as an int, or no arguments.
+ */
+template <class F>
+class Timer : public TimerBase {
+public:
+	//! Create a single shot or periodic timer, the type must be a constant.
+	//! It must be started to run.
+	template <class Rep, class Period>
+	Timer(SingleType type, std::chrono::duration<Rep, Period> timeout, F fn)
+		: TimerBase(type, to_ticks(timeout), 0, &Timer::invoke),
+		  fn_(std::move(fn))
+	{
+	}
+
+	//! Create a dual-state timer. It must be started to run.
+	template <class Rep, class Period, class Rep2, class Period2>
+	Timer(std::chrono::duration<Rep, Period> timeout,
+		  std::chrono::duration<Rep2, Period2> timeout2,
+		  F fn)
+		: TimerBase(Type::DualState, to_ticks(timeout), to_ticks(timeout2),
+					&Timer::invoke),
+		  fn_(std::move(fn))
+	{
+	}
+
+	//! Create a sequence timer with the timeouts in ms. The array must
+	//! outlive the timer. It must be started to run.
+	template <std::size_t N>
+	Timer(const uint32_t (&sequence)[N], F fn)
+		: TimerBase(Type::Sequence, 0, 0, &Timer::invoke),
+		  fn_(std::move(fn))
+	{
+		static_assert(N > 0 && N <= 255, "A sequence has 1 to 255 steps");
+
+		timer_.sequence = sequence;
+		timer_.sequence_len = N;
+	}
+
+	/**
+	 * \brief		Check the timer and call the callable if it timed out
+	 *
+	 * This is the same as xktimer_handle(), but the callable is called
+	 * directly. Use this for timers that are not added to an xk::TimerSet.
+	 *
+	 * \return		true if the timer timed out and the callable was called
+	 */
+	bool poll()
+	{
+		if (!timer_.enabled || !xktimer_reached(xktimer_clock(), timer_.ticks)) {
+			return false;
+		}
+
+		// No callback is set, so this only updates the state and ticks
+		if (!xktimer_handle(&timer_)) {
+			return false;
+		}
+
+		call(timer_.state);
+
+		return true;
+	}
+
+private:
+	void call(int state)
+	{
+		if constexpr (std::is_invocable_v<F &, int>) {
+			fn_(state);
+		} else {
+			static_assert(std::is_invocable_v<F &>,
+						  "The callable must take an int or no arguments");
+			fn_();
+		}
+	}
+
+	static void invoke(TimerBase * base, int state)
+	{
+		static_cast<Timer *>(base)->call(state);
+	}
+
+	[[no_unique_address]] F fn_;
+};
+
+template <class Rep, class Period, class F>
+Timer(SingleType, std::chrono::duration<Rep, Period>, F) -> Timer<F>;
+
+template <class Rep, class Period, class Rep2, class Period2, class F>
+Timer(std::chrono::duration<Rep, Period>,
+	  std::chrono::duration<Rep2, Period2>, F) -> Timer<F>;
+
+template <std::size_t N, class F>
+Timer(const uint32_t (&)[N], F) -> Timer<F>;
+
+//! Poll a fixed set of timers, with every callable called directly
+template <class... F>
+void poll(Timer<F> &... timers)
+{
+	(timers.poll(), ...);
+}
+
+/**
+ * \brief		A set of timers with its own context
+ *
+ * The set must outlive the timers added to it, and the timers must not be
+ * destroyed by the callables of other timers in the same set.
+ */
+class TimerSet {
+public:
+	TimerSet() { xktimer_ctx_init(&ctx_); }
+	~TimerSet() { xktimer_ctx_destroy(&ctx_); }
+
+	TimerSet(const TimerSet &) = delete;
+	TimerSet & operator=(const TimerSet &) = delete;
+
+	/**
+	 * \brief		Add a timer to the set
+	 *
+	 * \return		false if the timer was already added or there is no room
+	 */
+	bool add(TimerBase & timer)
+	{
+		xktimer_ptr_t t = &timer.timer_;
+
+		// The add functions set these fields again, so keep them first
+		xktimer_span_t timeout = t->timeout;
+		xktimer_span_t timeout2 = t->timeout2;
+		xktimer_span_t slack = t->slack;
+		uint8_t overrun = t->overrun;
+		bool added;
+
+		if (t->type == XKTIMER_DUAL_STATE) {
+			added = xktimer_ctx_add_dual(&ctx_, t, 0, 0, nullptr);
+		} else if (t->type == XKTIMER_SEQUENCE) {
+			added = xktimer_ctx_add_sequence(&ctx_, t, t->sequence, 
+											 t->sequence_len, nullptr);
+		} else {
+			added = xktimer_ctx_add(&ctx_, t, t->type, 0, nullptr);
+		}
+
+		if (!added) return false;
+
+		// The timeouts are in ticks, which are a whole number of ns
+		if (t->type == XKTIMER_DUAL_STATE) {
+			xktimer_set_timeout_dual_ns(t, timeout * XKTIMER_NS_PER_TICK, 
+										timeout2 * XKTIMER_NS_PER_TICK);
+		} else if (t->type != XKTIMER_SEQUENCE) {
+			xktimer_set_timeout_ns(t, timeout * XKTIMER_NS_PER_TICK);
+		}
+
+		// Keep a slack and an overrun policy set before the timer was added,
+		// the slack was set in ms
+		if (slack != 0) {
+			xktimer_set_slack(t, static_cast<uint32_t>(
+				slack / XKTIMER_TICKS_PER_MS));
+		}
+		xktimer_set_overrun(t, overrun);
+
+		return true;
+	}
+
+	//! Same as xktimer_remove()
+	bool remove(TimerBase & timer) { return xktimer_remove(&timer.timer_); }
+
+	/**
+	 * \brief		Call the callables of the timers that timed out
+	 *
+	 * Same as xktimer_task(), using xktimer_ctx_collect_expired().
+	 */
+	void task()
+	{
+		xktimer_tick_t now = xktimer_clock();
+		xktimer_ptr_t expired[32];
+		std::size_t count;
+
+		do {
+			count = xktimer_ctx_collect_expired(&ctx_, expired, 32, now);
+
+			for (std::size_t i = 0; i < count; i++) {
+				// An earlier callable could have removed this timer
+				if (expired[i]->ctx != &ctx_) continue;
+
+				TimerBase * base = reinterpret_cast<TimerBase *>(expired[i]);
+				base->invoke_(base, expired[i]->state);
+			}
+		} while (count == 32);
+	}
+
+	//! Same as xktimer_next_deadline()
+	xktimer_tick_t next_deadline() { return xktimer_ctx_next_deadline(&ctx_); }
+
+	//! Same as xktimer_set_default_slack()
+	template <class Rep, class Period>
+	void set_default_slack(std::chrono::duration<Rep, Period> slack)
+	{
+		xktimer_ctx_set_default_slack(&ctx_, to_ms(slack));
+	}
+
+	//! The context of the set
+	xktimer_ctx_t * ctx() { return &ctx_; }
+
+private:
+	xktimer_ctx_t ctx_;
+};
+
+/**
+ * \brief		A timer in an xk::StaticTimers schedule
+ *
+ * The timeouts are in ms. Timeout2 is only used by dual-state timers. The
+ * handler is a function or a lambda without captures, taking the state of the
+ * timer as an int, or no arguments.
+ */
+template <Type T, uint32_t Timeout, auto Handler, uint32_t Timeout2 = 0>
+struct Entry {
+	static_assert(Timeout > 0, "The timeout must not be 0");
+	static_assert(T != Type::DualState || Timeout2 > 0,
+				  "A dual-state timer needs a second timeout");
+	static_assert(T != Type::Sequence,
+				  "A sequence timer can not be in a static schedule");
+
+	static constexpr Type type = T;
+	static constexpr uint32_t timeout = Timeout;
+	static constexpr uint32_t timeout2 = Timeout2;
+
+	//! The time after which the timeouts of the timer repeat
+	static constexpr uint64_t period = T == Type::DualState ?
+		uint64_t(Timeout) + Timeout2 : Timeout;
+
+	static void call(int state)
+	{
+		if constexpr (std::is_invocable_v<decltype(Handler), int>) {
+			Handler(state);
+		} else {
+			static_assert(std::is_invocable_v<decltype(Handler)>,
+						  "The handler must take an int or no arguments");
+			Handler();
+		}
+	}
+};
+
+/**
+ * \brief		A fixed set of timers, scheduled at compile time
+ *
+ * For firmware where every timer is known when it is built. The compiler
+ * works out the hyperperiod of the timers, which is the least common multiple
+ * of the periods of the periodic and dual-state timers, and a table of every
+ * timeout in it, sorted by time. The single shot timers are left out of the
+ * hyperperiod and get a table of their own, which is walked once from
+ * start(). The tables are constexpr, so they are placed in flash. task() walks the table and
+ * calls the handlers directly, so there is no registry, no xktimer_t, no
+ * function pointer and no switch on the timer type.
+ *
+ * The RAM used is the start of the schedule and of the current hyperperiod
+ * and the positions in the tables, whatever the number of timers. At most 32 timers can be in one
+ * schedule, and the number of timeouts in a hyperperiod is limited by
+ * XKTIMER_STATIC_MAX_EVENTS, so periods with a small common multiple must be
+ * used.
+ *
+ * The timeouts are kept relative to start(), so unlike the timers of the
+ * XKTimer module, they do not drift when task() is called late. A late call
+ * runs the handlers that were missed, in order.
+ *
+ * \code
+ * void blink() { led_toggle(); }
+ * void sensor(int state) { sensor_power(state); }
+ *
+ * xk::StaticTimers<
+ *     xk::Entry<xk::Type::Periodic, 500, blink>,
+ *     xk::Entry<xk::Type::DualState, 900, sensor, 100>
+ * > timers;
+ *
+ * timers.start();
+ *
+ * while (1) {
+ *     timers.task();
+ * }
+ * \endcode
+ */
+template <class... Entries>
+class StaticTimers {
+	static_assert(sizeof...(Entries) > 0, "The schedule needs a timer");
+	static_assert(sizeof...(Entries) <= 32,
+				  "A schedule can have at most 32 timers");
+
+	//! The timers that time out at an offset in the hyperperiod
+	struct Event {
+		uint32_t offset;
+		uint32_t mask;
+		uint32_t state;
+	};
+
+	//! The single shot timers only time out once, so they do not repeat
+	static constexpr uint64_t hyperperiod_ = [] {
+		uint64_t h = 1;
+
+		((h = Entries::type == Type::SingleShot ?
+		  h : std::lcm(h, Entries::period)), ...);
+
+		return h;
+	}();
+
+	static_assert(hyperperiod_ <= UINT32_MAX / 2,
+				  "The hyperperiod of the timers is too long");
+
+	//! The number of timeouts of one timer in its table
+	template <class E, bool Once>
+	static constexpr std::size_t count_of()
+	{
+		if constexpr ((E::type == Type::SingleShot) != Once) {
+			return 0;
+		} else if constexpr (E::type == Type::SingleShot) {
+			return 1;
+		} else if constexpr (E::type == Type::Periodic) {
+			return hyperperiod_ / E::period;
+		} else {
+			return hyperperiod_ / E::period * 2;
+		}
+	}
+
+	template <bool Once>
+	static constexpr std::size_t raw_count_ =
+		(count_of<Entries, Once>() + ...);
+
+	static_assert(XKTIMER_STATIC_MAX_EVENTS <= UINT16_MAX,
+				  "XKTIMER_STATIC_MAX_EVENTS must fit the uint16_t position");
+	static_assert(raw_count_<false> <= XKTIMER_STATIC_MAX_EVENTS &&
+				  raw_count_<true> <= XKTIMER_STATIC_MAX_EVENTS,
+				  "Too many timeouts in the hyperperiod, please use periods "
+				  "with a smaller common multiple or raise "
+				  "XKTIMER_STATIC_MAX_EVENTS");
+
+	/*
+	 * Every timeout in a hyperperiod, or of the single shot timers if Once is
+	 * set, sorted, with one event per offset
+	 */
+	template <bool Once>
+	static constexpr auto raw_events()
+	{
+		std::array<Event, raw_count_<Once>> raw {};
+		std::size_t n = 0;
+		uint32_t bit = 1;
+
+		auto add = [&]<class E>(E *) {
+			uint32_t t = 0;
+
+			if constexpr ((E::type == Type::SingleShot) != Once) {
+				// In the other table
+			} else if constexpr (E::type == Type::SingleShot) {
+				raw[n++] = { E::timeout, bit, 0 };
+			} else if constexpr (E::type == Type::Periodic) {
+				while (t < hyperperiod_) {
+					t += E::timeout;
+					raw[n++] = { t, bit, 0 };
+				}
+			} else {
+				// A dual-state timer is called with 1 after the first timeout
+				while (t < hyperperiod_) {
+					t += E::timeout;
+					raw[n++] = { t, bit, bit };
+					t += E::timeout2;
+					raw[n++] = { t, bit, 0 };
+				}
+			}
+
+			bit <<= 1;
+		};
+
+		(add(static_cast<Entries *>(nullptr)), ...);
+
+		std::sort(raw.begin(), raw.end(), [](const Event & a, const Event & b) {
+			return a.offset < b.offset;
+		});
+
+		// Merge the timeouts at the same offset
+		std::size_t count = 0;
+
+		for (std::size_t i = 0; i < raw.size(); i++) {
+			if (count > 0 && raw[count - 1].offset == raw[i].offset) {
+				raw[count - 1].mask |= raw[i].mask;
+				raw[count - 1].state |= raw[i].state;
+			} else {
+				raw[count++] = raw[i];
+			}
+		}
+
+		return std::pair { raw, count };
+	}
+
+	template <bool Once>
+	static constexpr auto table()
+	{
+		constexpr auto raw = raw_events<Once>();
+		std::array<Event, raw.second> events {};
+
+		std::copy_n(raw.first.begin(), raw.second, events.begin());
+
+		return events;
+	}
+
+	//! The timeouts of the periodic and dual-state timers, from base_
+	static constexpr auto events_ = table<false>();
+
+	//! The timeouts of the single shot timers, from start_
+	static constexpr auto once_ = table<true>();
+
+	template <std::size_t... I>
+	static void fire(const Event & event, uint32_t mask,
+					 std::index_sequence<I...>)
+	{
+		((mask & (uint32_t(1) << I) ?
+		  Entries::call((event.state >> I) & 1) : void()), ...);
+	}
+
+public:
+	//! Start the schedule from the current time
+	void start()
+	{
+		start_ = base_ = xktimer_clock();
+		index_ = 0;
+		once_index_ = 0;
+		running_ = true;
+	}
+
+	//! Stop the schedule. start() starts it again from the beginning.
+	void stop() { running_ = false; }
+
+	//! True if the schedule is running
+	bool running() const { return running_; }
+
+	/**
+	 * \brief		Call the handlers of the timers that timed out
+	 *
+	 * Same as xktimer_task(), for the timers of this schedule.
+	 */
+	void task()
+	{
+		if (!running_) return;
+
+		xktimer_tick_t now = xktimer_clock();
+
+		// Run the timeouts of both tables that were missed in order
+		while (true) {
+			xktimer_diff_t late = -1, once_late = -1;
+
+			if constexpr (events_.size() > 0) {
+				late = xktimer_diff(now, base_) -
+					ticks_of(events_[index_].offset);
+			}
+
+			if (once_index_ < once_.size()) {
+				once_late = xktimer_diff(now, start_) -
+					ticks_of(once_[once_index_].offset);
+			}
+
+			if (late < 0 && once_late < 0) break;
+
+			if (once_late > late) {
+				const Event & event = once_[once_index_++];
+
+				fire(event, event.mask, std::index_sequence_for<Entries...> {});
+			} else if constexpr (events_.size() > 0) {
+				const Event & event = events_[index_];
+
+				fire(event, event.mask, std::index_sequence_for<Entries...> {});
+
+				if (++index_ == events_.size()) {
+					index_ = 0;
+					base_ += ticks_of(hyperperiod_);
+				}
+			}
+		}
+
+		// A schedule of single shot timers is done once they have run
+		if (events_.size() == 0 && once_index_ == once_.size()) {
+			running_ = false;
+		}
+	}
+
+	/**
+	 * \brief		The time of the next timeout, like xktimer_next_deadline()
+	 *
+	 * \return		the clock value of the next timeout, or XKTIMER_NO_DEADLINE
+	 * 				if the schedule is not running
+	 */
+	xktimer_tick_t next_deadline() const
+	{
+		if (!running_) return XKTIMER_NO_DEADLINE;
+
+		xktimer_tick_t next = XKTIMER_NO_DEADLINE;
+
+		if constexpr (events_.size() > 0) {
+			next = base_ + ticks_of(events_[index_].offset);
+		}
+
+		if (once_index_ < once_.size()) {
+			xktimer_tick_t once = start_ + ticks_of(once_[once_index_].offset);
+
+			if (events_.size() == 0 || xktimer_diff(once, next) < 0) {
+				next = once;
+			}
+		}
+
+		return next;
+	}
+
+	//! The hyperperiod of the schedule in ms, 1 if every timer is single shot
+	static constexpr uint32_t hyperperiod() { return uint32_t(hyperperiod_); }
+
+	//! The number of entries in the tables of timeouts
+	static constexpr std::size_t size() { return events_.size() + once_.size(); }
+
+private:
+	//! The offsets are in ms, whatever the resolution of the clock
+	static constexpr xktimer_diff_t ticks_of(uint64_t ms)
+	{
+		return xktimer_diff_t(ms * XKTIMER_TICKS_PER_MS);
+	}
+
+	xktimer_tick_t start_ = 0;
+	xktimer_tick_t base_ = 0;
+	uint16_t index_ = 0;
+	uint16_t once_index_ = 0;
+	bool running_ = false;
+};
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+/*
+ * Coroutines
+ *
+ * A coroutine that waits on xk::sleep_for() or xk::with_timeout() is parked
+ * in a timer that is part of the coroutine frame, and is resumed by the
+ * xktimer_task() or xktimer_run() of the context of the timer when it times
+ * out. No callback or heap allocated state is needed per wait.
+ *
+ * The coroutines are resumed from the pass over the timers, so they must run
+ * on the thread that runs the pass of their context, or hold xktimer_lock()
+ * while they start waiting. An xk::TimerSet does not resume coroutines.
+ *
+ * \code
+ * xk::Task<bool> handshake(Link & link)
+ * {
+ *     link.send_hello();
+ *
+ *     while (!link.ready()) {
+ *         co_await xk::sleep_for(10ms);
+ *     }
+ *
+ *     co_return true;
+ * }
+ *
+ * xk::Task<> session(Link & link)
+ * {
+ *     if (!co_await xk::with_timeout(handshake(link), 2s)) {
+ *         link.reset();
+ *     }
+ * }
+ * \endcode
+ */
+
+template <class T = void>
+class Task;
+
+template <class T>
+class TimeoutAwaiter;
+
+namespace detail {
+
+struct PromiseBase {
+	//! The coroutine to resume when the task finishes
+	std::coroutine_handle<> continuation;
+
+	//! The with_timeout() timer to remove when the task finishes
+	xktimer_ptr_t deadline = nullptr;
+
+	struct FinalAwaiter {
+		bool await_ready() noexcept { return false; }
+
+		template <class P>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h)
+			noexcept
+		{
+			PromiseBase & promise = h.promise();
+
+			if (promise.deadline != nullptr) {
+				xktimer_remove(promise.deadline);
+			}
+
+			if (promise.continuation) {
+				return promise.continuation;
+			}
+
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <class T>
+struct Promise : PromiseBase {
+	std::optional<T> value;
+
+	Task<T> get_return_object() noexcept;
+
+	template <class U = T>
+	void return_value(U && v) { value.emplace(std::forward<U>(v)); }
+
+	T take() { return std::move(*value); }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+	Task<void> get_return_object() noexcept;
+
+	void return_void() noexcept {}
+
+	void take() {}
+};
+
+}
+
+/**
+ * \brief		A coroutine that returns a T
+ *
+ * The coroutine does not run until it is awaited with co_await, or started
+ * with start() if no other coroutine waits for it yet. A started task can be
+ * awaited later, co_await then waits for it to return. The frame is destroyed
+ * with the task, even if the coroutine is still waiting, which also removes
+ * the timers it waits on.
+ */
+template <class T>
+class [[nodiscard]] Task {
+public:
+	using promise_type = detail::Promise<T>;
+
+	Task(Task && other) noexcept
+		: handle_(std::exchange(other.handle_, {})),
+		  started_(other.started_)
+	{
+	}
+
+	Task & operator=(Task && other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			handle_ = std::exchange(other.handle_, {});
+			started_ = other.started_;
+		}
+
+		return *this;
+	}
+
+	~Task() { reset(); }
+
+	//! Run a task that is not awaited to its first wait
+	void start()
+	{
+		if (handle_ && !started_) {
+			started_ = true;
+			handle_.resume();
+		}
+	}
+
+	//! True once the coroutine has returned
+	bool done() const { return !handle_ || handle_.done(); }
+
+	struct Awaiter {
+		std::coroutine_handle<promise_type> handle;
+
+		//! True if the task was started before, so it is waiting already
+		bool started;
+
+		bool await_ready() const noexcept { return !handle || handle.done(); }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+			noexcept
+		{
+			handle.promise().continuation = h;
+
+			// A started task is resumed by what it waits on, not by us
+			if (started) {
+				return std::noop_coroutine();
+			}
+
+			return handle;
+		}
+
+		T await_resume() { return handle.promise().take(); }
+	};
+
+	//! Run the task and wait for it to return
+	Awaiter operator co_await() && noexcept
+	{
+		return Awaiter { handle_, std::exchange(started_, true) };
+	}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle)
+		: handle_(handle)
+	{
+	}
+
+	void reset()
+	{
+		if (handle_) {
+			std::exchange(handle_, {}).destroy();
+		}
+	}
+
+	std::coroutine_handle<promise_type> handle_;
+	bool started_ = false;
+
+	friend promise_type;
+	friend class TimeoutAwaiter<T>;
+};
+
+namespace detail {
+
+template <class T>
+Task<T> Promise<T>::get_return_object() noexcept
+{
+	return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+	return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+}
+
+}
+
+/**
+ * \brief		The awaitable returned by xk::sleep_for()
+ *
+ * co_await returns false without waiting if the timer could not be added.
+ */
+class SleepAwaiter {
+public:
+	//! The timeout is in ticks
+	SleepAwaiter(xktimer_ctx_t * ctx, xktimer_span_t timeout)
+		: ctx_(ctx), timeout_(timeout)
+	{
+	}
+
+	SleepAwaiter(const SleepAwaiter &) = delete;
+	SleepAwaiter & operator=(const SleepAwaiter &) = delete;
+
+	~SleepAwaiter()
+	{
+		if (timer_.ctx != nullptr) {
+			xktimer_remove(&timer_);
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		if (!xktimer_ctx_add(ctx_, &timer_, XKTIMER_SINGLE_SHOT, 0, nullptr)) {
+			return false;
+		}
+
+		timer_.timeout = timeout_;
+		xktimer_set_handler(&timer_, &SleepAwaiter::wake, h.address());
+		xktimer_start(&timer_);
+		slept_ = true;
+
+		return true;
+	}
+
+	bool await_resume() const noexcept { return slept_; }
+
+private:
+	static void wake(xktimer_ptr_t timer)
+	{
+		xktimer_remove(timer);
+		std::coroutine_handle<>::from_address(timer->data).resume();
+	}
+
+	xktimer_t timer_ {};
+	xktimer_ctx_t * ctx_;
+	xktimer_span_t timeout_;
+	bool slept_ = false;
+};
+
+/**
+ * \brief		The awaitable returned by xk::with_timeout()
+ *
+ * co_await returns the result of the task as a std::optional, or true for a
+ * Task<void>, if it returned in time. If the timeout comes first, the task is
+ * destroyed where it waits and co_await returns std::nullopt or false. If the
+ * timer could not be added, the task runs without a timeout.
+ */
+template <class T>
+class TimeoutAwaiter {
+	using Result = std::conditional_t<std::is_void_v<T>, bool,
+									  std::optional<T>>;
+
+public:
+	//! The timeout is in ticks
+	TimeoutAwaiter(xktimer_ctx_t * ctx, Task<T> && op, xktimer_span_t timeout)
+		: op_(std::move(op)), ctx_(ctx), timeout_(timeout)
+	{
+	}
+
+	TimeoutAwaiter(const TimeoutAwaiter &) = delete;
+	TimeoutAwaiter & operator=(const TimeoutAwaiter &) = delete;
+
+	~TimeoutAwaiter()
+	{
+		if (timer_.ctx != nullptr) {
+			xktimer_remove(&timer_);
+		}
+	}
+
+	bool await_ready() const noexcept { return op_.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> h)
+	{
+		auto & promise = op_.handle_.promise();
+
+		continuation_ = h;
+		promise.continuation = h;
+
+		if (xktimer_ctx_add(ctx_, &timer_, XKTIMER_SINGLE_SHOT, 0, nullptr)) {
+			timer_.timeout = timeout_;
+			xktimer_set_handler(&timer_, &TimeoutAwaiter::expire, this);
+			xktimer_start(&timer_);
+
+			// The task removes the timer if it returns first
+			promise.deadline = &timer_;
+		}
+
+		if (std::exchange(op_.started_, true)) {
+			return std::noop_coroutine();
+		}
+
+		return op_.handle_;
+	}
+
+	Result await_resume()
+	{
+		if (timed_out_) {
+			return Result {};
+		}
+
+		if constexpr (std::is_void_v<T>) {
+			return true;
+		} else {
+			return Result { op_.handle_.promise().take() };
+		}
+	}
+
+private:
+	static void expire(xktimer_ptr_t timer)
+	{
+		TimeoutAwaiter * self = static_cast<TimeoutAwaiter *>(timer->data);
+
+		xktimer_remove(timer);
+		self->timed_out_ = true;
+
+		// Destroying the frame also removes the timers the task waits on
+		self->op_.reset();
+		self->continuation_.resume();
+	}
+
+	Task<T> op_;
+	xktimer_t timer_ {};
+	xktimer_ctx_t * ctx_;
+	std::coroutine_handle<> continuation_;
+	xktimer_span_t timeout_;
+	bool timed_out_ = false;
+};
+
+//! Wait for the given time in a coroutine, on the given context
+template <class Rep, class Period>
+SleepAwaiter sleep_for(xktimer_ctx_t * ctx,
+					   std::chrono::duration<Rep, Period> timeout)
+{
+	return SleepAwaiter(ctx, to_ticks(timeout));
+}
+
+//! Wait for the given time in a coroutine, on the default context
+template <class Rep, class Period>
+SleepAwaiter sleep_for(std::chrono::duration<Rep, Period> timeout)
+{
+	return SleepAwaiter(xktimer_default_ctx(), to_ticks(timeout));
+}
+
+//! Run a task with a timeout, on the given context
+template <class T, class Rep, class Period>
+TimeoutAwaiter<T> with_timeout(xktimer_ctx_t * ctx,
+							   Task<T> op,
+							   std::chrono::duration<Rep, Period> timeout)
+{
+	return TimeoutAwaiter<T>(ctx, std::move(op), to_ticks(timeout));
+}
+
+//! Run a task with a timeout, on the default context
+template <class T, class Rep, class Period>
+TimeoutAwaiter<T> with_timeout(Task<T> op,
+							   std::chrono::duration<Rep, Period> timeout)
+{
+	return TimeoutAwaiter<T>(xktimer_default_ctx(), std::move(op),
+							 to_ticks(timeout));
+}
+
+#endif
+
+}
+
+#endif
+
 #endif
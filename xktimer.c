@@ -32,6 +32,12 @@
  *
  ******************************************************************************/
 
+#if (defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_CLOCK) || \
+	 defined(XKTIMER_SERVICE) || defined(XKTIMER_WAIT_HYBRID)) && \
+	!defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 /* Standard Library Includes */
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,264 +45,4500 @@
 #include <stdbool.h>
 #include <string.h>
 
-/* Time Includes */
-#include <time.h>
+/* Time Includes */
+#include <time.h>
+
+#if defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_WAIT_HYBRID)
+#include <errno.h>
+#endif
+
+#if defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_DISPATCH)
+#include <pthread.h>
+#endif
+
+#ifdef XKTIMER_SERVICE
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef XKTIMER_FD
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+#ifdef XKTIMER_PERSIST
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(XKTIMER_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define XKTIMER_TRACE_USDT
+#endif
+#endif
+
+#ifdef XKTIMER_SOA
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#endif
+
+#include "includes.h"
+
+#include "xktimer.h"
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif !defined(__aarch64__)
+#error "XKTIMER_CLOCK_TSC is only supported on x86 and ARMv8"
+#endif
+#endif
+
+#if defined(XKTIMER_STATS) && !defined(XKTIMER_STATS_COUNTER)
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//! Read the counter used to time the callbacks
+#define XKTIMER_STATS_COUNTER()		xktimer_tsc()
+#define XKTIMER_STATS_TSC
+#else
+#define XKTIMER_STATS_COUNTER()		((uint64_t)xktimer_clock())
+#endif
+#endif
+
+//! The context used by the functions that don't take a context
+xktimer_ctx_t	xktimer_ctx_default;
+
+//! TRUE once xktimer_init() has set up the default context
+static bool		xktimer_initialized = false;
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+//! The counter value at calibration time
+uint64_t		xktimer_tsc_base;
+
+//! The time in ticks at calibration time
+xktimer_tick_t	xktimer_tsc_base_ticks;
+
+//! Counter ticks to clock ticks multiplier, scaled up by xktimer_tsc_shift
+uint64_t		xktimer_tsc_mult;
+
+//! The number of fraction bits of xktimer_tsc_mult
+unsigned int	xktimer_tsc_shift;
+#endif
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_CUSTOM
+//! The clock source set with xktimer_set_clock()
+xktimer_tick_t	(*xktimer_clock_source)();
+#endif
+
+#ifdef XKTIMER_TICKLESS
+//! The deadline the compare register is set for, or XKTIMER_NO_DEADLINE
+xktimer_tick_t	xktimer_hw_deadline = XKTIMER_NO_DEADLINE;
+
+//! Set once a timer of the default context is due, cleared by a pass
+volatile bool	xktimer_hw_pending = false;
+#endif
+
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC || defined(XKTIMER_STATS_TSC)
+static inline uint64_t xktimer_tsc()
+{
+#ifdef __aarch64__
+	uint64_t ticks;
+
+	__asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (ticks));
+	return ticks;
+#else
+	return __rdtsc();
+#endif
+}
+#endif
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+static uint64_t xktimer_monotonic_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * \brief			Read the counter at the same time as CLOCK_MONOTONIC
+ *
+ * The counter is read before and after the clock, and the closest of a few
+ * tries is kept, so an interrupt in between does not skew the pair.
+ */
+static uint64_t xktimer_tsc_sample(uint64_t * ns)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t tsc = 0;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t before = xktimer_tsc();
+		uint64_t now = xktimer_monotonic_ns();
+		uint64_t after = xktimer_tsc();
+
+		if (after - before < best) {
+			best = after - before;
+			tsc = before + best / 2;
+			*ns = now;
+		}
+	}
+
+	return tsc;
+}
+
+/**
+ * \brief			Find the counter frequency for XKTIMER_CLOCK_TSC
+ */
+static void xktimer_tsc_calibrate()
+{
+	uint64_t freq;
+	uint64_t now_ns;
+
+#ifdef __aarch64__
+	// The generic timer reports its own frequency
+	__asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (freq));
+	xktimer_tsc_base = xktimer_tsc_sample(&now_ns);
+#else
+	uint64_t start_ns;
+	uint64_t start = xktimer_tsc_sample(&start_ns);
+
+	do {
+		xktimer_tsc_base = xktimer_tsc_sample(&now_ns);
+	} while (now_ns - start_ns < XKTIMER_TSC_CALIBRATE_MS * 1000000ULL);
+
+	freq = (xktimer_tsc_base - start) * 1000000000ULL / (now_ns - start_ns);
+#endif
+
+	// The base is one pair, moved back to the last tick of CLOCK_MONOTONIC
+	// so both clocks tick at the same time
+	xktimer_tsc_base_ticks = (xktimer_tick_t)(now_ns / XKTIMER_NS_PER_TICK);
+	xktimer_tsc_base -= (now_ns % XKTIMER_NS_PER_TICK) * freq / 1000000000ULL;
+
+	// Long division of XKTIMER_RESOLUTION by freq, one fraction bit at a
+	// time for as many bits as fit, so a slow resolution keeps its precision
+	{
+		uint64_t mult = XKTIMER_RESOLUTION / freq;
+		uint64_t rem = XKTIMER_RESOLUTION % freq;
+		unsigned int shift = 0;
+
+		while (shift < 63 && mult < (1ULL << 62)) {
+			rem <<= 1;
+			mult = (mult << 1) | (rem >= freq);
+			if (rem >= freq) rem -= freq;
+			shift++;
+		}
+
+		xktimer_tsc_mult = mult;
+		xktimer_tsc_shift = shift;
+	}
+}
+
+//! Convert counter ticks to clock ticks, (delta * mult) >> shift in 128 bits
+static inline uint64_t xktimer_tsc_scale(uint64_t delta)
+{
+#ifdef __SIZEOF_INT128__
+	return (uint64_t)(((unsigned __int128)delta * xktimer_tsc_mult) >> 
+					  xktimer_tsc_shift);
+#else
+	uint64_t a_lo = delta & 0xFFFFFFFFULL, a_hi = delta >> 32;
+	uint64_t b_lo = xktimer_tsc_mult & 0xFFFFFFFFULL;
+	uint64_t b_hi = xktimer_tsc_mult >> 32;
+	uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+	uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+	uint64_t mid = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + 
+				   (lo_hi & 0xFFFFFFFFULL);
+	uint64_t hi = hi_hi + (hi_lo >> 32) + (lo_hi >> 32) + (mid >> 32);
+	uint64_t lo = (mid << 32) | (lo_lo & 0xFFFFFFFFULL);
+
+	if (xktimer_tsc_shift == 0) return lo;
+
+	return (hi << (64 - xktimer_tsc_shift)) | (lo >> xktimer_tsc_shift);
+#endif
+}
+#endif
+
+#ifdef XKTIMER_WHEEL
+//! The bucket of the first wheel level that a ticks value falls in
+#define xktimer_wheel_slot(ticks)	\
+	((xktimer_tick_t)((xktimer_utick_t)(ticks) >> XKTIMER_WHEEL_GRAIN_BITS))
+#endif
+
+#if defined(XKTIMER_SOA) && !defined(XKTIMER_NO_MALLOC)
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define XKTIMER_SOA_ALIGNED_ALLOC
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200112L
+#define XKTIMER_SOA_POSIX_MEMALIGN
+#elif !defined(__SSE2__)
+#error "XKTIMER_SOA needs C11, POSIX or _mm_malloc(), or XKTIMER_NO_MALLOC"
+#endif
+
+/**
+ * \brief			Allocate one of the SoA arrays, aligned for the vector loads
+ *
+ * aligned_alloc() is only there from C11 on, so older standards use
+ * posix_memalign(), or _mm_malloc() on x86 if that is not there either.
+ */
+static void * xktimer_soa_alloc(size_t bytes)
+{
+#if defined(XKTIMER_SOA_ALIGNED_ALLOC)
+	return aligned_alloc(32, bytes);
+#elif defined(XKTIMER_SOA_POSIX_MEMALIGN)
+	void * ptr;
+
+	return posix_memalign(&ptr, 32, bytes) == 0 ? ptr : NULL;
+#else
+	return _mm_malloc(bytes, 32);
+#endif
+}
+
+//! Free an array from xktimer_soa_alloc()
+#if defined(XKTIMER_SOA_ALIGNED_ALLOC) || defined(XKTIMER_SOA_POSIX_MEMALIGN)
+#define xktimer_soa_free(ptr)		free(ptr)
+#else
+#define xktimer_soa_free(ptr)		_mm_free(ptr)
+#endif
+#endif
+
+#if !defined(XKTIMER_NO_MALLOC) && !defined(XKTIMER_INTRUSIVE)
+//! Free the arrays allocated for a context
+static void xktimer_ctx_free(xktimer_ctx_t * ctx)
+{
+    free(ctx->ref);
+    free(ctx->ref_free);
+    ctx->ref = NULL;
+    ctx->ref_free = NULL;
+    ctx->ref_size = 0;
+
+#ifdef XKTIMER_SOA
+    xktimer_soa_free(ctx->soa_deadline);
+    xktimer_soa_free(ctx->soa_enabled);
+    ctx->soa_deadline = NULL;
+    ctx->soa_enabled = NULL;
+#endif
+
+#ifdef XKTIMER_HEAP
+    free(ctx->heap);
+    ctx->heap = NULL;
+    ctx->heap_size = 0;
+#endif
+}
+#endif
+
+void xktimer_init()
+{
+    // Release the memory, the loop lock and the timerfd of a previous
+    // xktimer_init(), which would leak or be initialized twice otherwise
+    if (xktimer_initialized) {
+        xktimer_ctx_destroy(&xktimer_ctx_default);
+    }
+
+    xktimer_ctx_init(&xktimer_ctx_default);
+    xktimer_initialized = true;
+
+#ifdef XKTIMER_TICKLESS
+    XKTIMER_HW_COMPARE_STOP();
+    xktimer_hw_deadline = XKTIMER_NO_DEADLINE;
+    xktimer_hw_pending = false;
+#endif
+    
+#ifdef DEBUG
+    printf("XKTimer Init\n");
+    printf("Timer Resolution: %d\n", XKTIMER_RESOLUTION);
+    printf("Clocks Per Sec: %ld\n", CLOCKS_PER_SEC);
+#endif
+}
+
+void xktimer_ctx_init(xktimer_ctx_t * ctx)
+{
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+    if (xktimer_tsc_mult == 0) {
+        xktimer_tsc_calibrate();
+    }
+#endif
+
+#ifdef XKTIMER_INTRUSIVE
+    ctx->list = NULL;
+    ctx->list_iter = NULL;
+#else
+    ctx->ref_idx = 0;
+    ctx->ref_free_len = 0;
+#ifndef XKTIMER_NO_MALLOC
+    // The registry grows on demand as timers are added
+    ctx->ref = NULL;
+    ctx->ref_free = NULL;
+    ctx->ref_size = 0;
+#ifdef XKTIMER_SOA
+    ctx->soa_deadline = NULL;
+    ctx->soa_enabled = NULL;
+#endif
+#elif defined(XKTIMER_SOA)
+    memset(ctx->soa_enabled, 0, sizeof(ctx->soa_enabled));
+#endif
+#ifdef XKTIMER_SOA
+    // The first pass moves the base to its time
+    ctx->soa_base = 0;
+#endif
+#endif
+
+#ifdef XKTIMER_WHEEL
+    memset(ctx->wheel, 0, sizeof(ctx->wheel));
+    ctx->wheel_due = NULL;
+    ctx->wheel_near = NULL;
+    ctx->wheel_tick = xktimer_wheel_slot(xktimer_clock());
+    ctx->wheel_count = 0;
+#endif
+
+#ifdef XKTIMER_HEAP
+#ifdef XKTIMER_INTRUSIVE
+    ctx->heap_root = NULL;
+#else
+    ctx->heap_len = 0;
+#ifndef XKTIMER_NO_MALLOC
+    ctx->heap = NULL;
+    ctx->heap_size = 0;
+#endif
+#endif
+    ctx->heap_pass = 0;
+    ctx->heap_defer = NULL;
+#endif
+
+    ctx->pass_now = 0;
+    ctx->pass_active = false;
+    ctx->slack = XKTIMER_MS_TICKS(XKTIMER_DEFAULT_SLACK);
+
+#ifdef XKTIMER_STATS
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+#endif
+
+#ifdef XKTIMER_BUDGET
+    {
+        int i;
+
+        for (i = 0; i < XKTIMER_PRIORITIES; i++) {
+            ctx->ready[i] = NULL;
+            ctx->ready_tail[i] = &ctx->ready[i];
+        }
+
+        ctx->ready_len = 0;
+    }
+#endif
+
+#ifdef XKTIMER_DISPATCH
+    ctx->pool = NULL;
+    ctx->pool_worker = -1;
+#endif
+
+#ifdef XKTIMER_PERSIST
+    ctx->persist_wall = 0;
+    ctx->persist_tick = 0;
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+    {
+        int i;
+
+        // Slot i is free for the producer that claims position i
+        for (i = 0; i < XKTIMER_CMD_QUEUE_SIZE; i++) {
+            ctx->cmd[i].seq = i;
+        }
+
+        ctx->cmd_head = 0;
+        ctx->cmd_tail = 0;
+#ifdef XKTIMER_FD
+        ctx->cmd_kick = false;
+#endif
+    }
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+    {
+        pthread_mutexattr_t mutex_attr;
+        pthread_condattr_t cond_attr;
+
+        pthread_mutexattr_init(&mutex_attr);
+        pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&ctx->loop_mutex, &mutex_attr);
+        pthread_mutexattr_destroy(&mutex_attr);
+
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&ctx->loop_cond, &cond_attr);
+        pthread_condattr_destroy(&cond_attr);
+
+        ctx->loop_sleeping = false;
+        ctx->loop_quit = false;
+    }
+#endif
+
+#ifdef XKTIMER_FD
+    ctx->fd = -1;
+    ctx->fd_deadline = XKTIMER_NO_DEADLINE;
+#endif
+}
+
+void xktimer_ctx_destroy(xktimer_ctx_t * ctx)
+{
+#if !defined(XKTIMER_NO_MALLOC) && !defined(XKTIMER_INTRUSIVE)
+    xktimer_ctx_free(ctx);
+#else
+    (void)ctx;
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+    pthread_cond_destroy(&ctx->loop_cond);
+    pthread_mutex_destroy(&ctx->loop_mutex);
+#endif
+
+#ifdef XKTIMER_FD
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+#endif
+}
+
+xktimer_ctx_t * xktimer_default_ctx()
+{
+    return &xktimer_ctx_default;
+}
+
+bool xktimer_assert(xktimer_ptr_t timer)
+{
+	return timer != NULL;
+}
+
+#ifdef XKTIMER_TRACE
+/**
+ * \name Trace Events
+ */
+//! @{
+#define XKTIMER_TRACE_ADD			0
+#define XKTIMER_TRACE_START			1
+#define XKTIMER_TRACE_STOP			2
+#define XKTIMER_TRACE_FIRE			3
+#define XKTIMER_TRACE_CALL			4
+#define XKTIMER_TRACE_CALL_END		5
+//! @}
+
+//! One event recorded by the trace
+typedef struct {
+	//! The CLOCK_MONOTONIC time of the event in ns
+	uint64_t ns;
+
+	//! The timer, only used as a name since it could be freed by now
+	const void * timer;
+
+	//! One of the XKTIMER_TRACE_* trace events
+	uint8_t event;
+
+	//! The state of the timer at the time of the event
+	uint8_t state;
+} xktimer_trace_event_t;
+
+//! The events recorded by one thread
+typedef struct {
+	xktimer_trace_event_t events[XKTIMER_TRACE_SIZE];
+
+	//! The number of events recorded, only written by the owner thread
+	unsigned long head;
+} xktimer_trace_ring_t;
+
+//! The rings handed out to the threads that record events
+static xktimer_trace_ring_t xktimer_trace_rings[XKTIMER_TRACE_THREADS];
+
+//! The number of rings handed out, can go past XKTIMER_TRACE_THREADS
+static unsigned int xktimer_trace_used;
+
+//! The number of events dropped because their thread has no ring
+static unsigned long xktimer_trace_lost;
+
+//! The ring of the calling thread, or NULL if it has none yet
+static __thread xktimer_trace_ring_t * xktimer_trace_ring;
+
+//! TRUE once the calling thread found all of the rings taken
+static __thread bool xktimer_trace_full;
+
+//! The time of an event in ns
+static inline uint64_t xktimer_trace_ns()
+{
+#if defined(__unix__) || defined(__APPLE__)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+	return (uint64_t)(xktimer_utick_t)xktimer_clock() * XKTIMER_NS_PER_TICK;
+#endif
+}
+
+//! Record an event in the ring of the calling thread
+static void xktimer_trace_write(uint8_t event, const void * timer, 
+								uint8_t state)
+{
+	xktimer_trace_ring_t * ring = xktimer_trace_ring;
+	xktimer_trace_event_t * entry;
+	unsigned long head;
+
+	if (ring == NULL) {
+		unsigned int idx;
+
+		if (!xktimer_trace_full) {
+			idx = __atomic_fetch_add(&xktimer_trace_used, 1, __ATOMIC_RELAXED);
+			if (idx < XKTIMER_TRACE_THREADS) {
+				ring = xktimer_trace_ring = &xktimer_trace_rings[idx];
+			} else {
+				xktimer_trace_full = true;
+			}
+		}
+
+		if (ring == NULL) {
+			__atomic_fetch_add(&xktimer_trace_lost, 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+
+	head = ring->head;
+	entry = &ring->events[head & (XKTIMER_TRACE_SIZE - 1)];
+	entry->ns = xktimer_trace_ns();
+	entry->timer = timer;
+	entry->event = event;
+	entry->state = state;
+
+	// Publish the event to xktimer_trace_dump()
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef XKTIMER_TRACE_USDT
+//! Fire the USDT probe of an event and record it
+#define xktimer_trace(probe, event, timer, state)			\
+	do {													\
+		DTRACE_PROBE2(xktimer, probe, timer, state);		\
+		xktimer_trace_write(event, timer, state);			\
+	} while (0)
+#else
+//! Record an event, there is no USDT probe to fire on this platform
+#define xktimer_trace(probe, event, timer, state)			\
+	xktimer_trace_write(event, timer, state)
+#endif
+#endif
+
+#ifdef XKTIMER_WHEEL
+static void xktimer_link(xktimer_ctx_t * ctx, xktimer_ptr_t * head,
+						 xktimer_ptr_t timer)
+{
+	timer->next = *head;
+	if (*head) {
+		(*head)->pprev = &timer->next;
+	}
+	*head = timer;
+	timer->pprev = head;
+
+	ctx->wheel_count++;
+}
+
+static void xktimer_unlink(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	if (timer->pprev == NULL) return;
+
+	*timer->pprev = timer->next;
+	if (timer->next) {
+		timer->next->pprev = timer->pprev;
+	}
+	timer->next = NULL;
+	timer->pprev = NULL;
+
+	ctx->wheel_count--;
+}
+
+static void xktimer_wheel_insert(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	xktimer_tick_t expires = xktimer_wheel_slot(timer->ticks);
+	xktimer_diff_t delta = xktimer_diff(expires, ctx->wheel_tick);
+	int level;
+
+	if (delta < 0) {
+		// The bucket was already processed, so check it on the next pass
+		xktimer_link(ctx, &ctx->wheel_near, timer);
+		return;
+	}
+
+	// Find the lowest level that covers the deadline
+	for (level = 0; level < XKTIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < (1L << (XKTIMER_WHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	// Park timers beyond the range of the wheel in the farthest bucket
+	if (delta >= (1L << (XKTIMER_WHEEL_BITS * XKTIMER_WHEEL_LEVELS))) {
+		expires = xktimer_ticks_after(ctx->wheel_tick, 
+			(1L << (XKTIMER_WHEEL_BITS * XKTIMER_WHEEL_LEVELS)) - 1);
+	}
+
+	xktimer_link(ctx, &ctx->wheel[level][(expires >> (XKTIMER_WHEEL_BITS * level)) & 
+									   XKTIMER_WHEEL_MASK],
+				 timer);
+}
+
+static void xktimer_wheel_cascade(xktimer_ctx_t * ctx, int level, int idx)
+{
+	xktimer_ptr_t timer;
+
+	// Move each timer in the bucket down to a lower level
+	while ((timer = ctx->wheel[level][idx]) != NULL) {
+		xktimer_unlink(ctx, timer);
+		xktimer_wheel_insert(ctx, timer);
+	}
+}
+
+static void xktimer_wheel_advance(xktimer_ctx_t * ctx, xktimer_tick_t now)
+{
+	xktimer_tick_t slot = xktimer_wheel_slot(now);
+	xktimer_ptr_t timer;
+	int level, idx;
+
+	if (ctx->wheel_count == 0) {
+		// Nothing is running, so just catch up with the clock
+		ctx->wheel_tick = xktimer_ticks_after(slot, 1);
+		return;
+	}
+
+	// Check the timers that were not due on the last pass again
+	while ((timer = ctx->wheel_near) != NULL) {
+		xktimer_unlink(ctx, timer);
+		xktimer_link(ctx, &ctx->wheel_due, timer);
+	}
+
+	while (xktimer_diff(ctx->wheel_tick, slot) <= 0) {
+		idx = ctx->wheel_tick & XKTIMER_WHEEL_MASK;
+
+		// Cascade the upper levels each time the level below wraps around
+		if (idx == 0) {
+			for (level = 1; level < XKTIMER_WHEEL_LEVELS; level++) {
+				int upper = (ctx->wheel_tick >> (XKTIMER_WHEEL_BITS * level)) & 
+							XKTIMER_WHEEL_MASK;
+
+				xktimer_wheel_cascade(ctx, level, upper);
+				if (upper != 0) {
+					break;
+				}
+			}
+		}
+
+		// Move the timers for this tick to the due list
+		while ((timer = ctx->wheel[0][idx]) != NULL) {
+			xktimer_unlink(ctx, timer);
+			xktimer_link(ctx, &ctx->wheel_due, timer);
+		}
+
+		ctx->wheel_tick = xktimer_ticks_after(ctx->wheel_tick, 1);
+	}
+}
+#endif
+
+#ifdef XKTIMER_HEAP
+//! Returns true if timer a times out before timer b
+#define xktimer_before(a, b)	(xktimer_diff((a)->ticks, (b)->ticks) < 0)
+
+#ifdef XKTIMER_INTRUSIVE
+//! Returns the next timer to time out, or NULL if the heap is empty
+#define xktimer_heap_top()		(ctx->heap_root)
+
+//! Returns true if the timer is in the heap
+#define xktimer_heap_contains(timer)	\
+	((timer)->heap_prev != NULL || ctx->heap_root == (timer))
+
+/**
+ * \brief			Merge two heaps whose roots have no siblings
+ */
+static xktimer_ptr_t xktimer_heap_meld(xktimer_ptr_t a, xktimer_ptr_t b)
+{
+	xktimer_ptr_t root;
+
+	if (a == NULL) return b;
+	if (b == NULL) return a;
+
+	if (xktimer_before(b, a)) {
+		root = b;
+		b = a;
+	} else {
+		root = a;
+	}
+
+	// The later root becomes the first child of the earlier one
+	b->heap_prev = root;
+	b->heap_next = root->heap_child;
+	if (root->heap_child) {
+		root->heap_child->heap_prev = b;
+	}
+	root->heap_child = b;
+
+	return root;
+}
+
+/**
+ * \brief			Merge a list of sibling heaps into one heap
+ *
+ * This is the standard two pass pairing: siblings are first melded in pairs
+ * from left to right, then the pairs are melded from right to left.
+ */
+static xktimer_ptr_t xktimer_heap_merge_pairs(xktimer_ptr_t first)
+{
+	xktimer_ptr_t pairs = NULL;
+	xktimer_ptr_t root = NULL;
+	xktimer_ptr_t a, b;
+
+	while ((a = first) != NULL) {
+		b = a->heap_next;
+		first = b ? b->heap_next : NULL;
+
+		a->heap_next = a->heap_prev = NULL;
+		if (b) {
+			b->heap_next = b->heap_prev = NULL;
+		}
+
+		// Push the melded pair, the stack reverses the order
+		a = xktimer_heap_meld(a, b);
+		a->heap_next = pairs;
+		pairs = a;
+	}
+
+	while ((a = pairs) != NULL) {
+		pairs = a->heap_next;
+		a->heap_next = NULL;
+		root = xktimer_heap_meld(root, a);
+	}
+
+	return root;
+}
+
+static void xktimer_heap_insert(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+	ctx->heap_root = xktimer_heap_meld(ctx->heap_root, timer);
+}
+
+static void xktimer_heap_remove(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	xktimer_ptr_t children;
+
+	if (!xktimer_heap_contains(timer)) return;
+
+	if (timer == ctx->heap_root) {
+		ctx->heap_root = NULL;
+	} else {
+		// Cut the timer out of its parent's list of children
+		if (timer->heap_prev->heap_child == timer) {
+			timer->heap_prev->heap_child = timer->heap_next;
+		} else {
+			timer->heap_prev->heap_next = timer->heap_next;
+		}
+		if (timer->heap_next) {
+			timer->heap_next->heap_prev = timer->heap_prev;
+		}
+	}
+
+	children = xktimer_heap_merge_pairs(timer->heap_child);
+	timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+
+	ctx->heap_root = xktimer_heap_meld(ctx->heap_root, children);
+}
+
+static void xktimer_heap_update(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	xktimer_heap_remove(ctx, timer);
+	xktimer_heap_insert(ctx, timer);
+}
+#else
+//! Returns the next timer to time out, or NULL if the heap is empty
+#define xktimer_heap_top()		(ctx->heap_len ? ctx->heap[0] : NULL)
+
+//! Returns true if the timer is in the heap
+#define xktimer_heap_contains(timer)	((timer)->heap_idx >= 0)
+
+//! Returns true if the timer at heap index a times out before the one at b
+#define xktimer_heap_before(a, b)	xktimer_before(ctx->heap[a], ctx->heap[b])
+
+static void xktimer_heap_swap(xktimer_ctx_t * ctx, int a, int b)
+{
+	xktimer_ptr_t timer = ctx->heap[a];
+
+	ctx->heap[a] = ctx->heap[b];
+	ctx->heap[b] = timer;
+	ctx->heap[a]->heap_idx = a;
+	ctx->heap[b]->heap_idx = b;
+}
+
+static void xktimer_heap_up(xktimer_ctx_t * ctx, int idx)
+{
+	while (idx > 0) {
+		int parent = (idx - 1) / 4;
+
+		if (!xktimer_heap_before(idx, parent)) break;
+
+		xktimer_heap_swap(ctx, idx, parent);
+		idx = parent;
+	}
+}
+
+static void xktimer_heap_down(xktimer_ctx_t * ctx, int idx)
+{
+	for (;;) {
+		int child = idx * 4 + 1;
+		int last = child + 4;
+		int min = idx;
+
+		if (last > ctx->heap_len) {
+			last = ctx->heap_len;
+		}
+
+		// Find the child that times out first
+		for (; child < last; child++) {
+			if (xktimer_heap_before(child, min)) {
+				min = child;
+			}
+		}
+
+		if (min == idx) break;
+
+		xktimer_heap_swap(ctx, idx, min);
+		idx = min;
+	}
+}
+
+/**
+ * \brief			Make sure the heap has room for the given number of timers
+ *
+ * This is done when a timer is added so that starting a timer never needs
+ * to allocate memory.
+ */
+static bool xktimer_heap_reserve(xktimer_ctx_t * ctx, int count)
+{
+#ifdef XKTIMER_NO_MALLOC
+	(void)ctx;
+	return count <= XKTIMER_MAX_TIMERS;
+#else
+	if (count > ctx->heap_size) {
+		int size = ctx->heap_size ? ctx->heap_size * 2 : 16;
+		xktimer_ptr_t * heap;
+
+		while (size < count) {
+			size *= 2;
+		}
+
+		heap = (xktimer_ptr_t *)realloc(ctx->heap, size * XKTIMER_PTR_SIZE);
+		if (heap == NULL) {
+			return false;
+		}
+
+		ctx->heap = heap;
+		ctx->heap_size = size;
+	}
+
+	return true;
+#endif
+}
+
+static void xktimer_heap_insert(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	timer->heap_idx = ctx->heap_len++;
+	ctx->heap[timer->heap_idx] = timer;
+	xktimer_heap_up(ctx, timer->heap_idx);
+}
+
+static void xktimer_heap_remove(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	int idx = timer->heap_idx;
+
+	if (idx < 0) return;
+
+	timer->heap_idx = -1;
+	if (--ctx->heap_len == idx) return;
+
+	// Move the last timer into the hole and restore the heap order
+	ctx->heap[idx] = ctx->heap[ctx->heap_len];
+	ctx->heap[idx]->heap_idx = idx;
+	xktimer_heap_up(ctx, idx);
+	xktimer_heap_down(ctx, ctx->heap[idx]->heap_idx);
+}
+
+static void xktimer_heap_update(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	// Just restore the heap order for the new ticks value
+	xktimer_heap_up(ctx, timer->heap_idx);
+	xktimer_heap_down(ctx, timer->heap_idx);
+}
+
+/**
+ * \brief			Restore the heap order after timers were appended
+ *
+ * The heap before index first is in order. When fewer timers were appended
+ * than were already in the heap, they are moved up one by one. Otherwise the
+ * whole heap is built again from the bottom up, which is O(n).
+ */
+static void xktimer_heap_build(xktimer_ctx_t * ctx, int first)
+{
+	int idx;
+
+	if (ctx->heap_len - first <= first) {
+		for (idx = first; idx < ctx->heap_len; idx++) {
+			xktimer_heap_up(ctx, idx);
+		}
+	} else {
+		for (idx = (ctx->heap_len - 2) / 4; idx >= 0; idx--) {
+			xktimer_heap_down(ctx, idx);
+		}
+	}
+}
+#endif
+#endif
+
+#if defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_WAIT_HYBRID)
+/**
+ * \brief			Convert ticks to a CLOCK_MONOTONIC time
+ */
+static void xktimer_timespec(struct timespec * ts, xktimer_tick_t ticks)
+{
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC_COARSE
+	// Same time base as xktimer_clock()
+	ts->tv_sec = ticks / XKTIMER_RESOLUTION;
+	ts->tv_nsec = (ticks % XKTIMER_RESOLUTION) * 
+				  (1000000000L / XKTIMER_RESOLUTION);
+#else
+	xktimer_diff_t left = xktimer_diff(ticks, xktimer_clock());
+
+	// Different time base, so sleep for the time that is left
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	if (left > 0) {
+		ts->tv_sec += left / XKTIMER_RESOLUTION;
+		ts->tv_nsec += (left % XKTIMER_RESOLUTION) * 
+					   (1000000000L / XKTIMER_RESOLUTION);
+		if (ts->tv_nsec >= 1000000000L) {
+			ts->tv_sec++;
+			ts->tv_nsec -= 1000000000L;
+		}
+	}
+#endif
+}
+#endif
+
+#if defined(XKTIMER_CMD_QUEUE) && (defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_FD))
+/**
+ * \brief			Check for a command that waits to be run by the owner
+ *
+ * The owner calls this after it stores that it is going to sleep, and a
+ * producer looks whether the owner sleeps after it publishes a command. All
+ * four accesses are sequentially consistent, so at least one of them sees
+ * what the other did.
+ */
+static bool xktimer_cmd_waiting(xktimer_ctx_t * ctx)
+{
+	unsigned int pos = ctx->cmd_tail;
+
+	return __atomic_load_n(&ctx->cmd[pos & (XKTIMER_CMD_QUEUE_SIZE - 1)].seq, 
+						   __ATOMIC_SEQ_CST) == pos + 1;
+}
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+//! Wake up the event loop if it is sleeping
+static void xktimer_loop_wake(xktimer_ctx_t * ctx)
+{
+	if (__atomic_load_n(&ctx->loop_sleeping, __ATOMIC_RELAXED)) {
+		pthread_cond_signal(&ctx->loop_cond);
+	}
+}
+#endif
+
+#ifdef XKTIMER_FD
+/**
+ * \brief			Arm the timerfd of a context for the given deadline
+ *
+ * The timerfd is armed relative to xktimer_clock(), so it works with any
+ * clock source. A deadline that has passed already makes it readable right
+ * away, and XKTIMER_NO_DEADLINE disarms it.
+ */
+static void xktimer_fd_arm(xktimer_ctx_t * ctx, xktimer_tick_t deadline)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+
+	if (deadline != XKTIMER_NO_DEADLINE) {
+		xktimer_diff_t left = xktimer_diff(deadline, xktimer_clock());
+
+		if (left > 0) {
+			its.it_value.tv_sec = left / XKTIMER_RESOLUTION;
+			its.it_value.tv_nsec = (left % XKTIMER_RESOLUTION) * 
+								   (1000000000L / XKTIMER_RESOLUTION);
+		} else {
+			// A zero it_value would disarm the timerfd
+			its.it_value.tv_nsec = 1;
+		}
+	}
+
+	timerfd_settime(ctx->fd, 0, &its, NULL);
+	ctx->fd_deadline = deadline;
+
+#ifdef XKTIMER_CMD_QUEUE
+	// This could have undone the arming of a producer that posted a command
+	if (xktimer_cmd_waiting(ctx)) {
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = 1;
+		timerfd_settime(ctx->fd, 0, &its, NULL);
+	}
+#endif
+}
+#endif
+
+#ifdef XKTIMER_TICKLESS
+/**
+ * \brief			Convert ticks to the counter of XKTIMER_HW_TICKS()
+ *
+ * This is the reverse of xktimer_clock(), rounded up so the compare never
+ * matches before xktimer_clock() reaches the ticks.
+ */
+static inline uint64_t xktimer_hw_ticks(xktimer_tick_t ticks)
+{
+	uint64_t value = (xktimer_utick_t)ticks;
+
+#if (XKTIMER_HW_TICKS_PER_SEC % XKTIMER_RESOLUTION) == 0
+	return value * (XKTIMER_HW_TICKS_PER_SEC / XKTIMER_RESOLUTION);
+#elif (XKTIMER_RESOLUTION % XKTIMER_HW_TICKS_PER_SEC) == 0
+	return (value + (XKTIMER_RESOLUTION / XKTIMER_HW_TICKS_PER_SEC) - 1) / 
+		   (XKTIMER_RESOLUTION / XKTIMER_HW_TICKS_PER_SEC);
+#else
+	return (value * XKTIMER_HW_TICKS_PER_SEC + XKTIMER_RESOLUTION - 1) / 
+		   XKTIMER_RESOLUTION;
+#endif
+}
+
+//! Set the compare register of the hardware timer for the given deadline
+static void xktimer_hw_arm(xktimer_tick_t deadline)
+{
+	xktimer_hw_deadline = deadline;
+
+	if (deadline == XKTIMER_NO_DEADLINE) {
+		XKTIMER_HW_COMPARE_STOP();
+		return;
+	}
+
+	XKTIMER_HW_COMPARE(xktimer_hw_ticks(deadline));
+
+	// The compare does not match a value the counter has already passed
+	if (xktimer_reached(xktimer_clock(), deadline)) {
+		xktimer_hw_pending = true;
+	}
+}
+#endif
+
+#if defined(XKTIMER_FD) || defined(XKTIMER_TICKLESS)
+/**
+ * \brief			Arm the wakeups of a context for the given deadline
+ *
+ * These are the timerfd of xktimer_fd() and the compare interrupt of
+ * XKTIMER_TICKLESS, which only the default context drives.
+ */
+static void xktimer_wake_at(xktimer_ctx_t * ctx, xktimer_tick_t deadline)
+{
+#ifdef XKTIMER_FD
+	if (ctx->fd >= 0) {
+		xktimer_fd_arm(ctx, deadline);
+	}
+#endif
+
+#ifdef XKTIMER_TICKLESS
+	if (ctx == &xktimer_ctx_default) {
+		xktimer_hw_arm(deadline);
+	}
+#endif
+}
+
+//! Arm the wakeups of a context for its earliest deadline
+static void xktimer_wake_next(xktimer_ctx_t * ctx)
+{
+	xktimer_wake_at(ctx, xktimer_ctx_next_deadline(ctx));
+}
+#endif
+
+#ifdef XKTIMER_SOA
+//! The deadline kept in the SoA arrays, in ms whatever the resolution
+#define xktimer_soa_ticks(ticks)	\
+	((uint32_t)((xktimer_utick_t)(ticks) / XKTIMER_TICKS_PER_MS))
+
+//! How far the SoA deadlines are kept from soa_base, in ms
+#define XKTIMER_SOA_WINDOW			0x40000000
+
+/**
+ * \brief			The deadline of a timer for the SoA arrays
+ *
+ * The deadline is clamped to XKTIMER_SOA_WINDOW ms around soa_base, which a
+ * pass keeps less than XKTIMER_SOA_WINDOW ms behind its time, so the 32-bit
+ * compare of the scan never wraps. A timer that is far behind is still seen
+ * as timed out, and one that is far ahead is not seen until it gets close.
+ */
+static uint32_t xktimer_soa_deadline(xktimer_ctx_t * ctx, xktimer_tick_t ticks)
+{
+	const xktimer_diff_t window = 
+		(xktimer_diff_t)XKTIMER_MS_TICKS(XKTIMER_SOA_WINDOW);
+	xktimer_diff_t ahead = xktimer_diff(ticks, ctx->soa_base);
+
+	if (ahead < -window) {
+		ticks = ctx->soa_base - window;
+	} else if (ahead > window) {
+		ticks = ctx->soa_base + window;
+	}
+
+	return xktimer_soa_ticks(ticks);
+}
+#endif
+
+#ifdef XKTIMER_PERSIST
+//! The wall clock time in ns, the time base of the persistent deadlines
+static int64_t xktimer_persist_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * \brief			The wall clock time in ns of a clock value of a context
+ *
+ * Passes reschedule many persistent timers at once, so the wall clock is
+ * only read again when the last reading is 1 ms old, and the time is taken
+ * from the monotonic clock in between.
+ */
+static int64_t xktimer_persist_wall(xktimer_ctx_t * ctx, xktimer_tick_t ticks)
+{
+	xktimer_tick_t now = xktimer_clock();
+	xktimer_diff_t age = xktimer_diff(now, ctx->persist_tick);
+
+	if (ctx->persist_wall == 0 || age < 0 || 
+		age >= (xktimer_diff_t)XKTIMER_MS_TICKS(1)) {
+		ctx->persist_wall = xktimer_persist_now();
+		ctx->persist_tick = now;
+	}
+
+	return ctx->persist_wall + 
+		   (int64_t)xktimer_diff(ticks, ctx->persist_tick) * 
+		   XKTIMER_NS_PER_TICK;
+}
+
+/**
+ * \brief			Write the state of a persistent timer to its record
+ *
+ * Persistent timers are never sequence timers, so the timeout of a state is
+ * always timeout or timeout2.
+ */
+static void xktimer_persist_sync(xktimer_ptr_t timer)
+{
+	xktimer_persist_rec_t * rec = timer->persist;
+	xktimer_tick_t ticks = timer->ticks;
+
+	// A touched timer is due one timeout after the last touch
+	if (timer->touched) {
+		ticks = xktimer_ticks_after(timer->touch, timer->state == 0 ? 
+									timer->timeout : timer->timeout2);
+	}
+
+	rec->deadline = xktimer_persist_wall(timer->ctx, ticks);
+	rec->timeout = (uint64_t)timer->timeout * XKTIMER_NS_PER_TICK;
+	rec->timeout2 = (uint64_t)timer->timeout2 * XKTIMER_NS_PER_TICK;
+	rec->state = timer->state;
+	rec->enabled = timer->enabled;
+	rec->overrun = timer->overrun;
+}
+#endif
+
+/**
+ * \brief			Update the scheduler after a timer has changed
+ *
+ * With XKTIMER_WHEEL, this moves the timer to the bucket for its new ticks
+ * value, or takes it out of the wheel if it is no longer running. With
+ * XKTIMER_HEAP, this moves the timer to its new place in the heap.
+ */
+static void xktimer_schedule(xktimer_ptr_t timer)
+{
+	xktimer_ctx_t * ctx = timer->ctx;
+
+	// Timers that were not added are not scheduled
+	if (ctx == NULL) return;
+
+#ifdef XKTIMER_WHEEL
+	xktimer_unlink(ctx, timer);
+	if (timer->enabled) {
+		xktimer_wheel_insert(ctx, timer);
+	}
+#elif defined(XKTIMER_HEAP)
+	if (!timer->enabled) {
+		xktimer_heap_remove(ctx, timer);
+	} else if (!xktimer_heap_contains(timer)) {
+		xktimer_heap_insert(ctx, timer);
+	} else {
+		xktimer_heap_update(ctx, timer);
+	}
+#elif defined(XKTIMER_SOA)
+	if (timer->slot >= 0) {
+		ctx->soa_deadline[timer->slot] = xktimer_soa_deadline(ctx, timer->ticks);
+		ctx->soa_enabled[timer->slot] = timer->enabled ? -1 : 0;
+	}
+#endif
+
+#ifdef XKTIMER_PERSIST
+	if (timer->persist) {
+		xktimer_persist_sync(timer);
+	}
+#endif
+}
+
+/**
+ * \brief			Update the scheduler and the event loop after a timer
+ * 					has changed
+ */
+static void xktimer_reschedule(xktimer_ptr_t timer)
+{
+	xktimer_schedule(timer);
+
+#ifdef XKTIMER_EVENT_LOOP
+	// The new deadline could be earlier than the one the loop sleeps for
+	if (timer->ctx && timer->enabled) {
+		xktimer_loop_wake(timer->ctx);
+	}
+#endif
+
+#ifdef XKTIMER_FD
+	// Only an earlier deadline needs a syscall, a pass arms it after
+	if (timer->ctx && timer->enabled && timer->ctx->fd >= 0 && 
+		!timer->ctx->pass_active && 
+		(timer->ctx->fd_deadline == XKTIMER_NO_DEADLINE || 
+		 xktimer_diff(timer->ticks, timer->ctx->fd_deadline) < 0)) {
+		xktimer_fd_arm(timer->ctx, timer->ticks);
+	}
+#endif
+
+#ifdef XKTIMER_TICKLESS
+	if (timer->ctx == &xktimer_ctx_default && timer->enabled && 
+		!timer->ctx->pass_active && 
+		(xktimer_hw_deadline == XKTIMER_NO_DEADLINE || 
+		 xktimer_diff(timer->ticks, xktimer_hw_deadline) < 0)) {
+		xktimer_hw_arm(timer->ticks);
+	}
+#endif
+}
+
+/**
+ * \brief			Start scheduling a batch of timers of a context
+ *
+ * The timers of the batch are passed to xktimer_batch_add() once their ticks
+ * are set, and xktimer_batch_end() finishes the batch. With XKTIMER_HEAP,
+ * the timers are appended to the heap and the heap order is restored once
+ * for the whole batch, in O(n) for a large batch. The event loop is woken
+ * up once for the batch.
+ *
+ * \return			The value to pass to the other batch functions
+ */
+static int xktimer_batch_begin(xktimer_ctx_t * ctx)
+{
+#if defined(XKTIMER_HEAP) && !defined(XKTIMER_INTRUSIVE)
+	return ctx ? ctx->heap_len : 0;
+#else
+	(void)ctx;
+	return 0;
+#endif
+}
+
+//! Add a timer whose ticks were set to a batch
+static void xktimer_batch_add(xktimer_ctx_t * ctx, 
+							  xktimer_ptr_t timer, 
+							  int * first)
+{
+	if (ctx == NULL) return;
+
+#if defined(XKTIMER_HEAP) && !defined(XKTIMER_INTRUSIVE)
+	if (timer->enabled && !xktimer_heap_contains(timer)) {
+		timer->heap_idx = ctx->heap_len++;
+		ctx->heap[timer->heap_idx] = timer;
+
+#ifdef XKTIMER_PERSIST
+		// Not scheduled one by one, so the record is written here
+		if (timer->persist) {
+			xktimer_persist_sync(timer);
+		}
+#endif
+		return;
+	}
+
+	// The part of the heap before the batch is out of order now
+	if (xktimer_heap_contains(timer) && timer->heap_idx < *first) {
+		*first = 0;
+	}
+
+	if (timer->enabled) return;
+#else
+	(void)first;
+#endif
+
+	xktimer_schedule(timer);
+}
+
+//! Finish a batch of timers
+static void xktimer_batch_end(xktimer_ctx_t * ctx, int first)
+{
+	if (ctx == NULL) return;
+
+#if defined(XKTIMER_HEAP) && !defined(XKTIMER_INTRUSIVE)
+	xktimer_heap_build(ctx, first);
+#else
+	(void)first;
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+	xktimer_loop_wake(ctx);
+#endif
+
+#if defined(XKTIMER_FD) || defined(XKTIMER_TICKLESS)
+	if (!ctx->pass_active) {
+		xktimer_wake_next(ctx);
+	}
+#endif
+}
+
+#if defined(XKTIMER_SOA) && !defined(XKTIMER_NO_MALLOC)
+/**
+ * \brief			Grow the SoA arrays of a context to the given size
+ *
+ * The arrays are kept aligned for the vector loads, so they are copied
+ * instead of using realloc().
+ */
+static bool xktimer_soa_grow(xktimer_ctx_t * ctx, int size)
+{
+	size_t bytes = XKTIMER_SOA_SIZE(size) * sizeof(uint32_t);
+	size_t old = XKTIMER_SOA_SIZE(ctx->ref_size) * sizeof(uint32_t);
+	uint32_t * deadline = (uint32_t *)xktimer_soa_alloc(bytes);
+	int32_t * enabled = (int32_t *)xktimer_soa_alloc(bytes);
+
+	if (deadline == NULL || enabled == NULL) {
+		xktimer_soa_free(deadline);
+		xktimer_soa_free(enabled);
+		return false;
+	}
+
+	memset(enabled, 0, bytes);
+	if (ctx->ref_size > 0) {
+		memcpy(deadline, ctx->soa_deadline, old);
+		memcpy(enabled, ctx->soa_enabled, old);
+	}
+
+	xktimer_soa_free(ctx->soa_deadline);
+	xktimer_soa_free(ctx->soa_enabled);
+	ctx->soa_deadline = deadline;
+	ctx->soa_enabled = enabled;
+
+	return true;
+}
+#endif
+
+/**
+ * \brief			Returns true if the timer was added to the given context
+ *
+ * xktimer_add() takes timers that were never initialized, so nothing that is
+ * read from the timer is followed before the context has confirmed it. The
+ * slot is only an index, which is checked against the registry of the
+ * context. In intrusive mode, the list link is a pointer, so it is only
+ * followed once the timer points back to the context, which only
+ * xktimer_add() sets.
+ */
+static bool xktimer_ctx_contains(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+#ifdef XKTIMER_INTRUSIVE
+	if (timer->ctx != ctx || ctx->list == NULL) return false;
+
+	return timer->list_pprev != NULL && *timer->list_pprev == timer;
+#else
+	return timer->slot >= 0 && timer->slot < ctx->ref_idx && 
+		   ctx->ref[timer->slot] == timer;
+#endif
+}
+
+/**
+ * \brief			Returns true if the timer was added with xktimer_add()
+ *
+ * Unlike xktimer_ctx_contains(), the context is taken from the timer, so the
+ * timer must have been added or zero filled at some point.
+ */
+static bool xktimer_registered(xktimer_ptr_t timer)
+{
+	return timer->ctx != NULL && xktimer_ctx_contains(timer->ctx, timer);
+}
+
+bool xktimer_reserve(int count)
+{
+	return xktimer_ctx_reserve(&xktimer_ctx_default, count);
+}
+
+bool xktimer_ctx_reserve(xktimer_ctx_t * ctx, int count)
+{
+#ifdef XKTIMER_INTRUSIVE
+	// The timers carry their own links, so there is nothing to allocate
+	(void)ctx;
+	(void)count;
+	return true;
+#elif defined(XKTIMER_NO_MALLOC)
+	(void)ctx;
+	return count <= XKTIMER_MAX_TIMERS;
+#else
+	if (count > ctx->ref_size) {
+		int size = ctx->ref_size ? ctx->ref_size * 2 : 16;
+		xktimer_ptr_t * ref;
+		int * ref_free;
+
+		while (size < count) {
+			size *= 2;
+		}
+
+		ref = (xktimer_ptr_t *)realloc(ctx->ref, size * XKTIMER_PTR_SIZE);
+		if (ref == NULL) {
+			return false;
+		}
+		ctx->ref = ref;
+
+		ref_free = (int *)realloc(ctx->ref_free, size * sizeof(int));
+		if (ref_free == NULL) {
+			return false;
+		}
+		ctx->ref_free = ref_free;
+
+#ifdef XKTIMER_SOA
+		if (!xktimer_soa_grow(ctx, size)) {
+			return false;
+		}
+#endif
+
+		ctx->ref_size = size;
+	}
+
+#ifdef XKTIMER_HEAP
+	return xktimer_heap_reserve(ctx, count);
+#else
+	return true;
+#endif
+#endif
+}
+
+static bool xktimer_add_ptr(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+#ifdef XKTIMER_INTRUSIVE
+	// Link the timer at the head of the list
+	timer->list_next = ctx->list;
+	if (ctx->list) {
+		ctx->list->list_pprev = &timer->list_next;
+	}
+	ctx->list = timer;
+	timer->list_pprev = &ctx->list;
+
+#ifdef XKTIMER_HEAP
+	timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+	timer->heap_pass = 0;
+	timer->heap_defer = NULL;
+	timer->heap_deferred = false;
+#endif
+#else
+	int count = ctx->ref_idx - ctx->ref_free_len;
+
+	if (ctx->ref_free_len > 0) {
+		// Reuse the slot of a removed timer
+		timer->slot = ctx->ref_free[--ctx->ref_free_len];
+	} else {
+		if (!xktimer_ctx_reserve(ctx, count + 1)) {
+			return false;
+		}
+
+		timer->slot = ctx->ref_idx++;
+	}
+
+#ifdef XKTIMER_HEAP
+	if (!xktimer_heap_reserve(ctx, count + 1)) {
+		ctx->ref_free[ctx->ref_free_len++] = timer->slot;
+		timer->slot = -1;
+		return false;
+	}
+
+	timer->heap_idx = -1;
+	timer->heap_pass = 0;
+	timer->heap_defer = NULL;
+	timer->heap_deferred = false;
+#endif
+
+    // Now copy the pointer to the timer struct
+    ctx->ref[timer->slot] = timer;
+#endif
+
+#ifdef XKTIMER_WHEEL
+	timer->next = NULL;
+	timer->pprev = NULL;
+#endif
+
+#ifdef XKTIMER_DISPATCH
+	timer->dispatch_head = 0;
+	timer->dispatch_len = 0;
+	timer->dispatch_queued = false;
+	timer->dispatch_cancel = NULL;
+#endif
+
+#ifdef XKTIMER_BUDGET
+	timer->ready_next = NULL;
+	timer->ready_pprev = NULL;
+#endif
+
+	timer->ctx = ctx;
+    
+    return true;
+}
+
+/**
+ * \brief			Set up the fields of a timer and add it to a context
+ *
+ * The ticks are not set, so the caller must update them afterwards.
+ */
+static bool xktimer_add_timer(xktimer_ctx_t * ctx,
+							  xktimer_ptr_t timer,
+							  uint8_t type,
+							  xktimer_span_t timeout,
+							  xktimer_span_t timeout2,
+							  void (*callback)(int))
+{
+	timer->type = type;
+	timer->enabled = false;
+	timer->state = 0;
+	timer->overrun = XKTIMER_OVERRUN_DRIFT;
+	timer->missed = 0;
+	timer->timeout = timeout;
+	timer->timeout2 = timeout2;
+	timer->sequence = NULL;
+	timer->sequence_len = 0;
+	timer->callback = callback;
+	timer->handler = NULL;
+	timer->data = NULL;
+#ifdef XKTIMER_STATS
+	timer->stats = NULL;
+#endif
+#ifdef XKTIMER_BUDGET
+	timer->priority = 0;
+#endif
+#ifdef XKTIMER_PERSIST
+	timer->persist = NULL;
+#endif
+	timer->slack = ctx->slack;
+	timer->ctx = NULL;
+
+	if (!xktimer_add_ptr(ctx, timer)) return false;
+
+#ifdef XKTIMER_TRACE
+	xktimer_trace(add, XKTIMER_TRACE_ADD, timer, 0);
+#endif
+
+	return true;
+}
+
+bool xktimer_add(xktimer_ptr_t timer,
+			     uint8_t type,
+			     uint32_t timeout,
+			     void (*callback)())
+{
+	return xktimer_ctx_add(&xktimer_ctx_default, timer, type, timeout, callback);
+}
+
+bool xktimer_ctx_add(xktimer_ctx_t * ctx,
+					 xktimer_ptr_t timer,
+					 uint8_t type,
+					 uint32_t timeout,
+					 void (*callback)())
+{
+	// A sequence timer needs its timeouts, see xktimer_ctx_add_sequence()
+	if (!xktimer_assert(timer) || xktimer_ctx_contains(ctx, timer) || 
+		type == XKTIMER_SEQUENCE) {
+		return false;
+	}
+
+	if (!xktimer_add_timer(ctx, timer, type, XKTIMER_MS_TICKS(timeout), 0, 
+						   callback)) {
+		return false;
+	}
+
+	xktimer_update_ticks(timer);
+    
+	return true;
+}
+
+bool xktimer_add_dual(xktimer_ptr_t timer,
+				      uint32_t timeout,
+				      uint32_t timeout2,
+				      void (*callback)(int))
+{
+	return xktimer_ctx_add_dual(&xktimer_ctx_default, timer, timeout, timeout2,
+								callback);
+}
+
+bool xktimer_ctx_add_dual(xktimer_ctx_t * ctx,
+						  xktimer_ptr_t timer,
+						  uint32_t timeout,
+						  uint32_t timeout2,
+						  void (*callback)(int))
+{
+	if (!xktimer_assert(timer) || xktimer_ctx_contains(ctx, timer)) {
+		return false;
+	}
+
+	if (!xktimer_add_timer(ctx, timer, XKTIMER_DUAL_STATE, 
+						   XKTIMER_MS_TICKS(timeout), 
+						   XKTIMER_MS_TICKS(timeout2), callback)) {
+		return false;
+	}
+
+	xktimer_update_ticks(timer);
+    
+	return true;
+}
+
+bool xktimer_add_sequence(xktimer_ptr_t timer,
+						  const uint32_t * sequence,
+						  uint8_t count,
+						  void (*callback)(int))
+{
+	return xktimer_ctx_add_sequence(&xktimer_ctx_default, timer, sequence, 
+									count, callback);
+}
+
+bool xktimer_ctx_add_sequence(xktimer_ctx_t * ctx,
+							  xktimer_ptr_t timer,
+							  const uint32_t * sequence,
+							  uint8_t count,
+							  void (*callback)(int))
+{
+	if (!xktimer_assert(timer) || xktimer_ctx_contains(ctx, timer) || 
+		sequence == NULL || count == 0) {
+		return false;
+	}
+
+	if (!xktimer_add_timer(ctx, timer, XKTIMER_SEQUENCE, 0, 0, callback)) {
+		return false;
+	}
+
+	timer->sequence = sequence;
+	timer->sequence_len = count;
+
+	xktimer_update_ticks(timer);
+    
+	return true;
+}
+
+#ifdef XKTIMER_BUDGET
+//! Append a timer to the queue of its priority, to wait for its callback
+static void xktimer_ready_push(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	xktimer_ptr_t * tail = ctx->ready_tail[timer->priority];
+
+	timer->ready_next = NULL;
+	timer->ready_pprev = tail;
+	*tail = timer;
+
+	ctx->ready_tail[timer->priority] = &timer->ready_next;
+	ctx->ready_len++;
+}
+
+//! Take a timer out of the queue of timers waiting for their callback
+static void xktimer_ready_unlink(xktimer_ctx_t * ctx, xktimer_ptr_t timer)
+{
+	if (timer->ready_pprev == NULL) return;
+
+	*timer->ready_pprev = timer->ready_next;
+
+	if (timer->ready_next) {
+		timer->ready_next->ready_pprev = timer->ready_pprev;
+	} else {
+		// The timer was the last of its queue
+		ctx->ready_tail[timer->priority] = timer->ready_pprev;
+	}
+
+	timer->ready_next = NULL;
+	timer->ready_pprev = NULL;
+	ctx->ready_len--;
+}
+
+//! Take the first waiting timer of the highest priority, or NULL if none
+static xktimer_ptr_t xktimer_ready_pop(xktimer_ctx_t * ctx)
+{
+	int i;
+
+	for (i = XKTIMER_PRIORITIES - 1; i >= 0; i--) {
+		xktimer_ptr_t timer = ctx->ready[i];
+
+		if (timer != NULL) {
+			xktimer_ready_unlink(ctx, timer);
+			return timer;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+#ifdef XKTIMER_DISPATCH
+/**
+ * \brief			Drop the expiries of a timer that wait for a pool
+ *
+ * Waits for a callback of the timer that is running on another thread. When
+ * called from the callback itself, xktimer_pool_run() is told not to touch
+ * the timer once the callback returns.
+ */
+static void xktimer_pool_cancel(xktimer_pool_t * pool, xktimer_ptr_t timer)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+
+	timer->dispatch_len = 0;
+
+	if (timer->dispatch_queued) {
+		bool dropped = false;
+
+		// Take the timer out of the queue it waits in, if not started yet
+		for (i = 0; i < pool->workers; i++) {
+			xktimer_worker_t * worker = &pool->worker[i];
+			unsigned int pos;
+
+			pthread_mutex_lock(&worker->lock);
+
+			for (pos = worker->head; pos != worker->tail; pos++) {
+				xktimer_ptr_t * entry = &worker->queue[
+					pos & (XKTIMER_DISPATCH_QUEUE_SIZE - 1)];
+
+				if (*entry == timer) {
+					*entry = NULL;
+					pool->pending--;
+					dropped = true;
+				}
+			}
+
+			pthread_mutex_unlock(&worker->lock);
+		}
+
+		if (dropped) {
+			timer->dispatch_queued = false;
+		} else if (timer->dispatch_cancel && 
+				   pthread_equal(timer->dispatch_thread, pthread_self())) {
+			*timer->dispatch_cancel = true;
+			timer->dispatch_cancel = NULL;
+			timer->dispatch_queued = false;
+		} else {
+			// A worker took the timer, wait for it to see the empty backlog
+			while (timer->dispatch_queued) {
+				pthread_cond_wait(&pool->done, &pool->lock);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+#endif
+
+bool xktimer_remove(xktimer_ptr_t timer)
+{
+	xktimer_ctx_t * ctx;
+
+	if (!xktimer_assert(timer) || !xktimer_registered(timer)) {
+		return false;
+	}
+
+	ctx = timer->ctx;
+
+#ifdef XKTIMER_PERSIST
+	// Free the record, or the timer would come back on the next restore
+	if (timer->persist) {
+		timer->persist->callback = 0;
+		timer->persist = NULL;
+	}
+#endif
+
+	// Take the timer out of the scheduler first
+	timer->enabled = false;
+	xktimer_reschedule(timer);
+
+#ifdef XKTIMER_BUDGET
+	// A removed timer must not get the callback it was waiting for
+	xktimer_ready_unlink(ctx, timer);
+#endif
+
+#ifdef XKTIMER_DISPATCH
+	// Nor the ones waiting for a worker
+	if (ctx->pool) {
+		xktimer_pool_cancel(ctx->pool, timer);
+	}
+#endif
+
+#ifdef XKTIMER_HEAP
+	// Nor be put back in the heap at the end of the current pass
+	if (timer->heap_deferred) {
+		xktimer_ptr_t * link = &ctx->heap_defer;
+
+		while (*link != timer) {
+			link = &(*link)->heap_defer;
+		}
+
+		*link = timer->heap_defer;
+		timer->heap_defer = NULL;
+		timer->heap_deferred = false;
+	}
+#endif
+
+#ifdef XKTIMER_INTRUSIVE
+	// Don't let the current xktimer_task() pass follow a removed timer
+	if (ctx->list_iter == timer) {
+		ctx->list_iter = timer->list_next;
+	}
+
+	*timer->list_pprev = timer->list_next;
+	if (timer->list_next) {
+		timer->list_next->list_pprev = timer->list_pprev;
+	}
+	timer->list_next = NULL;
+	timer->list_pprev = NULL;
+#else
+	ctx->ref[timer->slot] = NULL;
+	ctx->ref_free[ctx->ref_free_len++] = timer->slot;
+	timer->slot = -1;
+#endif
+
+	timer->ctx = NULL;
+
+	return true;
+}
+
+void xktimer_set_handler(xktimer_ptr_t timer,
+						 void (*handler)(xktimer_ptr_t),
+						 void * data)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->handler = handler;
+	timer->data = data;
+}
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_STD || XKTIMER_CLOCK == XKTIMER_CLOCK_CUSTOM
+//! Multiplier from clock() to ticks, if CLOCKS_PER_SEC is below the resolution
+#define XKTIMER_STD_MUL		(XKTIMER_RESOLUTION / CLOCKS_PER_SEC ? \
+							 XKTIMER_RESOLUTION / CLOCKS_PER_SEC : 1)
+//! Divisor from clock() to ticks, if CLOCKS_PER_SEC is above the resolution
+#define XKTIMER_STD_DIV		(CLOCKS_PER_SEC / XKTIMER_RESOLUTION ? \
+							 CLOCKS_PER_SEC / XKTIMER_RESOLUTION : 1)
+
+/**
+ * \brief			Read clock() and convert it to ticks
+ *
+ * With XKTIMER_TICKS_64 and a 32-bit clock_t, the wrap arounds of clock() are
+ * counted, so it must be read at least once per wrap around.
+ */
+static xktimer_tick_t xktimer_std_clock()
+{
+#ifdef XKTIMER_TICKS_64
+	static uint32_t last;
+	static uint64_t high;
+	uint64_t raw = (uint64_t)clock();
+
+	if (sizeof(clock_t) < sizeof(uint64_t)) {
+		if ((uint32_t)raw < last) {
+			high += (uint64_t)1 << 32;
+		}
+		last = (uint32_t)raw;
+		raw = high | last;
+	}
+
+	return (xktimer_tick_t)(raw * XKTIMER_STD_MUL / XKTIMER_STD_DIV);
+#else
+	return (xktimer_tick_t)clock() * XKTIMER_STD_MUL / XKTIMER_STD_DIV;
+#endif
+}
+#endif
+
+xktimer_tick_t xktimer_clock()
+{
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC_COARSE
+	struct timespec ts;
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC_COARSE
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+
+	return (xktimer_tick_t)ts.tv_sec * XKTIMER_RESOLUTION + 
+		   ts.tv_nsec / (1000000000L / XKTIMER_RESOLUTION);
+#elif XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+	return xktimer_tsc_base_ticks + 
+		   (xktimer_tick_t)xktimer_tsc_scale(xktimer_tsc() - xktimer_tsc_base);
+#elif XKTIMER_CLOCK == XKTIMER_CLOCK_HW
+#if (XKTIMER_HW_TICKS_PER_SEC % XKTIMER_RESOLUTION) == 0
+	return (xktimer_tick_t)(XKTIMER_HW_TICKS() / 
+							(XKTIMER_HW_TICKS_PER_SEC / XKTIMER_RESOLUTION));
+#elif (XKTIMER_RESOLUTION % XKTIMER_HW_TICKS_PER_SEC) == 0
+	return (xktimer_tick_t)((uint64_t)XKTIMER_HW_TICKS() * 
+							(XKTIMER_RESOLUTION / XKTIMER_HW_TICKS_PER_SEC));
+#else
+	return (xktimer_tick_t)((uint64_t)XKTIMER_HW_TICKS() * XKTIMER_RESOLUTION / 
+							XKTIMER_HW_TICKS_PER_SEC);
+#endif
+#elif XKTIMER_CLOCK == XKTIMER_CLOCK_CUSTOM
+	if (xktimer_clock_source) {
+		return xktimer_clock_source();
+	}
+
+	return xktimer_std_clock();
+#else
+	return xktimer_std_clock();
+#endif
+}
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_CUSTOM
+void xktimer_set_clock(xktimer_tick_t (*source)())
+{
+	xktimer_clock_source = source;
+}
+#endif
+
+xktimer_tick_t xktimer_now()
+{
+	return xktimer_ctx_now(&xktimer_ctx_default);
+}
+
+xktimer_tick_t xktimer_ctx_now(xktimer_ctx_t * ctx)
+{
+	if (ctx->pass_active) {
+		return ctx->pass_now;
+	}
+
+	return xktimer_clock();
+}
+
+//! The current time for a timer, as seen by its context
+#define xktimer_timer_now(timer)	\
+	((timer)->ctx ? xktimer_ctx_now((timer)->ctx) : xktimer_clock())
+
+/**
+ * \brief			The timeout of a timer for the given state, in ticks
+ */
+static inline xktimer_span_t xktimer_state_span(xktimer_ptr_t timer, 
+												uint8_t state)
+{
+	if (timer->type == XKTIMER_SEQUENCE) {
+		return XKTIMER_MS_TICKS(timer->sequence[state]);
+	}
+
+	return state == 0 ? timer->timeout : timer->timeout2;
+}
+
+/**
+ * \brief			The state a timer moves to after the given one times out
+ */
+static inline uint8_t xktimer_next_state(xktimer_ptr_t timer, uint8_t state)
+{
+	switch (timer->type) {
+	case XKTIMER_DUAL_STATE:
+		return state == 0 ? 1 : 0;
+	case XKTIMER_SEQUENCE:
+		return state + 1 < timer->sequence_len ? state + 1 : 0;
+	default:
+		return state;
+	}
+}
+
+/**
+ * \brief			Set the ticks for a given timer from the given time, without
+ * 					updating the scheduler
+ */
+static void xktimer_set_ticks_at(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	timer->ticks = xktimer_ticks_after(now, 
+									   xktimer_state_span(timer, timer->state));
+
+	// The new deadline replaces the one of any touch
+	timer->touched = false;
+
+	if (timer->slack > 1) {
+		xktimer_utick_t ticks = (xktimer_utick_t)timer->ticks + timer->slack - 1;
+
+		// Round up to the window, so the timers in it time out together
+		timer->ticks = (xktimer_tick_t)(ticks - ticks % timer->slack);
+	}
+}
+
+/**
+ * \brief			Update the ticks for a given timer from the given time
+ */
+static void xktimer_update_ticks_at(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	xktimer_set_ticks_at(timer, now);
+	xktimer_reschedule(timer);
+}
+
+void xktimer_update_ticks(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return;
+
+	xktimer_update_ticks_at(timer, xktimer_timer_now(timer));
+}
+
+uint32_t xktimer_timeout(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return 0;
+	
+	return (uint32_t)(timer->timeout / XKTIMER_TICKS_PER_MS);
+}
+
+uint32_t xktimer_timeout2(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return 0;
+	
+	return (uint32_t)(timer->timeout2 / XKTIMER_TICKS_PER_MS);
+}
+
+uint32_t xktimer_missed(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return 0;
+
+	return timer->missed;
+}
+
+xktimer_tick_t xktimer_next_timeout(xktimer_ptr_t timer)
+{
+	xktimer_tick_t now = xktimer_clock();
+
+	if (!xktimer_assert(timer)) return 0;
+
+	if (xktimer_reached(now, timer->ticks)) {
+		return 0;
+	}
+
+	return timer->ticks - now;
+}
+
+#ifdef XKTIMER_WHEEL
+/**
+ * \brief			Get the earliest deadline in a list of timers
+ */
+static xktimer_tick_t xktimer_list_deadline(xktimer_ptr_t timer, 
+											xktimer_tick_t deadline)
+{
+	for (; timer != NULL; timer = timer->next) {
+		if (deadline == XKTIMER_NO_DEADLINE || 
+			xktimer_diff(timer->ticks, deadline) < 0) {
+			deadline = timer->ticks;
+		}
+	}
+
+	return deadline;
+}
+#endif
+
+xktimer_tick_t xktimer_next_deadline()
+{
+	return xktimer_ctx_next_deadline(&xktimer_ctx_default);
+}
+
+xktimer_tick_t xktimer_ctx_next_deadline(xktimer_ctx_t * ctx)
+{
+#ifdef XKTIMER_HEAP
+	xktimer_ptr_t timer = xktimer_heap_top();
+
+	if (timer == NULL) {
+		return XKTIMER_NO_DEADLINE;
+	}
+
+	return timer->ticks;
+#elif defined(XKTIMER_WHEEL)
+	xktimer_tick_t deadline = xktimer_list_deadline(ctx->wheel_due, 
+													XKTIMER_NO_DEADLINE);
+	int level, i;
+
+	if (ctx->wheel_count == 0) {
+		return XKTIMER_NO_DEADLINE;
+	}
+
+	deadline = xktimer_list_deadline(ctx->wheel_near, deadline);
+
+	// Every timer in a bucket times out at or after the start of the bucket,
+	// so each level is searched in order until the earliest deadline found
+	// so far is before the end of the current bucket
+	for (level = 0; level < XKTIMER_WHEEL_LEVELS; level++) {
+		xktimer_tick_t block = ctx->wheel_tick >> (XKTIMER_WHEEL_BITS * level);
+
+		// The current bucket of the upper levels was already cascaded,
+		// unless the wheel is right at the start of that bucket
+		if (level > 0 && 
+			(ctx->wheel_tick & ((1L << (XKTIMER_WHEEL_BITS * level)) - 1))) {
+			block++;
+		}
+
+		for (i = 0; i < XKTIMER_WHEEL_SIZE; i++, block++) {
+			xktimer_ptr_t bucket = 
+				ctx->wheel[level][block & XKTIMER_WHEEL_MASK];
+			xktimer_tick_t end = (((block + 1) << (XKTIMER_WHEEL_BITS * level)) << 
+								  XKTIMER_WHEEL_GRAIN_BITS) - 1;
+
+			if (bucket == NULL) continue;
+
+			deadline = xktimer_list_deadline(bucket, deadline);
+			if (xktimer_diff(deadline, end) <= 0) break;
+		}
+	}
+
+	return deadline;
+#else
+	xktimer_tick_t deadline = XKTIMER_NO_DEADLINE;
+	xktimer_ptr_t timer;
+#ifdef XKTIMER_INTRUSIVE
+
+	for (timer = ctx->list; timer != NULL; timer = timer->list_next) {
+#else
+	int i;
+
+	for (i = 0; i < ctx->ref_idx; i++) {
+		timer = ctx->ref[i];
+#endif
+
+		if (timer && timer->enabled && (deadline == XKTIMER_NO_DEADLINE ||
+							   xktimer_diff(timer->ticks, deadline) < 0)) {
+			deadline = timer->ticks;
+		}
+	}
+
+	return deadline;
+#endif
+}
+
+/**
+ * \brief			Set the timeout of a timer in ticks
+ */
+static void xktimer_set_span(xktimer_ptr_t timer, xktimer_span_t timeout)
+{
+	if (!xktimer_assert(timer)) return;
+
+	// Set the timeout value
+	timer->timeout = timeout;
+
+	// Now update the timer ticks
+	xktimer_update_ticks(timer);
+}
+
+/**
+ * \brief			Set the timeouts of a dual-state timer in ticks
+ */
+static void xktimer_set_span_dual(xktimer_ptr_t timer,
+								  xktimer_span_t timeout,
+								  xktimer_span_t timeout2)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->state = 0;
+
+	// Set the timeouts
+	timer->timeout = timeout;
+	timer->timeout2 = timeout2;
+
+	// Now update the timer ticks
+	xktimer_update_ticks(timer);
+}
+
+void xktimer_set_timeout(xktimer_ptr_t timer, 
+						 uint32_t timeout)
+{
+	xktimer_set_span(timer, XKTIMER_MS_TICKS(timeout));
+}
+
+void xktimer_set_timeout_us(xktimer_ptr_t timer, uint64_t us)
+{
+	xktimer_set_span(timer, XKTIMER_US_TICKS(us));
+}
+
+void xktimer_set_timeout_ns(xktimer_ptr_t timer, uint64_t ns)
+{
+	xktimer_set_span(timer, XKTIMER_NS_TICKS(ns));
+}
+
+void xktimer_set_timeout_dual(xktimer_ptr_t timer,
+							  uint32_t timeout,
+							  uint32_t timeout2)
+{
+	xktimer_set_span_dual(timer, XKTIMER_MS_TICKS(timeout), 
+						  XKTIMER_MS_TICKS(timeout2));
+}
+
+void xktimer_set_timeout_dual_us(xktimer_ptr_t timer,
+								 uint64_t us,
+								 uint64_t us2)
+{
+	xktimer_set_span_dual(timer, XKTIMER_US_TICKS(us), XKTIMER_US_TICKS(us2));
+}
+
+void xktimer_set_timeout_dual_ns(xktimer_ptr_t timer,
+								 uint64_t ns,
+								 uint64_t ns2)
+{
+	xktimer_set_span_dual(timer, XKTIMER_NS_TICKS(ns), XKTIMER_NS_TICKS(ns2));
+}
+
+void xktimer_set_sequence(xktimer_ptr_t timer,
+						  const uint32_t * sequence,
+						  uint8_t count)
+{
+	if (!xktimer_assert(timer) || sequence == NULL || count == 0 ||
+		timer->type != XKTIMER_SEQUENCE) {
+		return;
+	}
+
+	timer->state = 0;
+
+	// Set the timeouts
+	timer->sequence = sequence;
+	timer->sequence_len = count;
+
+	// Now update the timer ticks
+	xktimer_update_ticks(timer);
+}
+
+
+void xktimer_set_slack(xktimer_ptr_t timer, uint32_t slack)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->slack = XKTIMER_MS_TICKS(slack);
+}
+
+void xktimer_set_overrun(xktimer_ptr_t timer, uint8_t policy)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->overrun = policy;
+
+#ifdef XKTIMER_PERSIST
+	if (timer->persist) {
+		xktimer_persist_sync(timer);
+	}
+#endif
+}
+
+#ifdef XKTIMER_BUDGET
+void xktimer_set_priority(xktimer_ptr_t timer, uint8_t priority)
+{
+	bool ready;
+
+	if (!xktimer_assert(timer)) return;
+
+	if (priority > XKTIMER_PRIORITIES - 1) {
+		priority = XKTIMER_PRIORITIES - 1;
+	}
+
+	// A waiting timer moves to the back of the queue of its new priority
+	ready = timer->ctx && timer->ready_pprev;
+	if (ready) {
+		xktimer_ready_unlink(timer->ctx, timer);
+	}
+
+	timer->priority = priority;
+
+	if (ready) {
+		xktimer_ready_push(timer->ctx, timer);
+	}
+}
+#endif
+
+void xktimer_set_default_slack(uint32_t slack)
+{
+	xktimer_ctx_set_default_slack(&xktimer_ctx_default, slack);
+}
+
+void xktimer_ctx_set_default_slack(xktimer_ctx_t * ctx, uint32_t slack)
+{
+	ctx->slack = XKTIMER_MS_TICKS(slack);
+}
+
+void xktimer_start(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->enabled = true;
+	timer->state = 0;
+
+#ifdef XKTIMER_TRACE
+	xktimer_trace(start, XKTIMER_TRACE_START, timer, 0);
+#endif
+
+	xktimer_update_ticks(timer);
+}
+
+void xktimer_stop(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->enabled = false;
+
+#ifdef XKTIMER_TRACE
+	xktimer_trace(stop, XKTIMER_TRACE_STOP, timer, timer->state);
+#endif
+
+	xktimer_reschedule(timer);
+
+#ifdef XKTIMER_BUDGET
+	// Drop the callback the timer could be waiting for
+	if (timer->ctx) {
+		xktimer_ready_unlink(timer->ctx, timer);
+	}
+#endif
+}
+
+size_t xktimer_add_many(const xktimer_spec_t * specs, size_t count)
+{
+	return xktimer_ctx_add_many(&xktimer_ctx_default, specs, count);
+}
+
+size_t xktimer_ctx_add_many(xktimer_ctx_t * ctx,
+							const xktimer_spec_t * specs,
+							size_t count)
+{
+	xktimer_tick_t now = xktimer_ctx_now(ctx);
+	size_t added = 0;
+	size_t i;
+	int first;
+
+#ifndef XKTIMER_INTRUSIVE
+	// Grow the registry once, the adds can then only fail when it is full
+	xktimer_ctx_reserve(ctx, ctx->ref_idx - ctx->ref_free_len + (int)count);
+#endif
+
+	first = xktimer_batch_begin(ctx);
+
+	for (i = 0; i < count; i++) {
+		const xktimer_spec_t * spec = &specs[i];
+		xktimer_ptr_t timer = spec->timer;
+
+		if (!xktimer_assert(timer) || xktimer_ctx_contains(ctx, timer) || 
+			spec->type == XKTIMER_SEQUENCE) {
+			continue;
+		}
+
+		if (!xktimer_add_timer(ctx, timer, spec->type, 
+							   XKTIMER_MS_TICKS(spec->timeout),
+							   spec->type == XKTIMER_DUAL_STATE ? 
+							   XKTIMER_MS_TICKS(spec->timeout2) : 0,
+							   spec->callback)) {
+			continue;
+		}
+
+		timer->enabled = spec->start;
+		xktimer_set_ticks_at(timer, now);
+		xktimer_batch_add(ctx, timer, &first);
+		added++;
+	}
+
+	xktimer_batch_end(ctx, first);
+
+	return added;
+}
+
+void xktimer_start_many(xktimer_ptr_t * timers, size_t count)
+{
+	xktimer_ctx_t * ctx = NULL;
+	xktimer_tick_t now = 0;
+	int first = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		xktimer_ptr_t timer = timers[i];
+
+		if (!xktimer_assert(timer)) continue;
+
+		// Read the clock once for each run of timers of the same context
+		if (i == 0 || timer->ctx != ctx) {
+			xktimer_batch_end(ctx, first);
+
+			ctx = timer->ctx;
+			now = xktimer_timer_now(timer);
+			first = xktimer_batch_begin(ctx);
+		}
+
+		timer->enabled = true;
+		timer->state = 0;
+
+#ifdef XKTIMER_TRACE
+		xktimer_trace(start, XKTIMER_TRACE_START, timer, 0);
+#endif
+
+		xktimer_set_ticks_at(timer, now);
+		xktimer_batch_add(ctx, timer, &first);
+	}
+
+	xktimer_batch_end(ctx, first);
+}
+
+void xktimer_touch(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return;
+
+	xktimer_touch_at(timer, xktimer_timer_now(timer));
+}
+
+void xktimer_touch_at(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	if (!xktimer_assert(timer)) return;
+
+	if (!timer->enabled) {
+		timer->enabled = true;
+		timer->state = 0;
+
+		xktimer_update_ticks_at(timer, now);
+		return;
+	}
+
+	// The deadline is only moved when it comes up, see xktimer_expire_state()
+	timer->touch = now;
+	timer->touched = true;
+
+#ifdef XKTIMER_PERSIST
+	// The record can not wait for the deadline to come up
+	if (timer->persist) {
+		xktimer_persist_sync(timer);
+	}
+#endif
+}
+
+bool xktimer_running(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return false;
+
+	return timer->enabled;
+}
+
+#ifdef XKTIMER_CMD_QUEUE
+//! The commands that can be posted to a context
+#define XKTIMER_CMD_START			1
+#define XKTIMER_CMD_STOP			2
+#define XKTIMER_CMD_SET_TIMEOUT		3
+#define XKTIMER_CMD_SET_TIMEOUT_DUAL	4
+
+#define XKTIMER_CMD_QUEUE_MASK		(XKTIMER_CMD_QUEUE_SIZE - 1)
+
+/**
+ * \brief			Post a command to the queue of the timer's context
+ *
+ * Each slot has a sequence number that tells the producers and the consumer
+ * whose turn it is. A producer claims a slot by moving cmd_head forward, fills
+ * it in and then publishes it by bumping its sequence number. This never
+ * blocks: if the queue is full, the command is dropped and FALSE is returned.
+ */
+static bool xktimer_post(xktimer_ptr_t timer,
+						 uint8_t op,
+						 uint32_t timeout,
+						 uint32_t timeout2)
+{
+	xktimer_ctx_t * ctx;
+	xktimer_cmd_t * cmd;
+	unsigned int pos;
+#ifdef XKTIMER_FD
+	int fd;
+#endif
+
+	if (!xktimer_assert(timer) || timer->ctx == NULL) return false;
+
+	ctx = timer->ctx;
+	pos = __atomic_load_n(&ctx->cmd_head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		unsigned int seq;
+		int diff;
+
+		cmd = &ctx->cmd[pos & XKTIMER_CMD_QUEUE_MASK];
+		seq = __atomic_load_n(&cmd->seq, __ATOMIC_ACQUIRE);
+		diff = (int)(seq - pos);
+
+		if (diff == 0) {
+			// The slot is free, so try to claim it
+			if (__atomic_compare_exchange_n(&ctx->cmd_head, &pos, pos + 1, 
+											true, __ATOMIC_RELAXED, 
+											__ATOMIC_RELAXED)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// The owner has not handled this slot yet, so the queue is full
+			return false;
+		} else {
+			// Another producer claimed the slot first
+			pos = __atomic_load_n(&ctx->cmd_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	cmd->op = op;
+	cmd->timer = timer;
+	cmd->timeout = timeout;
+	cmd->timeout2 = timeout2;
+
+	// Wake up the owner if it waits for its next timer, the other side of
+	// this is in xktimer_cmd_waiting()
+	__atomic_store_n(&cmd->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+#ifdef XKTIMER_EVENT_LOOP
+	// The loop holds its lock until it waits, so the signal is not lost
+	if (__atomic_load_n(&ctx->loop_sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&ctx->loop_mutex);
+		pthread_cond_signal(&ctx->loop_cond);
+		pthread_mutex_unlock(&ctx->loop_mutex);
+	}
+#endif
+
+#ifdef XKTIMER_FD
+	// One producer per pass makes the timerfd readable, the pass arms it
+	// again for the next timer
+	fd = __atomic_load_n(&ctx->fd, __ATOMIC_RELAXED);
+	if (fd >= 0 && !__atomic_exchange_n(&ctx->cmd_kick, true, 
+										__ATOMIC_SEQ_CST)) {
+		struct itimerspec its;
+
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_nsec = 1;
+		timerfd_settime(fd, 0, &its, NULL);
+	}
+#endif
+
+	return true;
+}
+
+/**
+ * \brief			Run the commands posted to the context
+ *
+ * This is done by the owner of the context at the start of each
+ * xktimer_task() pass. At most one queue worth of commands is run, so
+ * producers that keep posting can not hold up the pass.
+ */
+static void xktimer_cmd_drain(xktimer_ctx_t * ctx)
+{
+	int count;
+
+#ifdef XKTIMER_FD
+	// The commands posted from here on need the timerfd made readable again
+	__atomic_store_n(&ctx->cmd_kick, false, __ATOMIC_SEQ_CST);
+#endif
+
+	for (count = 0; count < XKTIMER_CMD_QUEUE_SIZE; count++) {
+		unsigned int pos = ctx->cmd_tail;
+		xktimer_cmd_t * cmd = &ctx->cmd[pos & XKTIMER_CMD_QUEUE_MASK];
+		xktimer_cmd_t copy;
+
+		if (__atomic_load_n(&cmd->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+			// Empty, or the producer has not published the slot yet
+			break;
+		}
+
+		copy = *cmd;
+
+		// Hand the slot back to the producers for the next lap
+		__atomic_store_n(&cmd->seq, pos + XKTIMER_CMD_QUEUE_SIZE, 
+						 __ATOMIC_RELEASE);
+		ctx->cmd_tail = pos + 1;
+
+		switch (copy.op) {
+		case XKTIMER_CMD_START:
+			xktimer_start(copy.timer);
+			break;
+		case XKTIMER_CMD_STOP:
+			xktimer_stop(copy.timer);
+			break;
+		case XKTIMER_CMD_SET_TIMEOUT:
+			xktimer_set_timeout(copy.timer, copy.timeout);
+			break;
+		case XKTIMER_CMD_SET_TIMEOUT_DUAL:
+			xktimer_set_timeout_dual(copy.timer, copy.timeout, copy.timeout2);
+			break;
+		}
+	}
+}
+
+bool xktimer_post_start(xktimer_ptr_t timer)
+{
+	return xktimer_post(timer, XKTIMER_CMD_START, 0, 0);
+}
+
+bool xktimer_post_stop(xktimer_ptr_t timer)
+{
+	return xktimer_post(timer, XKTIMER_CMD_STOP, 0, 0);
+}
+
+bool xktimer_post_set_timeout(xktimer_ptr_t timer, uint32_t timeout)
+{
+	return xktimer_post(timer, XKTIMER_CMD_SET_TIMEOUT, timeout, 0);
+}
+
+bool xktimer_post_set_timeout_dual(xktimer_ptr_t timer,
+								   uint32_t timeout,
+								   uint32_t timeout2)
+{
+	return xktimer_post(timer, XKTIMER_CMD_SET_TIMEOUT_DUAL, timeout, timeout2);
+}
+#endif
+
+#if defined(XKTIMER_WAIT_HYBRID) && !defined(xktimer_wait_task)
+//! The time in ticks spun at the end of a wait, learned from the wake ups
+static xktimer_span_t xktimer_wait_spin = XKTIMER_US_TICKS(XKTIMER_WAIT_SPIN_US);
+
+//! Let the other hardware thread of the core run while spinning
+static inline void xktimer_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__ ("yield");
+#endif
+}
+
+/**
+ * \brief			Sleep until the spin slice before the deadline
+ *
+ * The slice is shared by all threads. It is read and written without a
+ * lock, since a lost update only changes the next estimate.
+ */
+static void xktimer_wait_sleep(xktimer_tick_t deadline)
+{
+	xktimer_span_t spin = __atomic_load_n(&xktimer_wait_spin, __ATOMIC_RELAXED);
+	xktimer_tick_t wake;
+	xktimer_diff_t late;
+	struct timespec ts;
+
+	if (xktimer_diff(deadline, xktimer_clock()) <= (xktimer_diff_t)spin) {
+		return;
+	}
+
+	wake = (xktimer_tick_t)((xktimer_utick_t)deadline - spin);
+
+	xktimer_timespec(&ts, wake);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+	// Grow the slice past a late wake up at once, as it makes the wait late,
+	// and only shrink it slowly towards the wake up latency otherwise
+	late = xktimer_diff(xktimer_clock(), wake);
+	if (late < 0) {
+		late = 0;
+	}
+
+	if ((xktimer_span_t)late >= spin) {
+		spin = (xktimer_span_t)late + (xktimer_span_t)late / 2 + 1;
+	} else {
+		spin -= (spin - (xktimer_span_t)late) / 16;
+	}
+
+	if (spin > XKTIMER_US_TICKS(XKTIMER_WAIT_SPIN_MAX_US)) {
+		spin = XKTIMER_US_TICKS(XKTIMER_WAIT_SPIN_MAX_US);
+	}
+
+	__atomic_store_n(&xktimer_wait_spin, spin, __ATOMIC_RELAXED);
+}
+#endif
+
+//! Block until xktimer_clock() reaches the deadline
+static void xktimer_wait_until(xktimer_tick_t deadline)
+{
+#if defined(XKTIMER_WAIT_HYBRID) && !defined(xktimer_wait_task)
+	// Nothing to run while waiting, so sleep through most of it
+	xktimer_wait_sleep(deadline);
+#endif
+
+	while (!xktimer_reached(xktimer_clock(), deadline)) {
+#ifdef xktimer_wait_task
+		xktimer_wait_task();
+#elif defined(XKTIMER_WAIT_HYBRID)
+		xktimer_cpu_relax();
+#endif
+	}
+}
+
+void xktimer_wait(uint32_t ms)
+{
+	xktimer_wait_until(xktimer_ticks_after(xktimer_clock(), 
+										   XKTIMER_MS_TICKS(ms)));
+}
+
+void xktimer_wait_us(uint64_t us)
+{
+	xktimer_wait_until(xktimer_ticks_after(xktimer_clock(), 
+										   XKTIMER_US_TICKS(us)));
+}
+
+bool xktimer_periodic(xktimer_tick_t * ticks, uint32_t period)
+{
+	xktimer_tick_t now = xktimer_clock();
+
+	if (xktimer_reached(now, xktimer_ticks_after(*ticks, 
+												 XKTIMER_MS_TICKS(period)))) {
+		*ticks = now;
+		return true;
+	}
+
+	return false;
+}
+
+#ifdef XKTIMER_DISPATCH
+#define XKTIMER_DISPATCH_QUEUE_MASK	(XKTIMER_DISPATCH_QUEUE_SIZE - 1)
+
+/**
+ * \brief			Run the callbacks waiting for a timer
+ *
+ * The timer stays marked as queued until its backlog is empty, so no other
+ * worker runs its callback at the same time. A timer that was removed by its
+ * own callback is not touched again, it could be reused already.
+ */
+static void xktimer_pool_run(xktimer_pool_t * pool, xktimer_ptr_t timer)
+{
+	bool cancelled = false;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		int state;
+
+		if (cancelled) {
+			pthread_mutex_unlock(&pool->lock);
+			return;
+		}
+
+		timer->dispatch_cancel = NULL;
+
+		if (timer->dispatch_len == 0) {
+			timer->dispatch_queued = false;
+			pthread_cond_broadcast(&pool->done);
+			pthread_mutex_unlock(&pool->lock);
+			return;
+		}
+
+		state = timer->dispatch_states[timer->dispatch_head];
+		timer->dispatch_head = (timer->dispatch_head + 1) % 
+							   XKTIMER_DISPATCH_BACKLOG;
+		timer->dispatch_len--;
+
+		timer->dispatch_cancel = &cancelled;
+		timer->dispatch_thread = pthread_self();
+
+		pthread_mutex_unlock(&pool->lock);
+
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call, XKTIMER_TRACE_CALL, timer, state);
+#endif
+
+		timer->callback(state);
+
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call_end, XKTIMER_TRACE_CALL_END, timer, state);
+#endif
+
+		pthread_mutex_lock(&pool->lock);
+	}
+}
+
+//! Take the oldest timer from the queue of a worker, or NULL if it is empty
+static xktimer_ptr_t xktimer_worker_pop(xktimer_worker_t * worker)
+{
+	xktimer_ptr_t timer = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+
+	// Skip the entries of the timers that were removed while waiting
+	while (timer == NULL && worker->head != worker->tail) {
+		timer = worker->queue[worker->head++ & XKTIMER_DISPATCH_QUEUE_MASK];
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return timer;
+}
+
+//! Add a timer to the queue of a worker, returns false if it is full
+static bool xktimer_worker_push(xktimer_worker_t * worker, xktimer_ptr_t timer)
+{
+	bool pushed = false;
+
+	pthread_mutex_lock(&worker->lock);
+
+	if (worker->tail - worker->head < XKTIMER_DISPATCH_QUEUE_SIZE) {
+		worker->queue[worker->tail++ & XKTIMER_DISPATCH_QUEUE_MASK] = timer;
+		pushed = true;
+	}
+
+	pthread_mutex_unlock(&worker->lock);
+
+	return pushed;
+}
+
+static void * xktimer_worker_main(void * arg)
+{
+	xktimer_worker_t * worker = arg;
+	xktimer_pool_t * pool = worker->pool;
+
+	for (;;) {
+		xktimer_ptr_t timer = xktimer_worker_pop(worker);
+		int i;
+
+		// Steal from the other workers when the own queue is empty
+		for (i = 1; timer == NULL && i < pool->workers; i++) {
+			timer = xktimer_worker_pop(
+				&pool->worker[(worker->index + i) % pool->workers]);
+		}
+
+		if (timer != NULL) {
+			pthread_mutex_lock(&pool->lock);
+			pool->pending--;
+			pthread_mutex_unlock(&pool->lock);
+
+			xktimer_pool_run(pool, timer);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (pool->pending == 0) {
+			if (pool->quit) {
+				pthread_mutex_unlock(&pool->lock);
+				break;
+			}
+
+			pool->idle++;
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			pool->idle--;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief			Hand the callback of a timer that timed out to a pool
+ *
+ * The state is added to the backlog of the timer. The timer itself is only
+ * queued on a worker if it is not queued or running already, which keeps its
+ * callbacks in order.
+ */
+static void xktimer_pool_dispatch(xktimer_pool_t * pool, 
+								  xktimer_ptr_t timer, 
+								  int state,
+								  int worker)
+{
+	unsigned int next;
+	bool queue;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (timer->dispatch_len >= XKTIMER_DISPATCH_BACKLOG) {
+		pool->dropped++;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	timer->dispatch_states[(timer->dispatch_head + timer->dispatch_len) % 
+						   XKTIMER_DISPATCH_BACKLOG] = (uint8_t)state;
+	timer->dispatch_len++;
+
+	queue = !timer->dispatch_queued;
+	timer->dispatch_queued = true;
+
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!queue) return;
+
+	if (worker >= 0 && worker < pool->workers) {
+		next = worker;
+	} else {
+		next = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < pool->workers; i++) {
+		if (xktimer_worker_push(&pool->worker[(next + i) % pool->workers], 
+								timer)) {
+			pthread_mutex_lock(&pool->lock);
+			pool->pending++;
+			if (pool->idle > 0) {
+				pthread_cond_signal(&pool->cond);
+			}
+			pthread_mutex_unlock(&pool->lock);
+			return;
+		}
+	}
+
+	// All the queues are full, so run the callback here
+	xktimer_pool_run(pool, timer);
+}
+
+bool xktimer_pool_start(xktimer_pool_t * pool, int workers)
+{
+	int i;
+
+	if (pool == NULL || workers < 1) return false;
+
+	if (workers > XKTIMER_DISPATCH_MAX_WORKERS) {
+		workers = XKTIMER_DISPATCH_MAX_WORKERS;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->workers = 0;
+	pool->next = 0;
+	pool->pending = 0;
+	pool->idle = 0;
+	pool->quit = false;
+	pool->dropped = 0;
+
+	for (i = 0; i < workers; i++) {
+		xktimer_worker_t * worker = &pool->worker[i];
+
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->head = 0;
+		worker->tail = 0;
+		worker->pool = pool;
+		worker->index = i;
+	}
+
+	// The workers steal from each other, so set the count before they start
+	pool->workers = workers;
+
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&pool->worker[i].thread, NULL, 
+						   xktimer_worker_main, &pool->worker[i]) != 0) {
+			break;
+		}
+	}
+
+	if (i < workers) {
+		// Stop the workers that did start
+		pthread_mutex_lock(&pool->lock);
+		pool->quit = true;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+
+		while (i-- > 0) {
+			pthread_join(pool->worker[i].thread, NULL);
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+void xktimer_pool_stop(xktimer_pool_t * pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->workers; i++) {
+		pthread_join(pool->worker[i].thread, NULL);
+	}
+
+	// The other workers could steal until they have all returned
+	for (i = 0; i < pool->workers; i++) {
+		pthread_mutex_destroy(&pool->worker[i].lock);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+unsigned long xktimer_pool_dropped(xktimer_pool_t * pool)
+{
+	unsigned long dropped;
+
+	pthread_mutex_lock(&pool->lock);
+	dropped = pool->dropped;
+	pthread_mutex_unlock(&pool->lock);
+
+	return dropped;
+}
+
+void xktimer_set_pool(xktimer_pool_t * pool)
+{
+	xktimer_ctx_set_pool(&xktimer_ctx_default, pool);
+}
+
+void xktimer_ctx_set_pool(xktimer_ctx_t * ctx, xktimer_pool_t * pool)
+{
+	ctx->pool = pool;
+}
+#endif
+
+#ifdef XKTIMER_STATS
+//! The histogram bucket for a value
+static inline int xktimer_stats_bucket(uint64_t value)
+{
+	int bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+	return bucket < XKTIMER_STATS_BUCKETS ? bucket : XKTIMER_STATS_BUCKETS - 1;
+}
+
+static inline void xktimer_stats_add_fire(xktimer_stats_t * stats, 
+										  uint32_t late, 
+										  uint32_t missed)
+{
+	stats->fired++;
+	stats->missed += missed;
+	stats->late[xktimer_stats_bucket(late)]++;
+
+	if (late > stats->late_max) {
+		stats->late_max = late;
+	}
+}
+
+static inline void xktimer_stats_add_run(xktimer_stats_t * stats, 
+										 uint64_t run)
+{
+	stats->runs++;
+	stats->run_total += run;
+	stats->run[xktimer_stats_bucket(run)]++;
+
+	if (run > stats->run_max) {
+		stats->run_max = run;
+	}
+}
+
+/**
+ * \brief			Record a timeout, before the timer is updated
+ */
+static void xktimer_stats_fire(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	xktimer_utick_t behind = (xktimer_utick_t)xktimer_diff(now, timer->ticks);
+	uint32_t late = behind > UINT32_MAX ? UINT32_MAX : (uint32_t)behind;
+	xktimer_span_t period = xktimer_state_span(timer, timer->state);
+	uint32_t missed = 0;
+
+	if (timer->type != XKTIMER_SINGLE_SHOT && period > 0) {
+		missed = (uint32_t)(behind / period);
+	}
+
+	if (timer->stats) {
+		xktimer_stats_add_fire(timer->stats, late, missed);
+	}
+
+	if (timer->ctx) {
+		xktimer_stats_add_fire(&timer->ctx->stats, late, missed);
+	}
+}
+
+/**
+ * \brief			Call the callback of a timer and record how long it ran
+ */
+static void xktimer_stats_call(xktimer_ptr_t timer)
+{
+	// The callback could remove the timer
+	xktimer_stats_t * stats = timer->stats;
+	xktimer_ctx_t * ctx = timer->ctx;
+	uint64_t start = XKTIMER_STATS_COUNTER();
+	uint64_t run;
+
+	timer->callback(timer->state);
+
+	run = XKTIMER_STATS_COUNTER() - start;
+
+	if (stats) {
+		xktimer_stats_add_run(stats, run);
+	}
+
+	if (ctx) {
+		xktimer_stats_add_run(&ctx->stats, run);
+	}
+}
+
+void xktimer_set_stats(xktimer_ptr_t timer, xktimer_stats_t * stats)
+{
+	if (!xktimer_assert(timer)) return;
+
+	timer->stats = stats;
+}
+
+void xktimer_stats_snapshot(xktimer_stats_t * out)
+{
+	xktimer_ctx_stats_snapshot(&xktimer_ctx_default, out);
+}
+
+void xktimer_ctx_stats_snapshot(xktimer_ctx_t * ctx, xktimer_stats_t * out)
+{
+	if (out == NULL) return;
+
+#ifdef XKTIMER_EVENT_LOOP
+	pthread_mutex_lock(&ctx->loop_mutex);
+#endif
+
+	*out = ctx->stats;
+
+#ifdef XKTIMER_EVENT_LOOP
+	pthread_mutex_unlock(&ctx->loop_mutex);
+#endif
+}
+
+void xktimer_stats_reset()
+{
+	xktimer_ctx_stats_reset(&xktimer_ctx_default);
+}
+
+void xktimer_ctx_stats_reset(xktimer_ctx_t * ctx)
+{
+#ifdef XKTIMER_EVENT_LOOP
+	pthread_mutex_lock(&ctx->loop_mutex);
+#endif
+
+	memset(&ctx->stats, 0, sizeof(ctx->stats));
+
+#ifdef XKTIMER_EVENT_LOOP
+	pthread_mutex_unlock(&ctx->loop_mutex);
+#endif
+}
+
+uint64_t xktimer_stats_percentile(const uint32_t * hist, unsigned int percent)
+{
+	uint64_t total = 0, target, seen = 0;
+	int i;
+
+	if (hist == NULL) return 0;
+
+	for (i = 0; i < XKTIMER_STATS_BUCKETS; i++) {
+		total += hist[i];
+	}
+
+	if (total == 0) return 0;
+
+	if (percent > 100) {
+		percent = 100;
+	}
+
+	// The rank of the percentile, at least the first value
+	target = (total * percent + 99) / 100;
+	if (target == 0) {
+		target = 1;
+	}
+
+	for (i = 0; i < XKTIMER_STATS_BUCKETS - 1; i++) {
+		seen += hist[i];
+
+		if (seen >= target) break;
+	}
+
+	if (i == XKTIMER_STATS_BUCKETS - 1) {
+		// The last bucket has no upper bound
+		return UINT64_MAX;
+	}
+
+	return i == 0 ? 0 : (((uint64_t)1 << i) - 1);
+}
+
+//! A percentile, which is never more than the largest value seen
+static unsigned long long xktimer_stats_bound(const uint32_t * hist, 
+											  unsigned int percent,
+											  uint64_t max)
+{
+	uint64_t value = xktimer_stats_percentile(hist, percent);
+
+	return value < max ? value : max;
+}
+
+#if XKTIMER_RESOLUTION == 1000
+#define XKTIMER_TICK_UNIT	"ms"
+#elif XKTIMER_RESOLUTION == 1000000
+#define XKTIMER_TICK_UNIT	"us"
+#elif XKTIMER_RESOLUTION == 1000000000
+#define XKTIMER_TICK_UNIT	"ns"
+#else
+#define XKTIMER_TICK_UNIT	"ticks"
+#endif
+
+void xktimer_stats_dump(const xktimer_stats_t * stats)
+{
+	if (stats == NULL) return;
+
+	printf("Timeouts: %lu, missed periods: %lu\n", stats->fired, 
+		   stats->missed);
+	printf("Lateness (" XKTIMER_TICK_UNIT "): max %lu, p50 <= %llu, "
+		   "p90 <= %llu, p99 <= %llu\n", (unsigned long)stats->late_max,
+		   xktimer_stats_bound(stats->late, 50, stats->late_max),
+		   xktimer_stats_bound(stats->late, 90, stats->late_max),
+		   xktimer_stats_bound(stats->late, 99, stats->late_max));
+
+	if (stats->runs == 0) return;
+
+	printf("Callbacks (counter ticks): %lu, mean %llu, max %llu, "
+		   "p50 <= %llu, p99 <= %llu\n", stats->runs,
+		   (unsigned long long)(stats->run_total / stats->runs),
+		   (unsigned long long)stats->run_max,
+		   xktimer_stats_bound(stats->run, 50, stats->run_max),
+		   xktimer_stats_bound(stats->run, 99, stats->run_max));
+}
+#endif
+
+#ifdef XKTIMER_TRACE
+bool xktimer_trace_dump(FILE * out)
+{
+	static const char * const names[] = {
+		"add", "start", "stop", "fire", "callback", "callback"
+	};
+	unsigned int used = __atomic_load_n(&xktimer_trace_used, __ATOMIC_RELAXED);
+	const char * sep = "";
+	unsigned int i;
+
+	if (out == NULL) return false;
+
+	if (used > XKTIMER_TRACE_THREADS) {
+		used = XKTIMER_TRACE_THREADS;
+	}
+
+	fprintf(out, "{\"traceEvents\":[");
+
+	for (i = 0; i < used; i++) {
+		xktimer_trace_ring_t * ring = &xktimer_trace_rings[i];
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long pos = head > XKTIMER_TRACE_SIZE ? 
+							head - XKTIMER_TRACE_SIZE : 0;
+
+		for (; pos < head; pos++) {
+			const xktimer_trace_event_t * entry = 
+				&ring->events[pos & (XKTIMER_TRACE_SIZE - 1)];
+			const char * phase;
+
+			// Callbacks are spans, the other events are instants
+			if (entry->event == XKTIMER_TRACE_CALL) {
+				phase = "\"B\"";
+			} else if (entry->event == XKTIMER_TRACE_CALL_END) {
+				phase = "\"E\"";
+			} else {
+				phase = "\"i\",\"s\":\"t\"";
+			}
+
+			fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"xktimer\","
+					"\"ph\":%s,\"ts\":%llu.%03u,\"pid\":1,\"tid\":%u,"
+					"\"args\":{\"timer\":\"%p\",\"state\":%u}}", sep, 
+					names[entry->event], phase, 
+					(unsigned long long)(entry->ns / 1000), 
+					(unsigned int)(entry->ns % 1000), i + 1, entry->timer, 
+					entry->state);
+			sep = ",";
+		}
+	}
+
+	fprintf(out, "\n],\"otherData\":{\"lost\":\"%lu\"}}\n", 
+			__atomic_load_n(&xktimer_trace_lost, __ATOMIC_RELAXED));
+
+	return !ferror(out);
+}
+
+void xktimer_trace_reset()
+{
+	unsigned int i;
+
+	for (i = 0; i < XKTIMER_TRACE_THREADS; i++) {
+		__atomic_store_n(&xktimer_trace_rings[i].head, 0, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&xktimer_trace_lost, 0, __ATOMIC_RELAXED);
+}
+#endif
+
+/**
+ * \brief			The time a periodic, dual-state or sequence timer takes to
+ * 					go through all of its states, in ticks
+ */
+static xktimer_utick_t xktimer_cycle(xktimer_ptr_t timer)
+{
+	xktimer_utick_t cycle = 0;
+	int i;
+
+	switch (timer->type) {
+	case XKTIMER_PERIODIC:
+		return timer->timeout;
+	case XKTIMER_DUAL_STATE:
+		return (xktimer_utick_t)timer->timeout + timer->timeout2;
+	case XKTIMER_SEQUENCE:
+		for (i = 0; i < timer->sequence_len; i++) {
+			cycle += XKTIMER_MS_TICKS(timer->sequence[i]);
+		}
+		break;
+	}
+
+	return cycle;
+}
+
+/**
+ * \brief			Move the deadline of an anchored timer past the given time
+ *
+ * \param ticks		The next deadline, which is moved to the first deadline
+ * 					on the grid of the timer that is after now
+ * \param state		The state for that deadline, which is updated with it
+ *
+ * \return			The number of deadlines that were skipped
+ */
+static uint32_t xktimer_skip_missed(xktimer_ptr_t timer, 
+									xktimer_tick_t now,
+									xktimer_tick_t * ticks,
+									uint8_t * state)
+{
+	xktimer_utick_t behind, n;
+	uint64_t missed;
+
+	if (!xktimer_reached(now, *ticks)) return 0;
+
+	behind = (xktimer_utick_t)xktimer_diff(now, *ticks);
+
+	if (timer->type == XKTIMER_PERIODIC) {
+		n = behind / timer->timeout + 1;
+		*ticks = xktimer_ticks_after(*ticks, n * timer->timeout);
+		missed = n;
+	} else {
+		xktimer_utick_t cycle = xktimer_cycle(timer);
+		uint8_t steps = timer->type == XKTIMER_SEQUENCE ? 
+						timer->sequence_len : 2;
+
+		// Skip the whole cycles first, which keeps the state
+		n = behind / cycle;
+		*ticks = xktimer_ticks_after(*ticks, n * cycle);
+		missed = (uint64_t)n * steps;
+
+		// Then less than one cycle is left, so at most one deadline per step
+		while (xktimer_reached(now, *ticks)) {
+			*state = xktimer_next_state(timer, *state);
+			*ticks = xktimer_ticks_after(*ticks, 
+										 xktimer_state_span(timer, *state));
+			missed++;
+		}
+	}
+
+	return missed > UINT32_MAX ? UINT32_MAX : (uint32_t)missed;
+}
+
+/**
+ * \brief			Set the next deadline of an anchored timer
+ *
+ * \param deadline	The deadline that timed out
+ *
+ * \return			false if the timeout is skipped by XKTIMER_OVERRUN_SKIP
+ */
+static bool xktimer_update_ticks_anchored(xktimer_ptr_t timer,
+										  xktimer_tick_t deadline,
+										  xktimer_tick_t now)
+{
+	xktimer_tick_t ticks;
+	uint8_t state;
+
+	// A timer with no period can not be kept on a grid
+	if (xktimer_cycle(timer) == 0) {
+		xktimer_update_ticks_at(timer, now);
+		return true;
+	}
+
+	timer->ticks = xktimer_ticks_after(deadline, 
+									   xktimer_state_span(timer, timer->state));
+
+	if (timer->overrun == XKTIMER_OVERRUN_CATCH_UP) {
+		// Only count the deadlines that are behind, they run on the next passes
+		ticks = timer->ticks;
+		state = timer->state;
+		timer->missed = xktimer_skip_missed(timer, now, &ticks, &state);
+	} else {
+		timer->missed = xktimer_skip_missed(timer, now, &timer->ticks, 
+											&timer->state);
+	}
+
+	xktimer_reschedule(timer);
+
+	return timer->overrun != XKTIMER_OVERRUN_SKIP || timer->missed == 0;
+}
+
+/**
+ * \brief			Update the state and ticks of a timer that has timed out
+ *
+ * \return			false if the timer was touched and moved to a deadline
+ * 					that is still ahead, or the timeout is skipped. The
+ * 					callback must not be called then.
+ */
+static bool xktimer_expire_state(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	xktimer_tick_t deadline;
+
+	// A touched timer is moved to the deadline after the last touch first
+	if (timer->touched) {
+		xktimer_update_ticks_at(timer, timer->touch);
+
+		if (!xktimer_reached(now, timer->ticks)) return false;
+	}
+
+	deadline = timer->ticks;
+
+#ifdef XKTIMER_TRACE
+	xktimer_trace(fire, XKTIMER_TRACE_FIRE, timer, timer->state);
+#endif
+
+#ifdef XKTIMER_STATS
+	xktimer_stats_fire(timer, now);
+#endif
+
+	switch (timer->type) {
+	case XKTIMER_SINGLE_SHOT:
+		timer->enabled = false;
+		break;
+	case XKTIMER_PERIODIC:
+		break;
+	case XKTIMER_DUAL_STATE:
+	case XKTIMER_SEQUENCE:
+		timer->state = xktimer_next_state(timer, timer->state);
+		break;
+	}
+
+	timer->missed = 0;
+
+	if (timer->overrun != XKTIMER_OVERRUN_DRIFT && 
+		timer->type != XKTIMER_SINGLE_SHOT) {
+		return xktimer_update_ticks_anchored(timer, deadline, now);
+	}
+
+	xktimer_update_ticks_at(timer, now);
+
+	return true;
+}
+
+/**
+ * \brief			Call the handler or the callback function of a timer
+ * 					that has expired, if any
+ */
+static void xktimer_fire(xktimer_ptr_t timer)
+{
+#ifdef XKTIMER_TRACE
+	// Kept for the end of the call, the timer could be freed by then
+	uint8_t state = timer->state;
+#endif
+
+	// The handler can free the timer, so it must be the last to touch it
+	if (timer->handler) {
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call, XKTIMER_TRACE_CALL, timer, state);
+#endif
+		timer->handler(timer);
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call_end, XKTIMER_TRACE_CALL_END, timer, state);
+#endif
+		return;
+	}
+
+#ifdef XKTIMER_DISPATCH
+	if (timer->callback && timer->ctx && timer->ctx->pool) {
+		xktimer_pool_dispatch(timer->ctx->pool, timer, timer->state, 
+							  timer->ctx->pool_worker);
+		return;
+	}
+#endif
+
+	if (timer->callback) {
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call, XKTIMER_TRACE_CALL, timer, state);
+#endif
+#ifdef XKTIMER_STATS
+		xktimer_stats_call(timer);
+#else
+		timer->callback(timer->state);
+#endif
+#ifdef XKTIMER_TRACE
+		xktimer_trace(call_end, XKTIMER_TRACE_CALL_END, timer, state);
+#endif
+	}
+}
+
+/**
+ * \brief			Expire a timer that has timed out
+ *
+ * Updates the state and ticks of the timer based on its type and then calls
+ * the handler or the callback function, if any.
+ */
+static bool xktimer_expire(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	if (!xktimer_expire_state(timer, now)) return false;
+
+	xktimer_fire(timer);
+
+	return true;
+}
+
+static bool xktimer_handle_at(xktimer_ptr_t timer, xktimer_tick_t now)
+{
+	if (!xktimer_assert(timer) || !timer->enabled) return false;
+
+	if (xktimer_reached(now, timer->ticks)) {
+		return xktimer_expire(timer, now);
+	}
+
+	return false;
+}
+
+bool xktimer_handle(xktimer_ptr_t timer)
+{
+	if (!xktimer_assert(timer)) return false;
+
+	return xktimer_handle_at(timer, xktimer_timer_now(timer));
+}
+
+void xktimer_task()
+{
+	xktimer_ctx_task(&xktimer_ctx_default);
+}
+
+#ifdef XKTIMER_SOA
+/**
+ * \brief			Find the timed out slots in a block of the SoA arrays
+ *
+ * \param block		The first slot of the block, a multiple of
+ * 					XKTIMER_SOA_LANES
+ *
+ * \return			A mask with bit i set if slot block + i has timed out
+ */
+static unsigned int xktimer_soa_scan(xktimer_ctx_t * ctx, 
+									 int block, 
+									 xktimer_tick_t now)
+{
+	const uint32_t * deadline = &ctx->soa_deadline[block];
+	const int32_t * enabled = &ctx->soa_enabled[block];
+#if defined(__AVX2__)
+	__m256i diff = _mm256_sub_epi32(
+		_mm256_load_si256((const __m256i *)deadline), 
+		_mm256_set1_epi32((int32_t)xktimer_soa_ticks(now)));
+	__m256i hit = _mm256_andnot_si256(
+		_mm256_cmpgt_epi32(diff, _mm256_setzero_si256()), 
+		_mm256_load_si256((const __m256i *)enabled));
+
+	return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(hit));
+#elif defined(__SSE2__)
+	__m128i vnow = _mm_set1_epi32((int32_t)xktimer_soa_ticks(now));
+	__m128i zero = _mm_setzero_si128();
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < XKTIMER_SOA_LANES; i += 4) {
+		__m128i diff = _mm_sub_epi32(
+			_mm_load_si128((const __m128i *)&deadline[i]), vnow);
+		__m128i hit = _mm_andnot_si128(
+			_mm_cmpgt_epi32(diff, zero), 
+			_mm_load_si128((const __m128i *)&enabled[i]));
+
+		mask |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(hit)) << i;
+	}
+
+	return mask;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	static const uint32_t bits[4] = { 1, 2, 4, 8 };
+	uint32x4_t vbits = vld1q_u32(bits);
+	uint32x4_t vnow = vdupq_n_u32(xktimer_soa_ticks(now));
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < XKTIMER_SOA_LANES; i += 4) {
+		int32x4_t diff = vreinterpretq_s32_u32(
+			vsubq_u32(vld1q_u32(&deadline[i]), vnow));
+		uint32x4_t hit = vandq_u32(vcleq_s32(diff, vdupq_n_s32(0)), 
+								   vreinterpretq_u32_s32(vld1q_s32(&enabled[i])));
+
+		mask |= vaddvq_u32(vandq_u32(hit, vbits)) << i;
+	}
+
+	return mask;
+#else
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < XKTIMER_SOA_LANES; i++) {
+		if (enabled[i] && (int32_t)(deadline[i] - xktimer_soa_ticks(now)) <= 0) {
+			mask |= 1u << i;
+		}
+	}
+
+	return mask;
+#endif
+}
+#endif
+
+/**
+ * \brief			Start a pass over the timers of a context at the given time
+ */
+static void xktimer_pass_begin(xktimer_ctx_t * ctx, xktimer_tick_t now)
+{
+	ctx->pass_now = now;
+	ctx->pass_active = true;
+
+#ifdef XKTIMER_TICKLESS
+	// An interrupt during the pass flags the next pass again
+	if (ctx == &xktimer_ctx_default) {
+		xktimer_hw_pending = false;
+	}
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+	// Apply the commands posted by other threads before checking the timers
+	xktimer_cmd_drain(ctx);
+#endif
+
+#ifdef XKTIMER_WHEEL
+	xktimer_wheel_advance(ctx, now);
+#elif defined(XKTIMER_HEAP)
+	ctx->heap_pass++;
+#elif defined(XKTIMER_INTRUSIVE)
+	ctx->list_iter = ctx->list;
+#elif defined(XKTIMER_SOA)
+	// Move the base of the SoA deadlines before the scan could wrap
+	if (xktimer_diff(now, ctx->soa_base) < 0 || 
+		xktimer_diff(now, ctx->soa_base) >= 
+		(xktimer_diff_t)XKTIMER_MS_TICKS(XKTIMER_SOA_WINDOW)) {
+		int i;
+
+		ctx->soa_base = now;
+
+		for (i = 0; i < ctx->ref_idx; i++) {
+			if (ctx->ref[i] != NULL) {
+				ctx->soa_deadline[i] = 
+					xktimer_soa_deadline(ctx, ctx->ref[i]->ticks);
+			}
+		}
+	}
+#endif
+}
+
+/**
+ * \brief			Take the next timer that timed out in the current pass
+ *
+ * The state of the timer is not updated, so the timer must be expired before
+ * this is called again.
+ *
+ * \param pos		The position in the array of added timers, which must
+ * 					start at 0 for each pass. Only used by the linear scan.
+ *
+ * \return			The timer, or NULL if no more timers have timed out
+ */
+static xktimer_ptr_t xktimer_pass_next(xktimer_ctx_t * ctx, 
+									   xktimer_tick_t now, 
+									   int * pos)
+{
+	xktimer_ptr_t timer;
+
+#ifdef XKTIMER_WHEEL
+	(void)pos;
+
+	while ((timer = ctx->wheel_due) != NULL) {
+		xktimer_unlink(ctx, timer);
+
+		if (xktimer_reached(now, timer->ticks)) {
+			return timer;
+		}
+
+		// Parked beyond the range of the wheel, or in the bucket of this
+		// pass but not due yet, so place it again
+		xktimer_wheel_insert(ctx, timer);
+	}
+#elif defined(XKTIMER_HEAP)
+	(void)pos;
+
+	while ((timer = xktimer_heap_top()) != NULL && 
+		   xktimer_reached(now, timer->ticks)) {
+		if (timer->heap_pass != ctx->heap_pass) {
+			timer->heap_pass = ctx->heap_pass;
+			return timer;
+		}
+
+		// Timed out in this pass already and still due, like a catch-up
+		// timer that is behind or one restarted with a zero timeout. It
+		// waits for the next pass, out of the way of the timers below it.
+		xktimer_heap_remove(ctx, timer);
+
+		if (!timer->heap_deferred) {
+			timer->heap_deferred = true;
+			timer->heap_defer = ctx->heap_defer;
+			ctx->heap_defer = timer;
+		}
+	}
+#elif defined(XKTIMER_INTRUSIVE)
+	(void)pos;
+
+	while ((timer = ctx->list_iter) != NULL) {
+		// The callback could remove the next timer from the list
+		ctx->list_iter = timer->list_next;
+
+		if (timer->enabled && xktimer_reached(now, timer->ticks)) {
+			return timer;
+		}
+	}
+#elif defined(XKTIMER_SOA)
+	while (*pos < ctx->ref_idx) {
+		int block = *pos & ~(XKTIMER_SOA_LANES - 1);
+		unsigned int mask = xktimer_soa_scan(ctx, block, now);
+
+		// Skip the lanes before the position in the block
+		mask &= ~0u << (*pos - block);
+
+		if (mask == 0) {
+			*pos = block + XKTIMER_SOA_LANES;
+			continue;
+		}
+
+		*pos = block + __builtin_ctz(mask);
+		timer = ctx->ref[(*pos)++];
+
+		// The scan only looked at the low 32 bits of the deadline in ms
+		if (timer != NULL && timer->enabled && 
+			xktimer_reached(now, timer->ticks)) {
+			return timer;
+		}
+	}
+#else
+	while (*pos < ctx->ref_idx) {
+		// Removed timers leave a NULL slot
+		timer = ctx->ref[(*pos)++];
+
+		if (timer != NULL && timer->enabled && 
+			xktimer_reached(now, timer->ticks)) {
+			return timer;
+		}
+	}
+#endif
+
+	return NULL;
+}
+
+/**
+ * \brief			Finish a pass started with xktimer_pass_begin()
+ */
+static void xktimer_pass_end(xktimer_ctx_t * ctx)
+{
+#ifdef XKTIMER_HEAP
+	xktimer_ptr_t timer;
+
+	// Put the timers that xktimer_pass_next() set aside back in the heap
+	while ((timer = ctx->heap_defer) != NULL) {
+		ctx->heap_defer = timer->heap_defer;
+		timer->heap_defer = NULL;
+		timer->heap_deferred = false;
+
+		if (timer->enabled && !xktimer_heap_contains(timer)) {
+			xktimer_heap_insert(ctx, timer);
+		}
+	}
+#endif
+
+	ctx->pass_active = false;
+}
+
+void xktimer_ctx_task(xktimer_ctx_t * ctx)
+{
+	xktimer_tick_t now = xktimer_clock();
+	xktimer_ptr_t timer;
+	int pos = 0;
+
+	// Use the same time for every timer handled in this pass
+	xktimer_pass_begin(ctx, now);
+
+	while ((timer = xktimer_pass_next(ctx, now, &pos)) != NULL) {
+		xktimer_expire(timer, now);
+	}
+
+	xktimer_pass_end(ctx);
+
+#if defined(XKTIMER_FD) || defined(XKTIMER_TICKLESS)
+	xktimer_wake_next(ctx);
+#endif
+}
+
+size_t xktimer_collect_expired(xktimer_ptr_t * out, 
+							   size_t cap, 
+							   xktimer_tick_t now)
+{
+	return xktimer_ctx_collect_expired(&xktimer_ctx_default, out, cap, now);
+}
+
+size_t xktimer_ctx_collect_expired(xktimer_ctx_t * ctx,
+								   xktimer_ptr_t * out,
+								   size_t cap,
+								   xktimer_tick_t now)
+{
+	xktimer_ptr_t timer;
+	size_t count = 0;
+	int pos = 0;
+
+	if (out == NULL || cap == 0) return 0;
+
+	xktimer_pass_begin(ctx, now);
+
+	// Timers that do not fit stay expired for the next call
+	while (count < cap && (timer = xktimer_pass_next(ctx, now, &pos)) != NULL) {
+		if (xktimer_expire_state(timer, now)) {
+			out[count++] = timer;
+		}
+	}
+
+	xktimer_pass_end(ctx);
+
+	return count;
+}
+
+#ifdef XKTIMER_BUDGET
+size_t xktimer_task_budget(unsigned int max_callbacks, uint32_t max_us)
+{
+	return xktimer_ctx_task_budget(&xktimer_ctx_default, max_callbacks, 
+								   max_us);
+}
+
+size_t xktimer_ctx_task_budget(xktimer_ctx_t * ctx,
+							   unsigned int max_callbacks,
+							   uint32_t max_us)
+{
+	xktimer_tick_t now = xktimer_clock();
+	xktimer_tick_t end = xktimer_ticks_after(now, XKTIMER_US_TICKS(max_us));
+	xktimer_ptr_t timer;
+	unsigned int calls = 0;
+	int pos = 0;
+
+	xktimer_pass_begin(ctx, now);
+
+	// Update all the timers that timed out, and queue them behind the ones
+	// left over by the last pass
+	while ((timer = xktimer_pass_next(ctx, now, &pos)) != NULL) {
+		if (xktimer_expire_state(timer, now) && timer->ready_pprev == NULL) {
+			xktimer_ready_push(ctx, timer);
+		}
+	}
+
+	while ((max_callbacks == 0 || calls < max_callbacks) && 
+		   (timer = xktimer_ready_pop(ctx)) != NULL) {
+		xktimer_fire(timer);
+		calls++;
+
+		if (max_us && xktimer_reached(xktimer_clock(), end)) break;
+	}
+
+	xktimer_pass_end(ctx);
+
+#if defined(XKTIMER_FD) || defined(XKTIMER_TICKLESS)
+	// Timers still waiting for their callback need another pass right away
+	if (ctx->ready_len > 0) {
+		xktimer_wake_at(ctx, now);
+	} else {
+		xktimer_wake_next(ctx);
+	}
+#endif
+
+	return ctx->ready_len;
+}
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+void xktimer_run()
+{
+	xktimer_ctx_run_until(&xktimer_ctx_default, XKTIMER_NO_DEADLINE);
+}
+
+void xktimer_run_until(xktimer_tick_t deadline)
+{
+	xktimer_ctx_run_until(&xktimer_ctx_default, deadline);
+}
+
+void xktimer_quit()
+{
+	xktimer_ctx_quit(&xktimer_ctx_default);
+}
+
+void xktimer_lock()
+{
+	xktimer_ctx_lock(&xktimer_ctx_default);
+}
+
+void xktimer_unlock()
+{
+	xktimer_ctx_unlock(&xktimer_ctx_default);
+}
 
-#include "includes.h"
+void xktimer_ctx_run(xktimer_ctx_t * ctx)
+{
+	xktimer_ctx_run_until(ctx, XKTIMER_NO_DEADLINE);
+}
 
-#include "xktimer.h"
+void xktimer_ctx_run_until(xktimer_ctx_t * ctx, xktimer_tick_t deadline)
+{
+	pthread_mutex_lock(&ctx->loop_mutex);
 
-/**
- * \brief		The array of timers.
- *
- * This array is used to store pointers to the various timers that have been
- * added using timer_add() or timer_add_dual().
- */
-#ifdef XKTIMER_NO_MALLOC
-xktimer_ptr_t	xktimer_ref[XKTIMER_MAX_TIMERS];
-#else
-xktimer_ptr_t * xktimer_ref;
+	while (!ctx->loop_quit) {
+		xktimer_tick_t next;
+
+		xktimer_ctx_task(ctx);
+
+		if (deadline != XKTIMER_NO_DEADLINE && 
+			xktimer_reached(xktimer_clock(), deadline)) {
+			break;
+		}
+
+		// Sleep until the next timer is due or the deadline is reached
+		next = xktimer_ctx_next_deadline(ctx);
+		if (deadline != XKTIMER_NO_DEADLINE && 
+			(next == XKTIMER_NO_DEADLINE || xktimer_diff(deadline, next) < 0)) {
+			next = deadline;
+		}
+
+		if (ctx->loop_quit) break;
+
+		__atomic_store_n(&ctx->loop_sleeping, true, __ATOMIC_SEQ_CST);
+
+#ifdef XKTIMER_CMD_QUEUE
+		// A command posted before the producer could see us sleep runs now
+		if (xktimer_cmd_waiting(ctx)) {
+			next = xktimer_clock();
+		}
 #endif
 
-//! The index of the last added timer + 1
-int	 			xktimer_ref_idx;
+		if (next == XKTIMER_NO_DEADLINE) {
+			pthread_cond_wait(&ctx->loop_cond, &ctx->loop_mutex);
+		} else if (xktimer_diff(next, xktimer_clock()) > 0) {
+			struct timespec ts;
 
-void xktimer_init()
+			xktimer_timespec(&ts, next);
+			pthread_cond_timedwait(&ctx->loop_cond, &ctx->loop_mutex, &ts);
+		}
+
+		__atomic_store_n(&ctx->loop_sleeping, false, __ATOMIC_RELAXED);
+	}
+
+	// A quit only stops one loop, even if it came in before the loop started
+	ctx->loop_quit = false;
+
+	pthread_mutex_unlock(&ctx->loop_mutex);
+}
+
+void xktimer_ctx_quit(xktimer_ctx_t * ctx)
 {
-    xktimer_ref_idx = 0;
-    
-#ifndef XKTIMER_NO_MALLOC
-    xktimer_ref = (xktimer_ptr_t *)malloc(1 * XKTIMER_PTR_SIZE);
+	pthread_mutex_lock(&ctx->loop_mutex);
+
+	ctx->loop_quit = true;
+	xktimer_loop_wake(ctx);
+
+	pthread_mutex_unlock(&ctx->loop_mutex);
+}
+
+void xktimer_ctx_lock(xktimer_ctx_t * ctx)
+{
+	pthread_mutex_lock(&ctx->loop_mutex);
+}
+
+void xktimer_ctx_unlock(xktimer_ctx_t * ctx)
+{
+	pthread_mutex_unlock(&ctx->loop_mutex);
+}
 #endif
-    
-#ifdef DEBUG
-    printf("XKTimer Init\n");
-    printf("Timer Resolution: %d\n", XKTIMER_RESOLUTION);
-    printf("Clocks Per Sec: %ld\n", CLOCKS_PER_SEC);
+
+#ifdef XKTIMER_TICKLESS
+void xktimer_isr()
+{
+#ifdef XKTIMER_TICKLESS_DEFER
+	// Leave the callbacks to the next xktimer_task() of the main loop
+	xktimer_hw_pending = true;
+#else
+	xktimer_task();
 #endif
 }
 
-bool xktimer_assert(xktimer_ptr_t timer)
+bool xktimer_pending()
 {
-	return timer != NULL;
+	return xktimer_hw_pending;
 }
+#endif
 
-bool xktimer_add_ptr(xktimer_t * timer)
+#ifdef XKTIMER_FD
+int xktimer_fd()
 {
-#ifdef XKTIMER_NO_MALLOC
-    // Now copy the pointer to the timer struct
-    xktimer_ref[xktimer_ref_idx++] = timer;
-#else
-    if (xktimer_ref == NULL) {
-        return false;
-    } else {
-        int ref_size = sizeof(xktimer_ref) / XKTIMER_PTR_SIZE;
-        if (xktimer_ref_idx + 1 >= ref_size) {
-            // Reallocate for more timers
-            xktimer_ref = (xktimer_ptr_t *)realloc(xktimer_ref, (xktimer_ref_idx + 1) * 
-															     XKTIMER_PTR_SIZE);
-        }
-    }
+	return xktimer_ctx_fd(&xktimer_ctx_default);
+}
 
-    // Allocate the memory for this timer pointer
-    xktimer_ref[xktimer_ref_idx] = (xktimer_ptr_t)malloc(XKTIMER_PTR_SIZE);
-    // Now copy the pointer to the timer struct
-	// and increment to the next timer
-    xktimer_ref[xktimer_ref_idx++] = timer;
-#endif
-    
-    return true;
+void xktimer_on_readable()
+{
+	xktimer_ctx_on_readable(&xktimer_ctx_default);
 }
 
-bool xktimer_add(xktimer_ptr_t timer,
-			     uint8_t type,
-			     uint32_t timeout,
-			     void (*callback)())
+int xktimer_ctx_fd(xktimer_ctx_t * ctx)
 {
-	if (!xktimer_assert(timer) || xktimer_ref_idx >= XKTIMER_MAX_TIMERS) {
-		return false;
+	if (ctx->fd < 0) {
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+		if (fd < 0) return -1;
+
+		// The producers of xktimer_post_start() and co. read it
+		__atomic_store_n(&ctx->fd, fd, __ATOMIC_RELAXED);
+
+		xktimer_fd_arm(ctx, xktimer_ctx_next_deadline(ctx));
 	}
 
-	timer->type = type;
-	timer->enabled = false;
-	timer->state = 0;
-	timer->timeout = timeout;
-	timer->timeout2 = 0;
-	timer->callback = callback;
+	return ctx->fd;
+}
 
-	xktimer_update_ticks(timer);
-    xktimer_add_ptr(timer);
-    
-	return true;
+void xktimer_ctx_on_readable(xktimer_ctx_t * ctx)
+{
+	uint64_t expirations;
+	ssize_t len;
+
+	if (ctx->fd < 0) return;
+
+	// Clear the readable state. This fails with EAGAIN when the timerfd was
+	// armed again after firing, which is fine.
+	len = read(ctx->fd, &expirations, sizeof(expirations));
+	(void)len;
+
+	xktimer_ctx_task(ctx);
 }
+#endif
 
-bool xktimer_add_dual(xktimer_ptr_t timer,
-				      uint32_t timeout,
-				      uint32_t timeout2,
-				      void (*callback)(int))
+#ifdef XKTIMER_SERVICE
+//! The shard run by the calling thread, or NULL outside of a service
+static __thread xktimer_ctx_t * xktimer_service_current;
+
+//! Keep a thread on the given core, if the platform supports it
+static void xktimer_service_pin(pthread_t thread, int core)
 {
-	if (!xktimer_assert(timer) || xktimer_ref_idx >= XKTIMER_MAX_TIMERS) {
-		return false;
-	}
+#ifdef __linux__
+	cpu_set_t set;
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
 
-	timer->type = XKTIMER_DUAL_STATE;
-	timer->enabled = false;
-	timer->state = 0;
-	timer->timeout = timeout;
-	timer->timeout2 = timeout2;
-	timer->callback = callback;
+	if (cores < 1) return;
 
-	xktimer_update_ticks(timer);
-    xktimer_add_ptr(timer);
-    
-	return true;
+	CPU_ZERO(&set);
+	CPU_SET(core % cores, &set);
+	pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+	(void)thread;
+	(void)core;
+#endif
 }
 
-clock_t xktimer_clock()
+static void * xktimer_service_main(void * arg)
 {
-	return clock() / (CLOCKS_PER_SEC / XKTIMER_RESOLUTION);
+	xktimer_ctx_t * ctx = arg;
+
+	xktimer_service_current = ctx;
+	xktimer_ctx_run(ctx);
+
+	return NULL;
 }
 
-void xktimer_update_ticks(xktimer_ptr_t timer)
+/**
+ * \brief			Stop the first running shards and free all of them
+ */
+static void xktimer_service_shutdown(xktimer_service_t * service, int running)
 {
-	if (!xktimer_assert(timer)) return;
+	int i;
 
-	if (timer->state == 0) {
-		timer->ticks = xktimer_clock() + timer->timeout;
-	} else {
-		timer->ticks = xktimer_clock() + timer->timeout2;
+	for (i = 0; i < running; i++) {
+		xktimer_ctx_quit(&service->shard[i]);
+	}
+
+	for (i = 0; i < running; i++) {
+		pthread_join(service->thread[i], NULL);
+	}
+
+	// Run the callbacks that are still queued before freeing the shards
+	xktimer_pool_stop(&service->pool);
+
+	for (i = 0; i < service->shards; i++) {
+		xktimer_ctx_destroy(&service->shard[i]);
 	}
 }
 
-uint32_t xktimer_timeout(xktimer_ptr_t timer)
+bool xktimer_service_start(xktimer_service_t * service, int shards)
 {
-	if (!xktimer_assert(timer)) return 0;
-	
-	return timer->timeout;
+	int i;
+
+	if (service == NULL) return false;
+
+	if (shards <= 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+		shards = cores > 0 ? (int)cores : 1;
+	}
+
+	if (shards > XKTIMER_SERVICE_MAX_SHARDS) {
+		shards = XKTIMER_SERVICE_MAX_SHARDS;
+	}
+
+	if (!xktimer_pool_start(&service->pool, shards)) {
+		return false;
+	}
+
+	service->shards = shards;
+	service->next = 0;
+
+	for (i = 0; i < shards; i++) {
+		xktimer_ctx_t * ctx = &service->shard[i];
+
+		xktimer_ctx_init(ctx);
+		ctx->pool = &service->pool;
+		ctx->pool_worker = i;
+
+		xktimer_service_pin(service->pool.worker[i].thread, i);
+	}
+
+	for (i = 0; i < shards; i++) {
+		if (pthread_create(&service->thread[i], NULL, xktimer_service_main, 
+						   &service->shard[i]) != 0) {
+			break;
+		}
+
+		xktimer_service_pin(service->thread[i], i);
+	}
+
+	if (i < shards) {
+		// Stop the shards that did start
+		xktimer_service_shutdown(service, i);
+
+		return false;
+	}
+
+	return true;
 }
 
-uint32_t xktimer_timeout2(xktimer_ptr_t timer)
+void xktimer_service_stop(xktimer_service_t * service)
 {
-	if (!xktimer_assert(timer)) return 0;
-	
-	return timer->timeout2;
+	xktimer_service_shutdown(service, service->shards);
 }
 
-clock_t xktimer_next_timeout(xktimer_ptr_t timer)
+xktimer_ctx_t * xktimer_service_local(xktimer_service_t * service)
 {
-	if (!xktimer_assert(timer)) return 0;
+	unsigned int shard;
+	int cpu;
+
+	// Threads of the service keep their timers on their own shard
+	if (xktimer_service_current != NULL && 
+		xktimer_service_current >= &service->shard[0] && 
+		xktimer_service_current < &service->shard[service->shards]) {
+		return xktimer_service_current;
+	}
+
+	cpu = sched_getcpu();
+	if (cpu >= 0) {
+		shard = (unsigned int)cpu;
+	} else {
+		shard = __atomic_fetch_add(&service->next, 1, __ATOMIC_RELAXED);
+	}
 
-	return timer->ticks - clock();
+	return &service->shard[shard % service->shards];
 }
 
-void xktimer_set_timeout(xktimer_ptr_t timer, 
-						 uint32_t timeout)
+bool xktimer_service_add(xktimer_service_t * service,
+						 xktimer_ptr_t timer,
+						 uint8_t type,
+						 uint32_t timeout,
+						 void (*callback)())
 {
-	if (!xktimer_assert(timer)) return;
+	xktimer_ctx_t * ctx = xktimer_service_local(service);
+	bool added;
 
-	// Set the timeout value
-	timer->timeout = timeout;
+	xktimer_ctx_lock(ctx);
+	added = xktimer_ctx_add(ctx, timer, type, timeout, callback);
+	xktimer_ctx_unlock(ctx);
 
-	// Now update the timer ticks
-	xktimer_update_ticks(timer);
+	return added;
 }
 
-void xktimer_set_timeout_dual(xktimer_ptr_t timer,
+bool xktimer_service_add_dual(xktimer_service_t * service,
+							  xktimer_ptr_t timer,
 							  uint32_t timeout,
-							  uint32_t timeout2)
+							  uint32_t timeout2,
+							  void (*callback)(int))
 {
-	if (!xktimer_assert(timer)) return;
+	xktimer_ctx_t * ctx = xktimer_service_local(service);
+	bool added;
 
-	timer->state = 0;
+	xktimer_ctx_lock(ctx);
+	added = xktimer_ctx_add_dual(ctx, timer, timeout, timeout2, callback);
+	xktimer_ctx_unlock(ctx);
 
-	// Set the timeouts
-	timer->timeout = timeout;
-	timer->timeout2 = timeout2;
+	return added;
+}
 
-	// Now update the timer ticks
-	xktimer_update_ticks(timer);
+bool xktimer_service_add_sequence(xktimer_service_t * service,
+								  xktimer_ptr_t timer,
+								  const uint32_t * sequence,
+								  uint8_t count,
+								  void (*callback)(int))
+{
+	xktimer_ctx_t * ctx = xktimer_service_local(service);
+	bool added;
+
+	xktimer_ctx_lock(ctx);
+	added = xktimer_ctx_add_sequence(ctx, timer, sequence, count, callback);
+	xktimer_ctx_unlock(ctx);
+
+	return added;
 }
+#endif
 
+#ifdef XKTIMER_PERSIST
+//! The size of the mapped file of a store of the given number of records
+#define xktimer_persist_len(count)	\
+	(sizeof(xktimer_persist_header_t) + \
+	 (size_t)(count) * sizeof(xktimer_persist_rec_t))
 
-void xktimer_start(xktimer_ptr_t timer)
+bool xktimer_persist_open(xktimer_persist_t * store,
+						  const char * path,
+						  xktimer_t * timers,
+						  uint32_t count)
 {
-	if (!xktimer_assert(timer)) return;
+	return xktimer_ctx_persist_open(&xktimer_ctx_default, store, path, 
+									timers, count);
+}
 
-	timer->enabled = true;
-	timer->state = 0;
+bool xktimer_ctx_persist_open(xktimer_ctx_t * ctx,
+							  xktimer_persist_t * store,
+							  const char * path,
+							  xktimer_t * timers,
+							  uint32_t count)
+{
+	size_t len = xktimer_persist_len(count);
+	xktimer_persist_header_t * header;
+	struct stat st;
+	bool fresh;
+	void * map;
+	uint32_t i;
+	int fd;
 
-	xktimer_update_ticks(timer);
+	if (store == NULL || path == NULL || timers == NULL || count == 0) {
+		return false;
+	}
+
+	// The timers are cleared below, which would corrupt the context
+	for (i = 0; i < count; i++) {
+		if (xktimer_ctx_contains(ctx, &timers[i])) return false;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) return false;
+
+	// A new file is zero filled by ftruncate(), so all of its records are free
+	fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+	if (fresh ? ftruncate(fd, (off_t)len) != 0 : 
+				fstat(fd, &st) != 0 || (size_t)st.st_size != len) {
+		close(fd);
+		return false;
+	}
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	header = (xktimer_persist_header_t *)map;
+
+	if (fresh) {
+		header->magic = XKTIMER_PERSIST_MAGIC;
+		header->rec_size = sizeof(xktimer_persist_rec_t);
+		header->version = XKTIMER_PERSIST_VERSION;
+		header->count = count;
+	} else if (header->magic != XKTIMER_PERSIST_MAGIC || 
+			   header->rec_size != sizeof(xktimer_persist_rec_t) || 
+			   header->version != XKTIMER_PERSIST_VERSION || 
+			   header->count != count) {
+		munmap(map, len);
+		close(fd);
+		return false;
+	}
+
+	store->ctx = ctx;
+	store->fd = fd;
+	store->header = header;
+	store->recs = (xktimer_persist_rec_t *)(header + 1);
+	store->timers = timers;
+	store->count = count;
+	memset(store->callbacks, 0, sizeof(store->callbacks));
+
+	memset(timers, 0, (size_t)count * sizeof(xktimer_t));
+
+	return true;
 }
 
-void xktimer_stop(xktimer_ptr_t timer)
+void xktimer_persist_close(xktimer_persist_t * store)
 {
-	if (!xktimer_assert(timer)) return;
+	uint32_t i;
 
-	timer->enabled = false;
+	if (store == NULL || store->header == NULL) return;
+
+	for (i = 0; i < store->count; i++) {
+		xktimer_ptr_t timer = &store->timers[i];
+
+		// Detach the record first, so the remove keeps it
+		if (timer->persist) {
+			timer->persist = NULL;
+			xktimer_remove(timer);
+		}
+	}
+
+	munmap(store->header, xktimer_persist_len(store->count));
+	close(store->fd);
+
+	store->fd = -1;
+	store->header = NULL;
+	store->recs = NULL;
 }
 
-bool xktimer_running(xktimer_ptr_t timer)
+bool xktimer_persist_callback(xktimer_persist_t * store,
+							  uint16_t id,
+							  void (*callback)(int))
 {
-	if (!xktimer_assert(timer)) return false;
+	if (store == NULL || id == 0 || id >= XKTIMER_PERSIST_CALLBACKS) {
+		return false;
+	}
 
-	return timer->enabled;
+	store->callbacks[id] = callback;
+
+	return true;
 }
 
-void xktimer_wait(uint32_t ms)
+size_t xktimer_persist_restore(xktimer_persist_t * store)
 {
-	clock_t timestamp = xktimer_clock();
+	xktimer_ctx_t * ctx = store->ctx;
+	xktimer_tick_t now = xktimer_ctx_now(ctx);
+	int64_t wall = xktimer_persist_now();
+	size_t added = 0;
+	uint32_t i;
+	int first;
 
-	while (xktimer_clock() < timestamp + ms) {
-#ifdef timer_wait_task
-		xktimer_wait_task();
+#ifndef XKTIMER_INTRUSIVE
+	// Grow the registry once for all of the records
+	xktimer_ctx_reserve(ctx, ctx->ref_idx - ctx->ref_free_len + 
+						(int)store->count);
 #endif
-	}
-}
 
-bool xktimer_periodic(clock_t * ticks, uint32_t period)
-{
-	if (xktimer_clock() >= *ticks + period) {
-		*ticks = xktimer_clock();
-		return true;
+	first = xktimer_batch_begin(ctx);
+
+	for (i = 0; i < store->count; i++) {
+		xktimer_persist_rec_t * rec = &store->recs[i];
+		xktimer_ptr_t timer = &store->timers[i];
+		int64_t left = rec->deadline - wall;
+
+		if (rec->callback == 0 || rec->callback >= XKTIMER_PERSIST_CALLBACKS || 
+			store->callbacks[rec->callback] == NULL || 
+			rec->type < XKTIMER_SINGLE_SHOT || rec->type > XKTIMER_DUAL_STATE || 
+			xktimer_registered(timer)) {
+			continue;
+		}
+
+		if (!xktimer_add_timer(ctx, timer, rec->type, 
+							   XKTIMER_NS_TICKS(rec->timeout), 
+							   XKTIMER_NS_TICKS(rec->timeout2), 
+							   store->callbacks[rec->callback])) {
+			continue;
+		}
+
+		timer->state = rec->type == XKTIMER_DUAL_STATE ? rec->state & 1 : 0;
+		timer->enabled = rec->enabled != 0;
+		timer->overrun = rec->overrun;
+
+		// The timers that timed out while the program was down are due now
+		timer->ticks = xktimer_ticks_after(now, left > 0 ? 
+										   XKTIMER_NS_TICKS(left) : 0);
+
+		xktimer_batch_add(ctx, timer, &first);
+		timer->persist = rec;
+		added++;
 	}
 
-	return false;
+	xktimer_batch_end(ctx, first);
+
+	return added;
 }
 
-void xktimer_handle(xktimer_ptr_t timer)
+xktimer_ptr_t xktimer_persist_add(xktimer_persist_t * store,
+								  uint64_t key,
+								  uint8_t type,
+								  uint32_t timeout,
+								  uint32_t timeout2,
+								  uint16_t callback)
 {
-	if (!xktimer_assert(timer) || !timer->enabled) return;
+	uint32_t i;
 
-	if (xktimer_clock() >= timer->ticks) {
+	if (type < XKTIMER_SINGLE_SHOT || type > XKTIMER_DUAL_STATE || 
+		callback == 0 || callback >= XKTIMER_PERSIST_CALLBACKS || 
+		store->callbacks[callback] == NULL) {
+		return NULL;
+	}
 
-		switch (timer->type) {
-		case XKTIMER_SINGLE_SHOT:
-			timer->enabled = false;
-			break;
-		case XKTIMER_PERIODIC:
-			break;
-		case XKTIMER_DUAL_STATE:
-			if (timer->state == 0) {
-				timer->state = 1;
-			} else {
-				timer->state = 0;
-			}
-			break;
+	for (i = 0; i < store->count; i++) {
+		xktimer_persist_rec_t * rec = &store->recs[i];
+		xktimer_ptr_t timer = &store->timers[i];
+
+		// A record of a callback that is not registered is not free either
+		if (rec->callback != 0 || xktimer_registered(timer)) continue;
+
+		if (!xktimer_add_timer(store->ctx, timer, type, 
+							   XKTIMER_MS_TICKS(timeout),
+							   type == XKTIMER_DUAL_STATE ? 
+							   XKTIMER_MS_TICKS(timeout2) : 0,
+							   store->callbacks[callback])) {
+			return NULL;
 		}
 
+		rec->key = key;
+		rec->callback = callback;
+		rec->type = type;
+		timer->persist = rec;
+
+		// Also writes the rest of the record
 		xktimer_update_ticks(timer);
 
-		if (timer->callback) {
-			timer->callback(timer->state);
-		}
+		return timer;
 	}
+
+	return NULL;
 }
 
-void xktimer_task()
+xktimer_ptr_t xktimer_persist_find(xktimer_persist_t * store, uint64_t key)
 {
-	int i;
+	uint32_t i;
 
-	for (i = 0; i < xktimer_ref_idx; i++) {
-		xktimer_handle(xktimer_ref[i]);
+	for (i = 0; i < store->count; i++) {
+		xktimer_persist_rec_t * rec = &store->recs[i];
+
+		if (rec->callback != 0 && rec->key == key && 
+			store->timers[i].persist == rec) {
+			return &store->timers[i];
+		}
 	}
+
+	return NULL;
+}
+
+bool xktimer_persist_flush(xktimer_persist_t * store)
+{
+	if (store == NULL || store->header == NULL) return false;
+
+	return msync(store->header, xktimer_persist_len(store->count), 
+				 MS_SYNC) == 0;
 }
+#endif
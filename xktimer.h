@@ -72,6 +72,61 @@
  * the XKTimer module will call the timer's callback function.
  *
  *
+ * \section timer-clock	Clock Sources
+ * The standard C clock() function measures the CPU time used by the process,
+ * not the time that has elapsed. So, on hosted platforms, timers run slow
+ * whenever the process sleeps or waits for I/O. The clock source used by
+ * xktimer_clock() can be chosen at compile time by defining XKTIMER_CLOCK to
+ * one of the following values:
+ *  - XKTIMER_CLOCK_STD: The standard C clock() function. This is the default
+ *    unless XKTIMER_EVENT_LOOP is defined.
+ *  - XKTIMER_CLOCK_MONOTONIC: The POSIX CLOCK_MONOTONIC clock. This is the
+ *    default when XKTIMER_EVENT_LOOP is defined.
+ *  - XKTIMER_CLOCK_MONOTONIC_COARSE: The Linux CLOCK_MONOTONIC_COARSE clock,
+ *    which is cheaper to read but only advances once per kernel tick.
+ *  - XKTIMER_CLOCK_TSC: The CPU cycle counter (rdtsc on x86, cntvct_el0 on
+ *    ARMv8). On x86, the counter is calibrated against CLOCK_MONOTONIC in
+ *    xktimer_init() for XKTIMER_TSC_CALIBRATE_MS ms, and it must be
+ *    invariant (constant rate) for the timers to be correct.
+ *  - XKTIMER_CLOCK_HW: A hardware tick counter provided by the platform. The
+ *    XKTIMER_HW_TICKS() macro must read the counter and
+ *    XKTIMER_HW_TICKS_PER_SEC must be set to its frequency. The counter must
+ *    not wrap around, so narrow counters must be extended by the platform,
+ *    for example from an overflow interrupt.
+ *  - XKTIMER_CLOCK_CUSTOM: A function set at run time with xktimer_set_clock()
+ *    that returns the time in ms.
+ *
+ * All of the conversions to ms use constant divisors or a precomputed
+ * multiply and shift, so reading the clock never needs a run time division.
+ *
+ *
+ * \section timer-resolution	Timer Resolution
+ * By default, xktimer_clock() counts in ms and the deadlines are kept in a
+ * clock_t. Defining XKTIMER_RESOLUTION to 1000000 or 1000000000 makes the
+ * clock count in us or ns instead, so timers can run with periods below one
+ * ms. The resolution must be a multiple of 1000 that divides 1000000000.
+ *
+ * Above ms resolution, XKTIMER_TICKS_64 is defined and the ticks,
+ * xktimer_tick_t, are 64 bits wide on every platform, which lasts for
+ * centuries even in ns. It can also be defined in ms mode, for 32-bit
+ * platforms where clock() would otherwise wrap around after about 71
+ * minutes. All deadlines are compared with xktimer_reached() and the other
+ * differences are taken as signed values, so the comparisons stay correct
+ * if the ticks do wrap around.
+ *
+ * The timeouts given to xktimer_add(), xktimer_set_timeout() and the other
+ * functions that take a uint32_t stay in ms, and are converted to ticks.
+ * xktimer_set_timeout_us(), xktimer_set_timeout_ns() and their dual-state
+ * variants take a uint64_t in us or ns, which is rounded up to the next tick
+ * so timers never time out early. The values returned by xktimer_clock(),
+ * xktimer_next_deadline() and xktimer_next_timeout() are in ticks, and
+ * XKTIMER_TICKS_PER_MS converts them back to ms.
+ *
+ * With XKTIMER_WHEEL, each bucket of the first level still covers about one
+ * ms, 2^XKTIMER_WHEEL_GRAIN_BITS ticks, and the timers in the current bucket
+ * are checked against their exact deadline on every pass.
+ *
+ *
  * \section timer-single 	Single-State Timers
  * The operation of so called "single-state" timers is simple. Basically, the
  * user creates an instance of the xktimer_t struct and passes it to the
@@ -93,7 +148,7 @@
  * If a simpler or smaller type of single-state periodic timer is desired, the
  * xktimer_periodic() function provides this functionality. To use this function,
  * all that needs to be provided is a pointer to a ticks variable defined as
- * clock_t and a time in ms. This function is reentrant and is designed to be 
+ * xktimer_tick_t and a time in ms. This function is reentrant and is designed to be 
  * polled until it returns true. Please see the section \ref timer-simple-ex 
  * for a working example of the xktimer_periodic() function.
  *
@@ -116,6 +171,539 @@
  *
  * Please see \ref timer-dual-ex for a working example of a dual-state timer.
  *
+ *
+ * \section timer-sequence	Sequence Timers
+ * A sequence timer generalizes the dual-state timer to any number of steps.
+ * It is added with xktimer_add_sequence() and a constant array of intervals
+ * in ms, one per step. The timer runs the interval of step 0 first. When a
+ * step times out, the timer moves on to the next step, going back to step 0
+ * after the last one, and calls the callback with the step it moved to. This
+ * is the same as a dual-state timer, which is called with 1 after its first
+ * timeout and with 0 after its second. A blink pattern, a modem power-up
+ * cadence or a protocol retry schedule then needs a single timer instead of
+ * several timers or a state machine in the callback.
+ *
+ * The array is not copied, so it must stay valid while the timer is added,
+ * which also works with XKTIMER_NO_MALLOC. A sequence has at most 255 steps.
+ *
+ * \code
+ * static const uint32_t blink[] = { 100, 100, 100, 700 };
+ *
+ * xktimer_add_sequence(&timer, blink, 4, &led_blink);
+ * xktimer_start(&timer);
+ * \endcode
+ *
+ *
+ * \section timer-overrun	Anchored Timers and Overruns
+ * By default, a periodic, dual-state or sequence timer that times out sets
+ * its next deadline from the time of the pass that handled it. A pass that
+ * runs late therefore pushes all of the following timeouts back, and the
+ * timer drifts.
+ *
+ * xktimer_set_overrun() anchors the timer instead: the next deadline is the
+ * previous deadline plus the timeout, so the timer stays on the grid set when
+ * it was started. A pass that is late by more than a whole period finds
+ * deadlines that were missed, and the overrun policy says what to do with
+ * them:
+ *  - XKTIMER_OVERRUN_CATCH_UP: Every missed deadline is handled, one per
+ *    pass, until the timer has caught up.
+ *  - XKTIMER_OVERRUN_COALESCE: The callback is called once for all of the
+ *    missed deadlines, and the timer goes on from the next deadline after the
+ *    current time.
+ *  - XKTIMER_OVERRUN_SKIP: Same as XKTIMER_OVERRUN_COALESCE, but the callback
+ *    is not called at all for a timeout that missed a deadline.
+ *
+ * xktimer_missed() returns how many deadlines were skipped at the last
+ * timeout, or with XKTIMER_OVERRUN_CATCH_UP how many are still behind, so
+ * the callback can account for the lost periods. Anchored deadlines are not
+ * rounded up to the slack, except for the first one when the timer is
+ * started, so a timeout that is a multiple of the slack stays aligned.
+ *
+ *
+ * \section timer-touch	Touching Timers
+ * Idle and request timeouts are restarted on every bit of activity and
+ * almost never time out. Restarting them with xktimer_start() sets a new
+ * deadline each time, which moves the timer in the wheel or the heap.
+ *
+ * xktimer_touch() restarts a running timer lazily instead: it only stores
+ * the time of the activity. When the old deadline comes up, the timer is
+ * moved to the timeout after the last touch, and it only times out if that
+ * deadline has passed too. A touch is therefore a few stores, and a timer
+ * that is touched all the time is moved once per timeout at most.
+ * xktimer_touch_at() takes the time of the activity, so a batch of packets
+ * can be handled with a single clock read.
+ *
+ * Unlike xktimer_start(), a touch keeps the state of a dual-state or
+ * sequence timer. Until the old deadline comes up, xktimer_next_timeout()
+ * and xktimer_next_deadline() still return it.
+ *
+ *
+ * \section timer-wheel	Timing Wheel Scheduler
+ * By default, xktimer_task() walks the whole list of added timers on every
+ * pass and checks each one against the current time. This is fine for a
+ * handful of timers, but the cost grows with the number of timers even when
+ * most of them are stopped or far from timing out.
+ *
+ * When the module is compiled with XKTIMER_WHEEL defined, running timers are
+ * instead kept in a hierarchical timing wheel. The wheel has
+ * XKTIMER_WHEEL_LEVELS levels of XKTIMER_WHEEL_SIZE buckets each. The first
+ * level holds timers that expire within the next XKTIMER_WHEEL_SIZE ms, one
+ * bucket per ms, and each further level covers XKTIMER_WHEEL_SIZE times the
+ * range of the level below it. Timers further out than the last level are
+ * parked in its farthest bucket and placed again when they get closer.
+ *
+ * Each xktimer_task() pass then only looks at the buckets for the ms that
+ * have elapsed since the last pass, and xktimer_start() / xktimer_stop() just
+ * link or unlink the timer from a bucket. The API is the same in both modes,
+ * but the timer fields must not be modified directly while the timer is
+ * running, since the wheel would not see the change.
+ *
+ *
+ * \section timer-heap	Deadline Heap Scheduler
+ * When the module is compiled with XKTIMER_HEAP defined, running timers are
+ * kept in a 4-ary min-heap ordered by their ticks value instead. Starting,
+ * stopping or changing the timeout of a timer costs O(log n), and each
+ * xktimer_task() pass only looks at the timers that have actually timed out.
+ *
+ * The heap always knows which timer will time out first, so
+ * xktimer_next_deadline() is O(1) in this mode. This makes it the best fit
+ * for a main loop that needs to know how long it can block before the next
+ * timer is due. As with the timing wheel, the timer fields must not be
+ * modified directly while the timer is running.
+ *
+ * xktimer_add_many() and xktimer_start_many() add or start a whole array of
+ * timers with a single clock read. With the heap, the timers are appended
+ * and the heap order is restored once, which builds the heap in O(n) at
+ * startup instead of doing n inserts of O(log n) each.
+ *
+ *
+ * \section timer-intrusive	Intrusive Mode
+ * Normally, the XKTimer module keeps an array of pointers to the added
+ * timers (and an array for the deadline heap with XKTIMER_HEAP). When the
+ * module is compiled with XKTIMER_INTRUSIVE defined, the xktimer_t struct
+ * instead carries all the links the scheduler needs, and xktimer_add()
+ * simply links the timer into a list. Adding and removing timers then never
+ * allocates memory, there is no limit on the number of timers even with
+ * XKTIMER_NO_MALLOC, and the scheduler data sits in the same cache lines as
+ * the rest of the timer.
+ *
+ * With XKTIMER_HEAP, the deadline heap becomes a pairing heap linked through
+ * the timers instead of an array. xktimer_next_deadline() is still O(1), and
+ * starting or stopping a timer is O(log n) amortized.
+ *
+ *
+ * \section timer-soa	SoA Scan
+ * For tens to a few thousand timers, the linear scan is usually fast enough,
+ * but following the pointer to every timer to check its enabled and ticks
+ * fields is what costs the most. When the module is compiled with
+ * XKTIMER_SOA defined, the deadlines and enabled flags of the added timers
+ * are also kept in two packed, aligned arrays indexed by slot. xktimer_task()
+ * then compares XKTIMER_SOA_LANES deadlines at a time with AVX2, SSE2 or NEON
+ * (or a plain loop on other targets) and only reads the timers that have
+ * timed out.
+ *
+ * Only the low 32 bits of the ticks are kept, so the compare is done modulo
+ * 2^32 ms and each hit is checked against the real ticks. To keep the
+ * compare from wrapping, the deadlines are clamped to 2^30 ms (about 12
+ * days) around a base that the pass moves up to its time every 2^30 ms, so a
+ * timer that fell further behind, like a catch-up timer after a long stall,
+ * is still found, and a longer timeout is only scanned once it gets close.
+ * This mode can not be combined with XKTIMER_WHEEL, XKTIMER_HEAP or
+ * XKTIMER_INTRUSIVE.
+ *
+ *
+ * \section timer-loop	Event Loop
+ * Calling xktimer_task() from a while (1) loop keeps the CPU busy all the
+ * time, even when no timer is anywhere close to timing out. When the module
+ * is compiled with XKTIMER_EVENT_LOOP defined on a POSIX platform, the
+ * xktimer_run() function can be used as the main loop instead. It runs
+ * xktimer_task() and then sleeps until the deadline returned by
+ * xktimer_next_deadline(), so the CPU stays idle between timeouts.
+ *
+ * The loop wakes up early whenever a timer is added, started or gets a new
+ * timeout, so the new deadline is taken into account right away. Callbacks
+ * can use the normal XKTimer functions. Other threads must wrap their calls
+ * between xktimer_lock() and xktimer_unlock(), which serializes them with
+ * the loop. The loop only releases that lock while it sleeps.
+ *
+ * Since a sleeping process does not use any CPU time, the default clock
+ * source in this mode is XKTIMER_CLOCK_MONOTONIC instead of clock(). Please
+ * see \ref timer-clock.
+ *
+ * \code
+ * int main()
+ * {
+ *     xktimer_init();
+ *
+ *     xktimer_add(&timer, XKTIMER_PERIODIC, 1000, &timer_periodic);
+ *     xktimer_start(&timer);
+ *
+ *     // Runs the timers until xktimer_quit() is called
+ *     xktimer_run();
+ *
+ *     return 0;
+ * }
+ * \endcode
+ *
+ *
+ * \section timer-fd	File Descriptor
+ * Programs that already have their own epoll(), poll() or select() loop can
+ * compile the module with XKTIMER_FD on Linux instead. xktimer_fd() then
+ * returns a timerfd that becomes readable when the earliest running timer
+ * is due, and xktimer_on_readable() handles the timers once the loop sees it
+ * readable. xktimer_on_readable() also arms the timerfd again for the new
+ * earliest deadline, so nothing needs to be polled in between.
+ *
+ * The timerfd is only armed again when a timer gets a deadline before the
+ * one it is armed for. A timer that is stopped or moved later leaves it
+ * armed, which only costs one early xktimer_on_readable() that finds nothing
+ * due. Like the event loop, commands posted with xktimer_post_start() and
+ * the others are only seen once the timerfd fires.
+ *
+ * \code
+ * struct epoll_event ev = { .events = EPOLLIN };
+ *
+ * ev.data.fd = xktimer_fd();
+ * epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+ *
+ * while (1) {
+ *     int i, n = epoll_wait(epfd, events, 16, -1);
+ *
+ *     for (i = 0; i < n; i++) {
+ *         if (events[i].data.fd == xktimer_fd()) {
+ *             xktimer_on_readable();
+ *         }
+ *     }
+ * }
+ * \endcode
+ *
+ * An io_uring loop does not need the timerfd at all. With
+ * XKTIMER_CLOCK_MONOTONIC, the ticks of xktimer_next_deadline() can be
+ * given to an IORING_OP_TIMEOUT with IORING_TIMEOUT_ABS, and xktimer_task()
+ * called when it completes.
+ *
+ *
+ * \section timer-tickless	Tickless Operation
+ * On a microcontroller, polling xktimer_task() keeps the CPU out of its low
+ * power modes. With XKTIMER_CLOCK_HW, defining XKTIMER_TICKLESS makes the
+ * default context program a compare register of the hardware timer for the
+ * earliest deadline instead, so the main loop can sleep until it is due. The
+ * platform provides two more macros:
+ *  - XKTIMER_HW_COMPARE(ticks): Raise the compare interrupt once the counter
+ *    of XKTIMER_HW_TICKS() reaches the given uint64_t value. A compare
+ *    register narrower than the counter can simply be set to the low bits,
+ *    an early interrupt only costs a pass that finds nothing due.
+ *  - XKTIMER_HW_COMPARE_STOP(): Disable the compare interrupt.
+ *
+ * The interrupt handler calls xktimer_isr(). By default, this runs
+ * xktimer_task() right away, so the callbacks run in the interrupt and the
+ * main loop must mask the interrupt around its own XKTimer calls. With
+ * XKTIMER_TICKLESS_DEFER, xktimer_isr() only flags the timers as due, and
+ * the main loop calls xktimer_task() when xktimer_pending() returns true.
+ * Nothing else runs in the interrupt then.
+ *
+ * The compare register is only written again when a timer gets a deadline
+ * before the one it is set for, and once at the end of each pass. A deadline
+ * that has already passed when it is set makes xktimer_pending() return true,
+ * since the compare would never match.
+ *
+ * \code
+ * void TIM2_IRQHandler()
+ * {
+ *     TIM2->SR = 0;
+ *     xktimer_isr();
+ * }
+ *
+ * while (1) {
+ *     __disable_irq();
+ *     if (!xktimer_pending()) {
+ *         // Still wakes up on a pending interrupt
+ *         __WFI();
+ *     }
+ *     __enable_irq();
+ *
+ *     if (xktimer_pending()) {
+ *         xktimer_task();
+ *     }
+ * }
+ * \endcode
+ *
+ *
+ * \section timer-wait	Precise Waits
+ * xktimer_wait() and xktimer_wait_us() spin on xktimer_clock() for the whole
+ * delay by default, since that is all an embedded target can do. When
+ * XKTIMER_WAIT_HYBRID is defined, which is the default with
+ * XKTIMER_EVENT_LOOP, they sleep with clock_nanosleep() through most of the
+ * delay instead, and only spin for the last slice, with a pause instruction
+ * between the reads of the clock. The delay is then about as accurate as
+ * the clock, without keeping a core busy.
+ *
+ * The slice starts at XKTIMER_WAIT_SPIN_US and is learned from the time the
+ * sleeps actually take to wake up. It grows right away when a sleep comes
+ * back later than the slice, and shrinks slowly towards the measured wake up
+ * latency otherwise, up to XKTIMER_WAIT_SPIN_MAX_US. Waits shorter than the
+ * slice only spin.
+ *
+ * A wait that runs xktimer_wait_task() always spins, so the task keeps
+ * running during the whole delay.
+ *
+ *
+ * \section timer-slack	Timer Slack
+ * Timers that time out a few ms apart each wake up xktimer_run() on their
+ * own. When exact timing is not needed, a timer can be given a slack with
+ * xktimer_set_slack(). Its deadline is then rounded up to the next multiple
+ * of the slack, so all timers with the same slack that are due in the same
+ * window time out together, in one wakeup and one xktimer_task() pass. Timers
+ * whose slacks are multiples of each other, like 5 ms and 50 ms, line up on
+ * the larger window as well. A timer never times out early, and at most
+ * slack - 1 ms late.
+ *
+ * xktimer_set_default_slack() or the XKTIMER_DEFAULT_SLACK macro sets the
+ * slack given to new timers, which makes it a global coalescing window. This
+ * also works with XKTIMER_NO_MALLOC, where waking up less often saves power.
+ *
+ *
+ * \section timer-stats	Timer Statistics
+ * When compiled with XKTIMER_STATS, every context keeps an xktimer_stats_t
+ * with the number of timeouts, how late each timer timed out compared to its
+ * deadline, the number of whole periods that periodic and dual-state timers
+ * missed, and how long each callback ran. xktimer_set_stats() keeps the same
+ * statistics for a single timer in a struct given by the caller, so timers
+ * that are not watched cost no memory.
+ *
+ * The lateness and the callback times are kept in histograms with power of
+ * two buckets, which are fixed in size and take a few instructions to update.
+ * The callbacks are timed with XKTIMER_STATS_COUNTER(), which reads the TSC
+ * on x86 and the virtual counter on ARMv8 by default, so the times are in
+ * counter ticks. It can be defined to any other uint64_t counter, like a
+ * cycle counter on a microcontroller. Callbacks run by a pool and handlers
+ * are counted as timeouts but not timed.
+ *
+ * xktimer_stats_snapshot() copies the statistics of the context, and
+ * xktimer_stats_dump() prints a summary with percentiles. Without
+ * XKTIMER_STATS none of this is compiled in.
+ *
+ *
+ * \section timer-budget	Time-Budgeted Passes
+ * xktimer_task() calls every callback that is due in one pass, however long
+ * they take, so a burst of timeouts can hold up everything else that shares
+ * the main loop. When compiled with XKTIMER_BUDGET, xktimer_task_budget()
+ * bounds the pass by a number of callbacks and a time in us instead.
+ *
+ * The pass first updates every timer that timed out, like
+ * xktimer_collect_expired() does, and appends it to a queue of timers
+ * waiting for their callback. It then calls the callbacks from the front of
+ * the queue until the budget is used up, and returns the number of timers
+ * still waiting. The next call goes on with these before the timers that
+ * time out later, so the same timers are not always the ones delayed.
+ * A timer that times out again while it is waiting gets a single callback.
+ * A timer that is stopped or removed while it is waiting gets none.
+ *
+ * Each timer has a priority class from 0, the default, to
+ * XKTIMER_PRIORITIES - 1, set with xktimer_set_priority(). The waiting
+ * timers of a higher class are always called first, so critical timers are
+ * not held up by a backlog of others. The time budget is checked with
+ * xktimer_clock() after each callback, so it is only as precise as a tick,
+ * and at least one callback is called on each pass.
+ *
+ * \code
+ * xktimer_set_priority(&watchdog, XKTIMER_PRIORITIES - 1);
+ *
+ * while (1) {
+ *     // At most 8 callbacks or 200 us, then poll the I/O
+ *     xktimer_task_budget(8, 200);
+ *     io_poll();
+ * }
+ * \endcode
+ *
+ *
+ * \section timer-trace	Tracing
+ * The statistics only show totals. To see single events on a timeline,
+ * compile with XKTIMER_TRACE. Every add, start, stop and timeout of a timer
+ * is then recorded, along with the start and the end of each callback, in
+ * particular the ones run by the workers of an xktimer_pool_t.
+ *
+ * Each event is a USDT probe of the "xktimer" provider when <sys/sdt.h> is
+ * available: add, start, stop, fire, call and call_end, with the timer and
+ * its state as arguments. A probe is a single nop until perf, bpftrace or
+ * another tracer attaches to it.
+ *
+ * Each event is also written to a ring of XKTIMER_TRACE_SIZE events owned by
+ * the thread that records it, so recording never takes a lock. The oldest
+ * events are overwritten once the ring is full. Up to XKTIMER_TRACE_THREADS
+ * threads get a ring, and the events of other threads are only counted as
+ * lost. xktimer_trace_dump() writes the rings as Chrome trace JSON, which
+ * chrome://tracing and Perfetto can open. The times are CLOCK_MONOTONIC in
+ * us, the same time base as perf and most other tracers, so the file lines
+ * up with theirs.
+ *
+ * \code
+ * FILE * file = fopen("timers.json", "w");
+ *
+ * xktimer_trace_dump(file);
+ * fclose(file);
+ * \endcode
+ *
+ *
+ * \section timer-ctx	Timer Contexts
+ * All of the scheduler state, like the list of added timers, the wheel or
+ * heap and the event loop lock, lives in an xktimer_ctx_t. The functions
+ * documented above all work on a default context that is set up by
+ * xktimer_init(). Libraries and threads that need their own set of timers
+ * can create more contexts with xktimer_ctx_init() and use the xktimer_ctx_*
+ * variants of the functions, which take the context as the first parameter.
+ *
+ * A timer belongs to the context it was added to, so xktimer_start(),
+ * xktimer_stop(), xktimer_set_timeout() and xktimer_remove() do not need the
+ * context. A context is not thread-safe by itself: each one must only be used
+ * by one thread at a time, or through xktimer_ctx_lock() with
+ * XKTIMER_EVENT_LOOP. The clock source is shared by all contexts.
+ *
+ * \code
+ * xktimer_ctx_t ctx;
+ *
+ * void * worker(void * arg)
+ * {
+ *     xktimer_ctx_init(&ctx);
+ *
+ *     xktimer_ctx_add(&ctx, &timer, XKTIMER_PERIODIC, 100, &timer_periodic);
+ *     xktimer_start(&timer);
+ *
+ *     while (1) {
+ *         xktimer_ctx_task(&ctx);
+ *     }
+ * }
+ * \endcode
+ *
+ *
+ * \section timer-queue	Posting From Other Threads
+ * The XKTimer functions must only be called from the thread that runs
+ * xktimer_task() for the context. When the module is compiled with
+ * XKTIMER_CMD_QUEUE defined, other threads, like I/O threads that arm
+ * timeouts, can use xktimer_post_start(), xktimer_post_stop(),
+ * xktimer_post_set_timeout() and xktimer_post_set_timeout_dual() instead.
+ * These put a command into a lock-free queue in the context of the timer,
+ * and the next xktimer_task() pass runs the commands before it checks the
+ * timers. The owner thread does not take any lock, and the producers never
+ * block: when the queue is full, the post functions return false and the
+ * caller can try again later. XKTIMER_CMD_QUEUE_SIZE sets how many commands
+ * fit in the queue.
+ *
+ * The timer must have been added before any command is posted for it, and it
+ * must not be removed while commands for it could still be in the queue.
+ * Posting wakes up the owner if it waits for its next timer: a sleeping
+ * xktimer_run() is signaled, which takes the loop lock for a moment, and the
+ * timerfd of xktimer_fd() is made readable, once per pass. Otherwise the
+ * commands run at the next xktimer_task() the owner calls.
+ *
+ * The queue uses the GCC atomic builtins, so it needs GCC or Clang.
+ *
+ *
+ * \section timer-dispatch	Callback Dispatch
+ * Normally xktimer_task() calls the callback of a timer as soon as it times
+ * out, so one slow callback delays every other timer in the same pass. When
+ * the module is compiled with XKTIMER_DISPATCH defined, a context can hand
+ * its callbacks to an xktimer_pool_t instead. xktimer_task() then only finds
+ * and reschedules the timers that timed out, and the worker threads of the
+ * pool run the callbacks.
+ *
+ * Each worker has its own queue, and workers that run out of work take
+ * timers from the queues of the others. The callbacks of one timer still run
+ * one at a time and in the order the timer timed out, with the state it had
+ * at that time. If a timer times out again while XKTIMER_DISPATCH_BACKLOG
+ * expiries of it are still waiting, the new one is dropped and counted by
+ * xktimer_pool_dropped(). If the queues of all the workers are full, the
+ * callback is run by xktimer_task() as usual.
+ *
+ * The callbacks run on the worker threads, so they must use the functions
+ * from \ref timer-queue or xktimer_lock() to change any timer. Removing a
+ * timer drops the expiries that are still waiting for a worker, and waits for
+ * a callback of it that is running on another thread to return, so the timer
+ * can be freed right after xktimer_remove(). The thread that removes it must
+ * therefore not hold a lock that the callback takes. A callback can remove
+ * its own timer, but must not free it.
+ *
+ * \code
+ * xktimer_pool_t pool;
+ *
+ * xktimer_init();
+ * xktimer_pool_start(&pool, 4);
+ * xktimer_set_pool(&pool);
+ * \endcode
+ *
+ *
+ * \section timer-service	Sharded Timer Service
+ * One context run by one thread only goes so far. When the module is compiled
+ * with XKTIMER_SERVICE defined, along with XKTIMER_EVENT_LOOP and
+ * XKTIMER_DISPATCH, an xktimer_service_t runs one shard per core. Each shard
+ * has its own context, so its own scheduler and cached time, and an event
+ * loop thread that is pinned to its core. XKTIMER_WHEEL is the best fit for
+ * the shards when there are many timers.
+ *
+ * xktimer_service_add() adds a timer to the shard of the calling thread, or
+ * to the shard of the current core for threads outside the service, so the
+ * timers stay close to the code that uses them. The callbacks are run by a
+ * pool with one worker per shard, pinned to the same core. Timers are handed
+ * to the worker of their own shard first, and idle workers steal from the
+ * busy ones.
+ *
+ * A timer of the service belongs to its shard, so calls to xktimer_start(),
+ * xktimer_stop() and the other functions must be wrapped between
+ * xktimer_ctx_lock(timer->ctx) and xktimer_ctx_unlock(timer->ctx).
+ *
+ * \code
+ * xktimer_service_t service;
+ *
+ * xktimer_service_start(&service, 0);
+ *
+ * xktimer_service_add(&service, &timer, XKTIMER_SINGLE_SHOT, 5000, &expired);
+ * xktimer_ctx_lock(timer.ctx);
+ * xktimer_start(&timer);
+ * xktimer_ctx_unlock(timer.ctx);
+ * \endcode
+ *
+ *
+ * \section timer-persist	Persistent Timers
+ * Timers of hours or days, like leases and retention periods, should survive
+ * a restart of the program. When compiled with XKTIMER_PERSIST, an
+ * xktimer_persist_t keeps such timers in a file mapped with mmap(). Each
+ * timer has a fixed size record in the file, which the module rewrites
+ * whenever the timer is started, stopped, touched, times out or gets a new
+ * timeout, so the file is always up to date and nothing has to be saved on
+ * exit. The writes go to the page cache, which survives a crash of the
+ * program. xktimer_persist_flush() also makes them survive a power loss.
+ *
+ * The records do not hold any pointer, so the file can be mapped at any
+ * address. Deadlines are kept as wall clock times in ns since the epoch,
+ * since the monotonic clock starts over on boot. Callbacks are kept as IDs
+ * registered with xktimer_persist_callback(), and each record has a key
+ * chosen by the program, such as the ID of the lease in its database, to
+ * find the timer again with xktimer_persist_find(). The records are in the
+ * byte order of the host.
+ *
+ * xktimer_persist_open() maps the file, and reads nothing but its header.
+ * xktimer_persist_restore() then adds a timer for each record in place,
+ * without any parsing, and the timers that timed out while the program was
+ * down time out on the next pass. The timers live in an array given to
+ * xktimer_persist_open(), one for each record, so the storage is fixed like
+ * the file. Sequence timers can not be persistent, since their timeouts are
+ * a pointer.
+ *
+ * \code
+ * static xktimer_t leases[1024];
+ * xktimer_persist_t store;
+ *
+ * xktimer_persist_open(&store, "/var/lib/app/timers", leases, 1024);
+ * xktimer_persist_callback(&store, LEASE_EXPIRED, &lease_expired);
+ * xktimer_persist_restore(&store);
+ *
+ * // A new lease of one day
+ * timer = xktimer_persist_add(&store, lease_id, XKTIMER_SINGLE_SHOT,
+ *                             86400000, 0, LEASE_EXPIRED);
+ * xktimer_start(timer);
+ * \endcode
+ *
+ *
  * \section timer-ex 	Simple Timer Example
  * \code
  *
@@ -226,6 +814,18 @@
 
 #include <time.h>
 
+#if defined(XKTIMER_EVENT_LOOP) || defined(XKTIMER_DISPATCH)
+#include <pthread.h>
+#endif
+
+#ifdef XKTIMER_TRACE
+#include <stdio.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * \name Timer Types
  */
@@ -255,6 +855,31 @@
  * completed for that timer.
  */
 #define XKTIMER_DUAL_STATE			3
+
+/**
+ * \brief		Sequence Timer
+ *
+ * This timer type walks an array of timeout values, one per step, and
+ * starts over after the last one. The callback is passed the index of the
+ * step that starts after each timeout. Please see \ref timer-sequence.
+ */
+#define XKTIMER_SEQUENCE			4
+//! @}
+
+/**
+ * \name Overrun Policies
+ *
+ * Possible values for xktimer_set_overrun(). Please see \ref timer-overrun.
+ */
+//! @{
+//! The next deadline is set from the time the timer is handled (default)
+#define XKTIMER_OVERRUN_DRIFT		0
+//! Anchored, and every missed deadline is handled, one per pass
+#define XKTIMER_OVERRUN_CATCH_UP	1
+//! Anchored, and the missed deadlines are handled by one timeout
+#define XKTIMER_OVERRUN_COALESCE	2
+//! Anchored, and a timeout that missed deadlines is not handled
+#define XKTIMER_OVERRUN_SKIP		3
 //! @}
 
 /**
@@ -263,174 +888,1306 @@
  * This defines the resolution of the timers in the XKTimer module. Since
  * we use the global CLOCKS_PER_SEC variable to determine the number of
  * ticks in one second, we then use this variable to convert that value
- * into ms so we can provide full milli-second timer resolution.
+ * into ms so we can provide full milli-second timer resolution. It can be
+ * set to 1000000 or 1000000000 for us or ns ticks. Please see
+ * \ref timer-resolution.
  */
+#ifndef XKTIMER_RESOLUTION
 #define XKTIMER_RESOLUTION			1000
+#endif
+
+#if (XKTIMER_RESOLUTION % 1000) != 0 || (1000000000 % XKTIMER_RESOLUTION) != 0
+#error "XKTIMER_RESOLUTION must be a multiple of 1000 that divides 1000000000"
+#endif
+
+#if XKTIMER_RESOLUTION > 1000 && !defined(XKTIMER_TICKS_64)
+//! Keep the ticks in 64 bits, always defined above ms resolution
+#define XKTIMER_TICKS_64
+#endif
+
+//! The number of ticks in one ms
+#define XKTIMER_TICKS_PER_MS		(XKTIMER_RESOLUTION / 1000)
+//! The number of ns in one tick
+#define XKTIMER_NS_PER_TICK			(1000000000 / XKTIMER_RESOLUTION)
+
+#ifdef XKTIMER_TICKS_64
+//! A time in ticks, as returned by xktimer_clock()
+typedef int64_t xktimer_tick_t;
+//! The unsigned type used to subtract xktimer_tick_t values
+typedef uint64_t xktimer_utick_t;
+//! The difference between two xktimer_tick_t values
+typedef int64_t xktimer_diff_t;
+//! A timeout or slack in ticks
+typedef uint64_t xktimer_span_t;
+#else
+//! A time in ticks, as returned by xktimer_clock()
+typedef clock_t xktimer_tick_t;
+//! The unsigned type used to subtract xktimer_tick_t values
+typedef unsigned long xktimer_utick_t;
+//! The difference between two xktimer_tick_t values
+typedef long xktimer_diff_t;
+//! A timeout or slack in ticks
+typedef uint32_t xktimer_span_t;
+#endif
+
+//! The signed number of ticks from b to a, which is correct across a wrap
+#define xktimer_diff(a, b)			\
+	((xktimer_diff_t)((xktimer_utick_t)(a) - (xktimer_utick_t)(b)))
+
+//! Returns true once the time now has reached the deadline
+#define xktimer_reached(now, deadline)	(xktimer_diff(now, deadline) >= 0)
+
+//! The time span ticks after the given time, which wraps around instead of
+//! overflowing
+#define xktimer_ticks_after(ticks, span)	\
+	((xktimer_tick_t)((xktimer_utick_t)(ticks) + (xktimer_utick_t)(span)))
+
+//! Convert a time in ms to ticks
+#define XKTIMER_MS_TICKS(ms)		((xktimer_span_t)(ms) * XKTIMER_TICKS_PER_MS)
+
+#if XKTIMER_RESOLUTION >= 1000000
+//! Convert a time in us to ticks
+#define XKTIMER_US_TICKS(us)		\
+	((xktimer_span_t)(us) * (XKTIMER_RESOLUTION / 1000000))
+#else
+//! Convert a time in us to ticks, rounding up
+#define XKTIMER_US_TICKS(us)		\
+	((xktimer_span_t)(((uint64_t)(us) * XKTIMER_RESOLUTION + 999999) / 1000000))
+#endif
+
+//! Convert a time in ns to ticks, rounding up
+#define XKTIMER_NS_TICKS(ns)		\
+	((xktimer_span_t)(((uint64_t)(ns) + XKTIMER_NS_PER_TICK - 1) / \
+					  XKTIMER_NS_PER_TICK))
 
 //! A convenient define to get the size of the xktimer_t struct
 #define XKTIMER_SIZE				sizeof(xktimer_t)
 //! A convenient define to get the size of the xktimer_ptr_t struct
 #define XKTIMER_PTR_SIZE		sizeof(xktimer_ptr_t)
 
-//! This is the maximum allowed timers
+#ifndef XKTIMER_MAX_TIMERS
+//! This is the maximum allowed timers when compiled with XKTIMER_NO_MALLOC
 #define XKTIMER_MAX_TIMERS			30
+#endif
+
+#if defined(XKTIMER_WHEEL) && defined(XKTIMER_HEAP)
+#error "Only one of XKTIMER_WHEEL and XKTIMER_HEAP can be defined"
+#endif
 
 /**
- * \brief 		The basic XKTimer timer structure.
- *
- * This timer structure allows other modules to create an instance of this
- * structure and pass it to the XKTimer module functions in order to imple-
- * ment simple timer functionality. This struct contains all the information
- * needed for a timer including the timeout and elapsed time, as well as a
- * pointer to a callback function (optional) and other information required
- * for a the complete timer implementation.
+ * \name Clock Sources
  *
- * The XKTimer module keeps an array of pointers to these timer structs that
- * have been added using timer_add() or timer_add_dual() by calling modules
- * in order to keep track of the timeouts and call the callback function.
+ * Possible values for XKTIMER_CLOCK. Please see \ref timer-clock.
  */
-typedef struct {
-	//! The timer type
-	uint8_t type;
+//! @{
+#define XKTIMER_CLOCK_STD			0
+#define XKTIMER_CLOCK_MONOTONIC		1
+#define XKTIMER_CLOCK_MONOTONIC_COARSE	2
+#define XKTIMER_CLOCK_TSC			3
+#define XKTIMER_CLOCK_HW			4
+#define XKTIMER_CLOCK_CUSTOM		5
+//! @}
 
-	//! If TRUE, the timer is running.
-	bool enabled;
+#ifndef XKTIMER_CLOCK
+#ifdef XKTIMER_EVENT_LOOP
+#define XKTIMER_CLOCK				XKTIMER_CLOCK_MONOTONIC
+#else
+#define XKTIMER_CLOCK				XKTIMER_CLOCK_STD
+#endif
+#endif
 
-	//! The timer state. Can be 0 or 1 for dual state timers.
-	uint8_t state;
+#if defined(XKTIMER_EVENT_LOOP) && XKTIMER_CLOCK == XKTIMER_CLOCK_STD
+#error "XKTIMER_EVENT_LOOP needs a clock source that advances while sleeping"
+#endif
 
-	//! The first timeout value, used for all timer types
-	uint32_t timeout;
+#ifdef XKTIMER_FD
+#ifndef __linux__
+#error "XKTIMER_FD needs the timerfd of Linux"
+#endif
 
-	//! The second timeout value, used only for dual-state timers
-	uint32_t timeout2;
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_STD
+#error "XKTIMER_FD needs a clock source that advances while sleeping"
+#endif
+#endif
 
-	//! Holds the elapsed time
-	clock_t ticks;
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_HW && \
+	(!defined(XKTIMER_HW_TICKS) || !defined(XKTIMER_HW_TICKS_PER_SEC))
+#error "XKTIMER_CLOCK_HW needs XKTIMER_HW_TICKS() and XKTIMER_HW_TICKS_PER_SEC"
+#endif
 
-	//! Pointer to the callback function to call on timeout
-	void (*callback)(int);
-} xktimer_t;
+#if defined(XKTIMER_EVENT_LOOP) && !defined(XKTIMER_WAIT_HYBRID)
+#define XKTIMER_WAIT_HYBRID
+#endif
 
-//! Defines a pointer to an xktimer_t struct
-typedef xktimer_t * xktimer_ptr_t;
+#ifdef XKTIMER_WAIT_HYBRID
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_STD
+#error "XKTIMER_WAIT_HYBRID needs a clock source that advances while sleeping"
+#endif
 
-/**
- * \brief			Initialize XKTimer module
- *
- * This initializes the XKTimer module by allocating the necessary resources
- * for adding timers. This must be called before using timer_add(); otherwise
- * the program will experience a segmentation fault.
- */
-extern void xktimer_init();
+#ifndef XKTIMER_WAIT_SPIN_US
+//! The time in us spun at the end of a wait before any wake up is measured
+#define XKTIMER_WAIT_SPIN_US		100
+#endif
 
-/**
- * \brief			Add a new timer to the array
- *
- * Adds a new timer to the array using the specified id, type, timeout,
- * and callback.
- *
- * If the type parameter is anything other than single shot or periodic, it
- * will be set to single shot by default.
- *
- * \param timer		A pointer to the timer struct to add
- * \param type		The timer type to use.
- * \param timeout	The timeout in ms for this timer. This can be changed by
- * 					calling timer_set_timeout() with the ID after the timer has
- * 					been created.
- * \param callback	A pointer to the callback function to call upon timeout.
- * 					This can be NULL if the callback is not desired.
- *
- * \return true		Successfully added timer
- * \return false	Either the timer already existed or it exceeded the maximum
- * 					number of timers.
- */
-extern bool xktimer_add(xktimer_ptr_t timer,
-					    uint8_t type,
-					    uint32_t timeout,
-					    void (*callback)());
+#ifndef XKTIMER_WAIT_SPIN_MAX_US
+//! The longest time in us that the end of a wait spins
+#define XKTIMER_WAIT_SPIN_MAX_US	2000
+#endif
+#endif
 
-/**
- * \brief 			Add a new dual-state timer
- * 
- * Adds a new dual-state timer to the internal timer array and initializes it 
- * with the parameters provided to this function. 
- * 
- * The callback defines a single integer parameter that gives information of 
- * which timeout value was executed. Please see the \ref timer-dual section 
- * for more information on the callback function. The callback is optional and
- * can be substituted by NULL if no callback is desired.
- * 
- * 
- * 
- * \param timer		A pointer to the timer struct to add
- * \param timeout	The first timeout value for this timer
- * \param timeout2 	The second timeout value for this timer
- * \param callback	A pointer to the callback function to call upon timeout.
- * 
- * \return true		Successfully added timer
- * \return false	Either the timer already existed or it exceeded the maximum
- * 					number of timers.
- */
-extern bool xktimer_add_dual(xktimer_ptr_t timer,
-						     uint32_t timeout,
-						     uint32_t timeout2,
-						     void (*callback)(int));
+#ifdef XKTIMER_TICKLESS
+#if XKTIMER_CLOCK != XKTIMER_CLOCK_HW
+#error "XKTIMER_TICKLESS needs XKTIMER_CLOCK_HW"
+#endif
 
-extern clock_t xktimer_clock();
+#if !defined(XKTIMER_HW_COMPARE) || !defined(XKTIMER_HW_COMPARE_STOP)
+#error "XKTIMER_TICKLESS needs XKTIMER_HW_COMPARE() and XKTIMER_HW_COMPARE_STOP()"
+#endif
+#endif
 
-/**
- * \brief			Update the ticks for a given timer
- *
- * Updates the internal ticks variable for the given timer to timeout
- * based on the current value as returned by timer_clock() and the
- * internal timeout variable.
- *
- * For dual state timers, this will also update the ticks based on
- * the internal state variable using timeout2 when the state is equal
- * to 1.
- *
- * \param timer		A pointer to the timer to use to update
- * 					the internal ticks.
- */
-extern void xktimer_update_ticks(xktimer_ptr_t timer);
+#ifndef XKTIMER_TSC_CALIBRATE_MS
+//! The time in ms spent calibrating the TSC clock source in xktimer_init()
+#define XKTIMER_TSC_CALIBRATE_MS	10
+#endif
 
-extern uint32_t xktimer_timeout(xktimer_ptr_t timer);
-extern uint32_t xktimer_timeout2(xktimer_ptr_t timer);
+#ifdef XKTIMER_SOA
+#if defined(XKTIMER_WHEEL) || defined(XKTIMER_HEAP) || defined(XKTIMER_INTRUSIVE)
+#error "XKTIMER_SOA only works with the default linear scan"
+#endif
 
-/**
- * \brief			Get the next timeout for the given timer
- *
- * This function calculates how many ms are left before the given timer
- * will time out.
- *
- * \param timer		A pointer to the timer to calculate the next
- * 					timeout from.
- *
- * \retval clock_t	The next timeout value in ms.
- */
-extern clock_t xktimer_next_timeout(xktimer_ptr_t timer);
+//! The number of deadlines compared at once by the SoA scan
+#define XKTIMER_SOA_LANES			8
 
-/**
- * \brief			Set the timeout for the given timer
- *
+//! The number of SoA entries for the given number of timers
+#define XKTIMER_SOA_SIZE(count)		\
+	(((count) + XKTIMER_SOA_LANES - 1) & ~(XKTIMER_SOA_LANES - 1))
+#endif
+
+#ifndef XKTIMER_DEFAULT_SLACK
+//! The slack in ms given to new timers. Please see \ref timer-slack.
+#define XKTIMER_DEFAULT_SLACK		0
+#endif
+
+#ifdef XKTIMER_DISPATCH
+#ifndef XKTIMER_DISPATCH_MAX_WORKERS
+//! The maximum number of worker threads in an xktimer_pool_t
+#define XKTIMER_DISPATCH_MAX_WORKERS	8
+#endif
+
+#ifndef XKTIMER_DISPATCH_QUEUE_SIZE
+//! The number of timers that can be queued on each worker
+#define XKTIMER_DISPATCH_QUEUE_SIZE	256
+#endif
+
+#ifndef XKTIMER_DISPATCH_BACKLOG
+//! The number of expiries of one timer that can wait for its callback
+#define XKTIMER_DISPATCH_BACKLOG	32
+#endif
+
+#if (XKTIMER_DISPATCH_QUEUE_SIZE & (XKTIMER_DISPATCH_QUEUE_SIZE - 1)) != 0
+#error "XKTIMER_DISPATCH_QUEUE_SIZE must be a power of two"
+#endif
+
+#if XKTIMER_DISPATCH_BACKLOG < 1 || XKTIMER_DISPATCH_BACKLOG > 32
+#error "XKTIMER_DISPATCH_BACKLOG must be between 1 and 32"
+#endif
+#endif
+
+#ifdef XKTIMER_SERVICE
+#if !defined(XKTIMER_EVENT_LOOP) || !defined(XKTIMER_DISPATCH)
+#error "XKTIMER_SERVICE needs XKTIMER_EVENT_LOOP and XKTIMER_DISPATCH"
+#endif
+
+#ifndef XKTIMER_SERVICE_MAX_SHARDS
+//! The maximum number of shards in an xktimer_service_t
+#define XKTIMER_SERVICE_MAX_SHARDS	XKTIMER_DISPATCH_MAX_WORKERS
+#endif
+
+#if XKTIMER_SERVICE_MAX_SHARDS > XKTIMER_DISPATCH_MAX_WORKERS
+#error "XKTIMER_SERVICE_MAX_SHARDS can not be more than XKTIMER_DISPATCH_MAX_WORKERS"
+#endif
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+#ifndef XKTIMER_CMD_QUEUE_SIZE
+//! The number of commands that can be posted to a context between two passes
+#define XKTIMER_CMD_QUEUE_SIZE		64
+#endif
+
+#if (XKTIMER_CMD_QUEUE_SIZE & (XKTIMER_CMD_QUEUE_SIZE - 1)) != 0
+#error "XKTIMER_CMD_QUEUE_SIZE must be a power of two"
+#endif
+#endif
+
+#ifdef XKTIMER_BUDGET
+#ifndef XKTIMER_PRIORITIES
+//! The number of priority classes for xktimer_set_priority()
+#define XKTIMER_PRIORITIES			4
+#endif
+
+#if XKTIMER_PRIORITIES < 1 || XKTIMER_PRIORITIES > 256
+#error "XKTIMER_PRIORITIES must be between 1 and 256"
+#endif
+#endif
+
+#ifdef XKTIMER_STATS
+#ifndef XKTIMER_STATS_BUCKETS
+//! The number of buckets in each histogram of an xktimer_stats_t
+#define XKTIMER_STATS_BUCKETS		32
+#endif
+
+#if XKTIMER_STATS_BUCKETS < 2 || XKTIMER_STATS_BUCKETS > 64
+#error "XKTIMER_STATS_BUCKETS must be between 2 and 64"
+#endif
+#endif
+
+#ifdef XKTIMER_TRACE
+#ifndef XKTIMER_TRACE_SIZE
+//! The number of events kept by each thread, a power of two
+#define XKTIMER_TRACE_SIZE			1024
+#endif
+
+#ifndef XKTIMER_TRACE_THREADS
+//! The number of threads that can record events
+#define XKTIMER_TRACE_THREADS		8
+#endif
+
+#if (XKTIMER_TRACE_SIZE & (XKTIMER_TRACE_SIZE - 1)) != 0
+#error "XKTIMER_TRACE_SIZE must be a power of two"
+#endif
+#endif
+
+#ifdef XKTIMER_PERSIST
+#if !defined(__unix__) && !defined(__APPLE__)
+#error "XKTIMER_PERSIST needs mmap()"
+#endif
+
+#ifndef XKTIMER_PERSIST_CALLBACKS
+//! The number of callback IDs of an xktimer_persist_t, starting from 1
+#define XKTIMER_PERSIST_CALLBACKS	32
+#endif
+#endif
+
+/**
+ * \brief		Returned by xktimer_next_deadline() when no timer is running
+ */
+#define XKTIMER_NO_DEADLINE			((xktimer_tick_t)-1)
+
+#ifdef XKTIMER_WHEEL
+#ifndef XKTIMER_WHEEL_BITS
+//! The number of bits of the deadline indexed by each wheel level
+#define XKTIMER_WHEEL_BITS			6
+#endif
+
+#ifndef XKTIMER_WHEEL_LEVELS
+//! The number of levels in the timing wheel
+#define XKTIMER_WHEEL_LEVELS		4
+#endif
+
+//! The number of buckets in each level of the timing wheel
+#define XKTIMER_WHEEL_SIZE			(1 << XKTIMER_WHEEL_BITS)
+//! Mask used to get the bucket index from a deadline
+#define XKTIMER_WHEEL_MASK			(XKTIMER_WHEEL_SIZE - 1)
+
+#ifndef XKTIMER_WHEEL_GRAIN_BITS
+//! Each bucket of the first wheel level covers 2^XKTIMER_WHEEL_GRAIN_BITS ticks
+#if XKTIMER_RESOLUTION >= 1000000000
+#define XKTIMER_WHEEL_GRAIN_BITS	20
+#elif XKTIMER_RESOLUTION >= 1000000
+#define XKTIMER_WHEEL_GRAIN_BITS	10
+#else
+#define XKTIMER_WHEEL_GRAIN_BITS	0
+#endif
+#endif
+#endif
+
+#ifdef XKTIMER_STATS
+/**
+ * \brief		Timing statistics of a timer or a context
+ *
+ * Please see \ref timer-stats. Bucket 0 of a histogram counts the values of
+ * 0 and bucket i the values from 2^(i-1) to 2^i - 1. The last bucket also
+ * counts all larger values.
+ */
+typedef struct xktimer_stats_s {
+	//! The number of times the timers timed out
+	unsigned long fired;
+
+	//! The number of whole periods the timers were late by
+	unsigned long missed;
+
+	//! The largest lateness in ticks
+	uint32_t late_max;
+
+	//! The number of callbacks that were timed
+	unsigned long runs;
+
+	//! The total time spent in the callbacks, in counter ticks
+	uint64_t run_total;
+
+	//! The longest callback, in counter ticks
+	uint64_t run_max;
+
+	//! How late the timers timed out, in ticks
+	uint32_t late[XKTIMER_STATS_BUCKETS];
+
+	//! How long the callbacks ran, in counter ticks
+	uint32_t run[XKTIMER_STATS_BUCKETS];
+} xktimer_stats_t;
+#endif
+
+#ifdef XKTIMER_PERSIST
+/**
+ * \brief		The record of a persistent timer in the mapped file
+ *
+ * The layout is fixed and holds no pointers. Please see \ref timer-persist.
+ */
+typedef struct xktimer_persist_rec_s {
+	//! The key given to xktimer_persist_add()
+	uint64_t key;
+
+	//! The deadline in ns since the epoch, like CLOCK_REALTIME
+	int64_t deadline;
+
+	//! The timeout of state 0 in ns
+	uint64_t timeout;
+
+	//! The timeout of state 1 in ns
+	uint64_t timeout2;
+
+	//! The ID of the callback, or 0 if the record is free
+	uint16_t callback;
+
+	//! The timer type
+	uint8_t type;
+
+	//! The state of the timer
+	uint8_t state;
+
+	//! If not 0, the timer is running
+	uint8_t enabled;
+
+	//! The overrun policy set with xktimer_set_overrun()
+	uint8_t overrun;
+
+	uint8_t reserved[2];
+} xktimer_persist_rec_t;
+
+/**
+ * \brief		The header at the start of the mapped file
+ */
+typedef struct {
+	//! XKTIMER_PERSIST_MAGIC
+	uint32_t magic;
+
+	//! The size of xktimer_persist_rec_t, to catch a change of layout
+	uint16_t rec_size;
+
+	//! XKTIMER_PERSIST_VERSION
+	uint16_t version;
+
+	//! The number of records after the header
+	uint32_t count;
+
+	uint32_t reserved;
+} xktimer_persist_header_t;
+
+//! The first bytes of a file of xktimer_persist_open(), "XKTP"
+#define XKTIMER_PERSIST_MAGIC		0x50544B58
+
+//! The version of the file layout
+#define XKTIMER_PERSIST_VERSION		1
+#endif
+
+/**
+ * \brief 		The basic XKTimer timer structure.
+ *
+ * This timer structure allows other modules to create an instance of this
+ * structure and pass it to the XKTimer module functions in order to imple-
+ * ment simple timer functionality. This struct contains all the information
+ * needed for a timer including the timeout and elapsed time, as well as a
+ * pointer to a callback function (optional) and other information required
+ * for a the complete timer implementation.
+ *
+ * The XKTimer module keeps an array of pointers to these timer structs that
+ * have been added using timer_add() or timer_add_dual() by calling modules
+ * in order to keep track of the timeouts and call the callback function.
+ */
+typedef struct xktimer_s {
+	//! The timer type
+	uint8_t type;
+
+	//! If TRUE, the timer is running.
+	bool enabled;
+
+	//! If TRUE, the timer was touched since its deadline was set
+	bool touched;
+
+	//! The timer state. Can be 0 or 1 for dual state timers, or the step of
+	//! a sequence timer.
+	uint8_t state;
+
+	//! The number of steps of a sequence timer
+	uint8_t sequence_len;
+
+	//! The overrun policy set with xktimer_set_overrun()
+	uint8_t overrun;
+
+	//! The number of deadlines missed at the last timeout
+	uint32_t missed;
+
+	//! The first timeout value in ticks, used for all timer types
+	xktimer_span_t timeout;
+
+	//! The second timeout value in ticks, used only for dual-state timers
+	xktimer_span_t timeout2;
+
+	//! The timeout values in ms of a sequence timer, one per step
+	const uint32_t * sequence;
+
+	//! The timeouts are rounded up to a multiple of this many ticks, if not 0
+	xktimer_span_t slack;
+
+	//! Holds the elapsed time
+	xktimer_tick_t ticks;
+
+	//! The time of the last xktimer_touch(), used if touched is TRUE
+	xktimer_tick_t touch;
+
+	//! Pointer to the callback function to call on timeout
+	void (*callback)(int);
+
+	//! Called with the timer instead of the callback, if set
+	void (*handler)(struct xktimer_s *);
+
+	//! The data given to xktimer_set_handler()
+	void * data;
+
+#ifdef XKTIMER_STATS
+	//! The statistics given to xktimer_set_stats(), or NULL
+	struct xktimer_stats_s * stats;
+#endif
+
+	//! The context the timer was added to, or NULL if not added
+	struct xktimer_ctx_s * ctx;
+
+#ifdef XKTIMER_INTRUSIVE
+	//! The next timer in the list of added timers
+	struct xktimer_s * list_next;
+
+	//! Points to the link that points to this timer, or NULL if not added
+	struct xktimer_s ** list_pprev;
+#else
+	//! The slot of the timer in the list of added timers, or -1
+	int slot;
+#endif
+
+#ifdef XKTIMER_HEAP
+#ifdef XKTIMER_INTRUSIVE
+	//! The first child of the timer in the deadline heap
+	struct xktimer_s * heap_child;
+
+	//! The next sibling of the timer in the deadline heap
+	struct xktimer_s * heap_next;
+
+	//! The previous sibling or the parent of the timer in the deadline heap
+	struct xktimer_s * heap_prev;
+#else
+	//! The position of the timer in the deadline heap, or -1 if not in it
+	int heap_idx;
+#endif
+
+	//! The xktimer_task() pass in which the timer last timed out
+	unsigned int heap_pass;
+
+	//! The next timer set aside until the end of the pass
+	struct xktimer_s * heap_defer;
+
+	//! True while the timer is set aside until the end of the pass
+	bool heap_deferred;
+#endif
+
+#ifdef XKTIMER_WHEEL
+	//! The next timer in the same wheel bucket
+	struct xktimer_s * next;
+
+	//! Points to the link that points to this timer, or NULL if not linked
+	struct xktimer_s ** pprev;
+#endif
+
+#ifdef XKTIMER_DISPATCH
+	//! The states of the expiries waiting for a worker, a ring buffer
+	uint8_t dispatch_states[XKTIMER_DISPATCH_BACKLOG];
+
+	//! The index of the oldest expiry waiting for a worker
+	uint8_t dispatch_head;
+
+	//! The number of expiries waiting for a worker
+	uint8_t dispatch_len;
+
+	//! TRUE while the timer is queued on or run by a worker
+	bool dispatch_queued;
+
+	//! Set by xktimer_remove() while the callback of the timer is running
+	bool * dispatch_cancel;
+
+	//! The thread running the callback while dispatch_cancel is not NULL
+	pthread_t dispatch_thread;
+#endif
+
+#ifdef XKTIMER_BUDGET
+	//! The priority class set with xktimer_set_priority()
+	uint8_t priority;
+
+	//! The next timer waiting for its callback
+	struct xktimer_s * ready_next;
+
+	//! Points to the link that points to this timer, or NULL if not waiting
+	struct xktimer_s ** ready_pprev;
+#endif
+
+#ifdef XKTIMER_PERSIST
+	//! The record kept up to date for this timer, or NULL if not persistent
+	xktimer_persist_rec_t * persist;
+#endif
+} xktimer_t;
+
+//! Defines a pointer to an xktimer_t struct
+typedef xktimer_t * xktimer_ptr_t;
+
+/**
+ * \brief		A timer to add with xktimer_add_many()
+ */
+typedef struct xktimer_spec_s {
+	//! The timer to add
+	xktimer_ptr_t timer;
+
+	//! The timer type, sequence timers can not be added this way
+	uint8_t type;
+
+	//! If TRUE, the timer is started as well
+	bool start;
+
+	//! The timeout value in ms
+	uint32_t timeout;
+
+	//! The second timeout value in ms, used only for dual-state timers
+	uint32_t timeout2;
+
+	//! Pointer to the callback function to call on timeout, or NULL
+	void (*callback)(int);
+} xktimer_spec_t;
+
+#ifdef XKTIMER_DISPATCH
+/**
+ * \brief		A worker thread of an xktimer_pool_t
+ *
+ * The fields of this struct are private to the XKTimer module.
+ */
+typedef struct xktimer_worker_s {
+	//! Protects queue, head and tail
+	pthread_mutex_t lock;
+
+	//! The timers waiting for this worker to run their callbacks
+	xktimer_ptr_t queue[XKTIMER_DISPATCH_QUEUE_SIZE];
+
+	//! The position of the oldest timer in queue
+	unsigned int head;
+
+	//! The position after the newest timer in queue
+	unsigned int tail;
+
+	//! The pool the worker belongs to
+	struct xktimer_pool_s * pool;
+
+	//! The position of the worker in the pool
+	int index;
+
+	//! The thread running the worker
+	pthread_t thread;
+} xktimer_worker_t;
+
+/**
+ * \brief		A pool of threads that run timer callbacks.
+ *
+ * Please see \ref timer-dispatch. The fields of this struct are private to
+ * the XKTimer module.
+ */
+typedef struct xktimer_pool_s {
+	//! Protects the dispatch fields of the timers and the fields below
+	pthread_mutex_t lock;
+
+	//! Signaled when a timer is queued or the pool is stopped
+	pthread_cond_t cond;
+
+	//! Signaled when a timer is no longer queued on or run by a worker
+	pthread_cond_t done;
+
+	//! The worker threads
+	xktimer_worker_t worker[XKTIMER_DISPATCH_MAX_WORKERS];
+
+	//! The number of worker threads
+	int workers;
+
+	//! The worker that gets the next timer
+	unsigned int next;
+
+	//! The number of timers queued on the workers
+	int pending;
+
+	//! The number of workers waiting for a timer
+	int idle;
+
+	//! Set by xktimer_pool_stop() to make the workers return
+	bool quit;
+
+	//! The number of expiries dropped because the backlog was full
+	unsigned long dropped;
+} xktimer_pool_t;
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+/**
+ * \brief		A command posted with one of the xktimer_post_*() functions
+ *
+ * The fields of this struct are private to the XKTimer module.
+ */
+typedef struct xktimer_cmd_s {
+	//! Tells the producers and the owner whether the slot is free or filled
+	unsigned int seq;
+
+	//! The command to run
+	uint8_t op;
+
+	//! The timer to run the command on
+	xktimer_ptr_t timer;
+
+	//! The timeout values for the set timeout commands
+	uint32_t timeout;
+	uint32_t timeout2;
+} xktimer_cmd_t;
+#endif
+
+/**
+ * \brief		A set of timers with its own scheduler state.
+ *
+ * All of the state of the XKTimer module is kept in a context. The functions
+ * that take a context, like xktimer_ctx_add() and xktimer_ctx_task(), work on
+ * that set of timers only, so several subsystems or threads can each have
+ * their own timers. The functions without a context work on the default
+ * context returned by xktimer_default_ctx(). Please see \ref timer-ctx.
+ *
+ * The fields of this struct are private to the XKTimer module.
+ */
+typedef struct xktimer_ctx_s {
+#ifdef XKTIMER_INTRUSIVE
+	//! The list of added timers, linked through list_next and list_pprev
+	xktimer_ptr_t list;
+
+	//! The next timer to be handled by the current xktimer_task() pass
+	xktimer_ptr_t list_iter;
+#else
+#ifdef XKTIMER_NO_MALLOC
+	//! The array of added timers. Removed timers leave a NULL slot.
+	xktimer_ptr_t ref[XKTIMER_MAX_TIMERS];
+
+	//! The stack of free slots in ref
+	int ref_free[XKTIMER_MAX_TIMERS];
+#else
+	//! The array of added timers. Removed timers leave a NULL slot.
+	xktimer_ptr_t * ref;
+
+	//! The stack of free slots in ref
+	int * ref_free;
+
+	//! The number of slots allocated for ref and ref_free
+	int ref_size;
+#endif
+
+	//! The index of the last used slot + 1
+	int ref_idx;
+
+	//! The number of free slots below ref_idx
+	int ref_free_len;
+
+#ifdef XKTIMER_SOA
+#ifdef XKTIMER_NO_MALLOC
+	//! The low 32 bits of the ticks of the timer in each slot
+	uint32_t soa_deadline[XKTIMER_SOA_SIZE(XKTIMER_MAX_TIMERS)]
+		__attribute__((aligned(32)));
+
+	//! -1 if the timer in the slot is running, 0 otherwise
+	int32_t soa_enabled[XKTIMER_SOA_SIZE(XKTIMER_MAX_TIMERS)]
+		__attribute__((aligned(32)));
+#else
+	//! The low 32 bits of the ticks of the timer in each slot
+	uint32_t * soa_deadline;
+
+	//! -1 if the timer in the slot is running, 0 otherwise
+	int32_t * soa_enabled;
+#endif
+
+	//! The time the SoA deadlines are clamped around
+	xktimer_tick_t soa_base;
+#endif
+#endif
+
+#ifdef XKTIMER_WHEEL
+	//! The timing wheel buckets, linked through next and pprev
+	xktimer_ptr_t wheel[XKTIMER_WHEEL_LEVELS][XKTIMER_WHEEL_SIZE];
+
+	//! The list of timers that are due and waiting to be handled
+	xktimer_ptr_t wheel_due;
+
+	//! Timers in a bucket that was already processed, checked on every pass
+	xktimer_ptr_t wheel_near;
+
+	//! The next wheel bucket (in ticks >> XKTIMER_WHEEL_GRAIN_BITS) that has
+	//! not been processed yet
+	xktimer_tick_t wheel_tick;
+
+	//! The number of timers linked into the wheel or the due list
+	int wheel_count;
+#endif
+
+#ifdef XKTIMER_HEAP
+#ifdef XKTIMER_INTRUSIVE
+	//! The root of the pairing heap of running timers
+	xktimer_ptr_t heap_root;
+#else
+#ifdef XKTIMER_NO_MALLOC
+	//! The 4-ary min-heap of running timers
+	xktimer_ptr_t heap[XKTIMER_MAX_TIMERS];
+#else
+	//! The 4-ary min-heap of running timers
+	xktimer_ptr_t * heap;
+
+	//! The number of entries allocated for heap
+	int heap_size;
+#endif
+
+	//! The number of timers in heap
+	int heap_len;
+#endif
+
+	//! Incremented on each xktimer_task() pass
+	unsigned int heap_pass;
+
+	//! The timers that timed out again in the current pass, kept out of
+	//! the heap until the pass is over
+	xktimer_ptr_t heap_defer;
+#endif
+
+	//! The time sampled at the start of the current xktimer_task() pass
+	xktimer_tick_t pass_now;
+
+	//! TRUE while xktimer_task() is running
+	bool pass_active;
+
+	//! The slack in ticks given to the timers added to this context
+	xktimer_span_t slack;
+
+#ifdef XKTIMER_STATS
+	//! The statistics of all timers of this context
+	xktimer_stats_t stats;
+#endif
+
+#ifdef XKTIMER_BUDGET
+	//! The timers waiting for their callback, one queue for each priority
+	xktimer_ptr_t ready[XKTIMER_PRIORITIES];
+
+	//! The last link of each queue in ready, where the next timer goes
+	xktimer_ptr_t * ready_tail[XKTIMER_PRIORITIES];
+
+	//! The number of timers waiting for their callback
+	size_t ready_len;
+#endif
+
+#ifdef XKTIMER_DISPATCH
+	//! The pool that runs the callbacks, or NULL to run them in xktimer_task()
+	xktimer_pool_t * pool;
+
+	//! The worker that gets the callbacks first, or -1 to spread them out
+	int pool_worker;
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+	//! The ring of commands posted by other threads
+	xktimer_cmd_t cmd[XKTIMER_CMD_QUEUE_SIZE];
+
+	//! The next position to be claimed by a producer
+	unsigned int cmd_head;
+
+	//! The next position to be run by xktimer_task()
+	unsigned int cmd_tail;
+
+#ifdef XKTIMER_FD
+	//! TRUE once a producer has made the timerfd readable for the next pass
+	bool cmd_kick;
+#endif
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+	//! Held by the event loop while it is not sleeping
+	pthread_mutex_t loop_mutex;
+
+	//! Signaled to wake up the event loop early
+	pthread_cond_t loop_cond;
+
+	//! TRUE while the event loop is sleeping
+	bool loop_sleeping;
+
+	//! Set by xktimer_quit() to make the event loop return
+	bool loop_quit;
+#endif
+
+#ifdef XKTIMER_FD
+	//! The timerfd returned by xktimer_fd(), or -1 if not created yet
+	int fd;
+
+	//! The deadline the timerfd is armed for, or XKTIMER_NO_DEADLINE
+	xktimer_tick_t fd_deadline;
+#endif
+
+#ifdef XKTIMER_PERSIST
+	//! The wall clock time in ns at persist_tick, or 0 if not read yet
+	int64_t persist_wall;
+
+	//! The clock value persist_wall was read at
+	xktimer_tick_t persist_tick;
+#endif
+} xktimer_ctx_t;
+
+#ifdef XKTIMER_SERVICE
+/**
+ * \brief		A set of timer contexts, each run by its own thread and core.
+ *
+ * Please see \ref timer-service. The fields of this struct are private to the
+ * XKTimer module.
+ */
+typedef struct xktimer_service_s {
+	//! The context of each shard
+	xktimer_ctx_t shard[XKTIMER_SERVICE_MAX_SHARDS];
+
+	//! The thread running the event loop of each shard
+	pthread_t thread[XKTIMER_SERVICE_MAX_SHARDS];
+
+	//! The number of shards
+	int shards;
+
+	//! The shard that gets the next timer added from outside the service
+	unsigned int next;
+
+	//! Runs the callbacks, with one worker per shard
+	xktimer_pool_t pool;
+} xktimer_service_t;
+#endif
+
+#ifdef XKTIMER_PERSIST
+/**
+ * \brief		A file of persistent timers
+ *
+ * Please see \ref timer-persist.
+ */
+typedef struct {
+	//! The context the timers are added to
+	xktimer_ctx_t * ctx;
+
+	//! The file descriptor of the mapped file
+	int fd;
+
+	//! The mapped file, starting with its header
+	xktimer_persist_header_t * header;
+
+	//! The records, right after the header
+	xktimer_persist_rec_t * recs;
+
+	//! The timers, one for each record
+	xktimer_t * timers;
+
+	//! The number of records and timers
+	uint32_t count;
+
+	//! The callbacks registered with xktimer_persist_callback(), by ID
+	void (*callbacks[XKTIMER_PERSIST_CALLBACKS])(int);
+} xktimer_persist_t;
+#endif
+
+/**
+ * \brief			Initialize XKTimer module
+ *
+ * This initializes the XKTimer module by allocating the necessary resources
+ * for adding timers. This must be called before using timer_add(); otherwise
+ * the program will experience a segmentation fault.
+ *
+ * Calling it again starts over with no timers: what the previous call set up
+ * is released first, like xktimer_ctx_destroy() does, so the timerfd of
+ * xktimer_fd() is closed. No other thread may use the module meanwhile, and
+ * xktimer_run() must not be running.
+ */
+extern void xktimer_init();
+
+/**
+ * \brief			Add a new timer to the array
+ *
+ * Adds a new timer to the array using the specified id, type, timeout,
+ * and callback.
+ *
+ * If the type parameter is anything other than single shot or periodic, it
+ * will be set to single shot by default.
+ *
+ * The timer struct does not need to be initialized, all of its fields are
+ * set here. A timer that is in another context must be removed from it
+ * first, only adding it twice to the same context is caught.
+ *
+ * \param timer		A pointer to the timer struct to add
+ * \param type		The timer type to use.
+ * \param timeout	The timeout in ms for this timer. This can be changed by
+ * 					calling timer_set_timeout() with the ID after the timer has
+ * 					been created.
+ * \param callback	A pointer to the callback function to call upon timeout.
+ * 					This can be NULL if the callback is not desired.
+ *
+ * \return true		Successfully added timer
+ * \return false	Either the timer already existed or there was no room for
+ * 					it (more than XKTIMER_MAX_TIMERS with XKTIMER_NO_MALLOC, or
+ * 					out of memory).
+ */
+extern bool xktimer_add(xktimer_ptr_t timer,
+					    uint8_t type,
+					    uint32_t timeout,
+					    void (*callback)());
+
+/**
+ * \brief 			Add a new dual-state timer
+ * 
+ * Adds a new dual-state timer to the internal timer array and initializes it 
+ * with the parameters provided to this function. 
+ * 
+ * The callback defines a single integer parameter that gives information of 
+ * which timeout value was executed. Please see the \ref timer-dual section 
+ * for more information on the callback function. The callback is optional and
+ * can be substituted by NULL if no callback is desired.
+ * 
+ * 
+ * 
+ * \param timer		A pointer to the timer struct to add
+ * \param timeout	The first timeout value for this timer
+ * \param timeout2 	The second timeout value for this timer
+ * \param callback	A pointer to the callback function to call upon timeout.
+ * 
+ * \return true		Successfully added timer
+ * \return false	Either the timer already existed or there was no room for
+ * 					it (more than XKTIMER_MAX_TIMERS with XKTIMER_NO_MALLOC, or
+ * 					out of memory).
+ */
+extern bool xktimer_add_dual(xktimer_ptr_t timer,
+						     uint32_t timeout,
+						     uint32_t timeout2,
+						     void (*callback)(int));
+
+/**
+ * \brief 			Add a new sequence timer
+ * 
+ * Adds a new sequence timer to the internal timer array. The timer runs the
+ * timeouts of the array one after the other and calls the callback with the
+ * index of the next one after each timeout. Please see \ref timer-sequence.
+ * 
+ * \param timer		A pointer to the timer struct to add
+ * \param sequence	The timeout values in ms. The array is not copied and
+ * 					must stay valid while the timer is added.
+ * \param count		The number of timeout values, from 1 to 255
+ * \param callback	A pointer to the callback function to call upon timeout.
+ * 
+ * \return true		Successfully added timer
+ * \return false	The timer already existed, the sequence is empty, or there
+ * 					was no room for it (more than XKTIMER_MAX_TIMERS with
+ * 					XKTIMER_NO_MALLOC, or out of memory).
+ */
+extern bool xktimer_add_sequence(xktimer_ptr_t timer,
+								 const uint32_t * sequence,
+								 uint8_t count,
+								 void (*callback)(int));
+
+/**
+ * \brief			Add an array of timers
+ *
+ * Same as calling xktimer_add() or xktimer_add_dual() for each timer, and
+ * xktimer_start() for those with start set, but the internal timer array
+ * is grown once and the clock is read once. The timers that are started
+ * are scheduled together, please see \ref timer-heap.
+ *
+ * \param specs		The timers to add, with their types and timeouts
+ * \param count		The number of timers in specs
+ *
+ * \return			The number of timers that were added. The timers that
+ * 					already existed or had no room are skipped.
+ */
+extern size_t xktimer_add_many(const xktimer_spec_t * specs, size_t count);
+
+/**
+ * \brief			Remove a timer from the array
+ *
+ * Stops the timer and removes it from the internal timer array, so it is no
+ * longer handled by xktimer_task(). Its slot is reused by the next timer
+ * that is added. This is O(1), and the timer struct can be freed or added
+ * again afterwards.
+ *
+ * \param timer		A pointer to the timer struct to remove
+ *
+ * \return true		Successfully removed timer
+ * \return false	The timer was not added
+ */
+extern bool xktimer_remove(xktimer_ptr_t timer);
+
+/**
+ * \brief			Set a handler that is called with the timer itself
+ *
+ * The handler is called instead of the callback when the timer times out, so
+ * it can find its own state from timer->data. Handlers are always called by
+ * the pass that found the timer, even if the context has a callback pool, and
+ * they may remove the timer or free it after removing it.
+ *
+ * xktimer_add() and xktimer_add_dual() clear the handler, so this must be
+ * called after the timer is added.
+ *
+ * \param timer		A pointer to the timer struct
+ * \param handler	The handler to call on timeout, or NULL to use the
+ * 					callback again
+ * \param data		Stored in timer->data for the handler
+ */
+extern void xktimer_set_handler(xktimer_ptr_t timer,
+								void (*handler)(xktimer_ptr_t),
+								void * data);
+
+/**
+ * \brief			Preallocate room for the given number of timers
+ *
+ * The internal timer array grows geometrically as timers are added, so this
+ * is never required. It can be used to allocate all the memory up front
+ * when the number of timers is known in advance.
+ *
+ * \param count		The total number of timers to make room for
+ *
+ * \return true		There is room for count timers
+ * \return false	The memory could not be allocated, or count is larger
+ * 					than XKTIMER_MAX_TIMERS with XKTIMER_NO_MALLOC.
+ */
+extern bool xktimer_reserve(int count);
+
+/**
+ * \brief			Get the current time in ticks
+ *
+ * Reads the clock source selected with XKTIMER_CLOCK and converts it to
+ * ticks of XKTIMER_RESOLUTION per second, which are ms by default. Please see
+ * \ref timer-clock and \ref timer-resolution.
+ *
+ * \return			The current time in ticks.
+ */
+extern xktimer_tick_t xktimer_clock();
+
+/**
+ * \brief			Get the time of the current xktimer_task() pass
+ *
+ * xktimer_task() reads the clock only once per pass and uses that time for
+ * every timer it handles, including the new ticks of timers that are
+ * restarted. This function returns that time while xktimer_task() is
+ * running, so callbacks see the same timestamp as the pass that called
+ * them. Outside of xktimer_task(), it simply returns xktimer_clock().
+ *
+ * xktimer_update_ticks() and the functions that use it, such as
+ * xktimer_start(), also use this time.
+ *
+ * \return			The time of the current pass in ticks.
+ */
+extern xktimer_tick_t xktimer_now();
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_CUSTOM
+/**
+ * \brief			Set the clock source used by xktimer_clock()
+ *
+ * Only available when XKTIMER_CLOCK is XKTIMER_CLOCK_CUSTOM. Until this is
+ * called, xktimer_clock() uses clock().
+ *
+ * \param source	A function that returns the current time in ticks of
+ * 					XKTIMER_RESOLUTION. It must never go backwards.
+ */
+extern void xktimer_set_clock(xktimer_tick_t (*source)());
+#endif
+
+/**
+ * \brief			Update the ticks for a given timer
+ *
+ * Updates the internal ticks variable for the given timer to timeout
+ * based on the current value as returned by xktimer_now() and the
+ * internal timeout variable.
+ *
+ * For dual state timers, this will also update the ticks based on
+ * the internal state variable using timeout2 when the state is equal
+ * to 1.
+ *
+ * \param timer		A pointer to the timer to use to update
+ * 					the internal ticks.
+ */
+extern void xktimer_update_ticks(xktimer_ptr_t timer);
+
+/**
+ * \brief			Get the first timeout of a timer, in ms
+ *
+ * The timeout is rounded down when it is not a whole number of ms.
+ */
+extern uint32_t xktimer_timeout(xktimer_ptr_t timer);
+
+//! Get the second timeout of a dual-state timer, in ms
+extern uint32_t xktimer_timeout2(xktimer_ptr_t timer);
+
+/**
+ * \brief			Get the next timeout for the given timer
+ *
+ * This function calculates how many ticks are left before the given timer
+ * will time out.
+ *
+ * \param timer		A pointer to the timer to calculate the next
+ * 					timeout from.
+ *
+ * \return			The next timeout value in ticks, or 0 if the timer has
+ * 					already timed out.
+ */
+extern xktimer_tick_t xktimer_next_timeout(xktimer_ptr_t timer);
+
+/**
+ * \brief			Get the earliest deadline of all running timers
+ *
+ * This function returns the ticks value, in the same units as returned by
+ * xktimer_clock(), at which the first of the running timers added with
+ * xktimer_add() or xktimer_add_dual() will time out. A main loop can use this
+ * to find out how long it can block before it needs to run xktimer_task().
+ *
+ * This is O(1) when compiled with XKTIMER_HEAP. Otherwise the list of timers
+ * (or the buckets of the timing wheel) has to be searched.
+ *
+ * \return			The earliest deadline in ticks, or XKTIMER_NO_DEADLINE
+ * 					if no timer is running.
+ */
+extern xktimer_tick_t xktimer_next_deadline();
+
+/**
+ * \brief			Set the timeout for the given timer
+ *
  * \param timer		A pointer to the timer to modify
- * \param timeout	The timeout value to set.
+ * \param timeout	The timeout value to set, in ms.
  */
 extern void xktimer_set_timeout(xktimer_ptr_t timer,
 							  uint32_t timeout);
 
+/**
+ * \brief			Set the timeout for the given timer in us
+ *
+ * Same as xktimer_set_timeout(), but the timeout is rounded up to the next
+ * tick instead of being a whole number of ms. Please see
+ * \ref timer-resolution.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param us		The timeout value to set, in us
+ */
+extern void xktimer_set_timeout_us(xktimer_ptr_t timer, uint64_t us);
+
+/**
+ * \brief			Set the timeout for the given timer in ns
+ *
+ * Same as xktimer_set_timeout_us(), with the timeout in ns.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param ns		The timeout value to set, in ns
+ */
+extern void xktimer_set_timeout_ns(xktimer_ptr_t timer, uint64_t ns);
+
 /**
  * \brief			Set the timeout for a dual-state timer
  *
  * \param timer		A pointer to the timer to modify
- * \param timeout	The first timeout value
- * \param timeout2	The second timeout value
+ * \param timeout	The first timeout value, in ms
+ * \param timeout2	The second timeout value, in ms
  */
 extern void xktimer_set_timeout_dual(xktimer_ptr_t timer,
 								   uint32_t timeout,
 								   uint32_t timeout2);
 
+//! Same as xktimer_set_timeout_dual(), with the timeouts in us
+extern void xktimer_set_timeout_dual_us(xktimer_ptr_t timer,
+										uint64_t us,
+										uint64_t us2);
+
+//! Same as xktimer_set_timeout_dual(), with the timeouts in ns
+extern void xktimer_set_timeout_dual_ns(xktimer_ptr_t timer,
+										uint64_t ns,
+										uint64_t ns2);
+
+/**
+ * \brief			Set the timeouts of a sequence timer
+ *
+ * The timer goes back to step 0. The timeouts of a sequence timer are only
+ * changed by this function, not by xktimer_set_timeout().
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param sequence	The timeout values in ms, which must stay valid
+ * \param count		The number of timeout values, from 1 to 255
+ */
+extern void xktimer_set_sequence(xktimer_ptr_t timer,
+								 const uint32_t * sequence,
+								 uint8_t count);
+
+/**
+ * \brief			Set the slack of a timer
+ *
+ * The deadline of the timer is rounded up to a multiple of the slack, so
+ * timers that time out within the same window do so together. Please see
+ * \ref timer-slack. The new slack is used from the next time the timer is
+ * started or times out.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param slack		The slack in ms, or 0 to time out at the exact deadline
+ */
+extern void xktimer_set_slack(xktimer_ptr_t timer, uint32_t slack);
+
+/**
+ * \brief			Anchor a timer and set what happens to missed deadlines
+ *
+ * Please see \ref timer-overrun. Only periodic and dual-state timers are
+ * anchored, and not while their timeouts are 0. xktimer_add() and
+ * xktimer_add_dual() reset the policy to XKTIMER_OVERRUN_DRIFT, so this must
+ * be called after the timer is added.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param policy	One of the XKTIMER_OVERRUN_* values
+ */
+extern void xktimer_set_overrun(xktimer_ptr_t timer, uint8_t policy);
+
+/**
+ * \brief			Get the number of deadlines missed at the last timeout
+ *
+ * This is meant to be called from the callback or the handler. With
+ * XKTIMER_OVERRUN_COALESCE and XKTIMER_OVERRUN_SKIP, it is the number of
+ * deadlines that were skipped, and with XKTIMER_OVERRUN_CATCH_UP the number
+ * that are still behind the current time. It is always 0 for timers that are
+ * not anchored.
+ *
+ * \param timer		A pointer to the timer
+ *
+ * \return			The number of missed deadlines
+ */
+extern uint32_t xktimer_missed(xktimer_ptr_t timer);
+
+/**
+ * \brief			Set the slack given to new timers
+ *
+ * This changes the slack of the timers added after this call. The default is
+ * XKTIMER_DEFAULT_SLACK.
+ *
+ * \param slack		The slack in ms, or 0 to time out at the exact deadline
+ */
+extern void xktimer_set_default_slack(uint32_t slack);
+
 /**
  * \brief			Starts the specified timer
  *
@@ -449,6 +2206,40 @@ extern void xktimer_start(xktimer_ptr_t timer);
  */
 extern void xktimer_stop(xktimer_ptr_t timer);
 
+/**
+ * \brief			Start an array of timers
+ *
+ * Same as calling xktimer_start() for each timer, but the clock is read
+ * once for each run of timers of the same context, and the timers are
+ * scheduled together. Please see \ref timer-heap.
+ *
+ * \param timers	The timers to start
+ * \param count		The number of timers in the array
+ */
+extern void xktimer_start_many(xktimer_ptr_t * timers, size_t count);
+
+/**
+ * \brief			Restart a timer lazily
+ *
+ * Only stores the current time in the timer. The timer is moved to its new
+ * deadline when the old one comes up. A timer that is not running is
+ * started, like with xktimer_start(). Please see \ref timer-touch.
+ *
+ * \param timer		A pointer to the timer to touch
+ */
+extern void xktimer_touch(xktimer_ptr_t timer);
+
+/**
+ * \brief			Restart a timer lazily from the given time
+ *
+ * Same as xktimer_touch(), but with the time of the activity, for example
+ * one read of xktimer_now() for a whole batch of events.
+ *
+ * \param timer		A pointer to the timer to touch
+ * \param now		The time of the activity, from xktimer_now()
+ */
+extern void xktimer_touch_at(xktimer_ptr_t timer, xktimer_tick_t now);
+
 /**
  * \brief			Returns the timer running state.
  *
@@ -479,10 +2270,22 @@ extern bool xktimer_running(xktimer_ptr_t timer);
  * Replace task_function with the name of the function you want to execute, and
  * the XKTimer module will run it while waiting for a timeout.
  *
+ * With XKTIMER_WAIT_HYBRID, the function sleeps through most of the delay.
+ * Please see \ref timer-wait.
+ *
  * \param ms		A time in milli-seconds to block
  */
 extern void xktimer_wait(uint32_t ms);
 
+/**
+ * \brief 			Delay for the specified us
+ *
+ * Same as xktimer_wait(), rounded up to the next tick of xktimer_clock().
+ *
+ * \param us		A time in micro-seconds to block
+ */
+extern void xktimer_wait_us(uint64_t us);
+
 /**
  * \brief			A simple reentrant periodic timer function
  *
@@ -502,7 +2305,7 @@ extern void xktimer_wait(uint32_t ms);
  * \retval true		The timer has timed out
  * \retval false	The timer has not timed out yet
  */
-extern bool xktimer_periodic(clock_t * ticks, uint32_t period);
+extern bool xktimer_periodic(xktimer_tick_t * ticks, uint32_t period);
 
 
 /**
@@ -518,11 +2321,17 @@ extern bool xktimer_periodic(clock_t * ticks, uint32_t period);
  * and using xktimer_task() to monitor them, the xktimer_t struct can be 
  * initialized manually and this function can be used to monitor that timer. Or,
  * if we want to disable all other timers temporarily but one or two, we can use
- * this to keep the desired timers running.
+ * this to keep the desired timers running. A timer that is initialized
+ * manually must have all of its other fields set to 0, for example with a
+ * static initializer or memset().
  *
  * \param timer		A pointer to the timer to handle
+ *
+ * \return true		The timer timed out
+ * \return false	The timer did not time out, it was moved to the deadline
+ * 					of a touch, or the timeout was skipped
  */
-extern void xktimer_handle(xktimer_ptr_t timer);
+extern bool xktimer_handle(xktimer_ptr_t timer);
 
 /**
  * \brief			Handles the list of added timers
@@ -531,7 +2340,641 @@ extern void xktimer_handle(xktimer_ptr_t timer);
  * xktimer_add(). The xktimer_handle() function is used to check each timer 
  * one at a time in a simple loop through the list of pointers to all active 
  * timer structs.
+ *
+ * The clock is read once at the start of the pass. Please see xktimer_now().
+ *
+ * When compiled with XKTIMER_WHEEL, only the wheel buckets for the ms that
+ * elapsed since the last call are checked. Please see \ref timer-wheel.
+ * When compiled with XKTIMER_HEAP, only the timers that have timed out are
+ * taken from the deadline heap. Please see \ref timer-heap.
  */
 extern void xktimer_task();
 
+/**
+ * \brief			Collect the timers that have timed out into an array
+ *
+ * This is a pass like xktimer_task(), but instead of calling the callbacks,
+ * it writes the timers that timed out into the given array. The state and
+ * ticks of each timer are updated just like xktimer_handle() does, so
+ * timer->state holds the value the callback would have been called with.
+ * This lets the caller handle the timeouts in groups, for example by closing
+ * many idle connections with one call, or by sorting them by type.
+ *
+ * If more than cap timers have timed out, the rest stay timed out and are
+ * returned by the next call. The callbacks and the handlers set with
+ * xktimer_set_handler() are never called, even when a pool is set with
+ * xktimer_set_pool(). Timeouts skipped by XKTIMER_OVERRUN_SKIP are not
+ * written to the array.
+ *
+ * \param out		The array to write the timers to
+ * \param cap		The number of timers that fit in the array
+ * \param now		The time in ticks, usually from xktimer_clock()
+ *
+ * \return			The number of timers written to the array
+ */
+extern size_t xktimer_collect_expired(xktimer_ptr_t * out, 
+									  size_t cap, 
+									  xktimer_tick_t now);
+
+#ifdef XKTIMER_BUDGET
+/**
+ * \brief			Handle the timers with a bound on the callbacks called
+ *
+ * Same as xktimer_task(), but stops calling callbacks once the budget is
+ * used up. The timers that timed out and were not called yet are called
+ * first by the next pass. Please see \ref timer-budget.
+ *
+ * \param max_callbacks	The most callbacks to call, or 0 for no limit
+ * \param max_us	The time in us after which no more callbacks are
+ * 					called, or 0 for no limit
+ *
+ * \return			The number of timers still waiting for their callback
+ */
+extern size_t xktimer_task_budget(unsigned int max_callbacks, uint32_t max_us);
+
+/**
+ * \brief			Set the priority class of a timer
+ *
+ * The timers of a higher class that are waiting for their callback are
+ * called first by xktimer_task_budget().
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param priority	The class, from 0 to XKTIMER_PRIORITIES - 1
+ */
+extern void xktimer_set_priority(xktimer_ptr_t timer, uint8_t priority);
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+/**
+ * \brief			Run the timers until xktimer_quit() is called
+ *
+ * This runs xktimer_task() and sleeps until the next timer deadline in a
+ * loop. Please see \ref timer-loop.
+ */
+extern void xktimer_run();
+
+/**
+ * \brief			Run the timers until the given deadline
+ *
+ * Same as xktimer_run(), but returns once xktimer_clock() reaches the
+ * deadline.
+ *
+ * \param deadline	The time in ticks, as returned by xktimer_clock(), at
+ * 					which to return. XKTIMER_NO_DEADLINE runs until
+ * 					xktimer_quit() is called.
+ */
+extern void xktimer_run_until(xktimer_tick_t deadline);
+
+/**
+ * \brief			Make xktimer_run() or xktimer_run_until() return
+ *
+ * This can be called from a timer callback or from another thread. If no loop
+ * is running, the next call to xktimer_run() or xktimer_run_until() returns
+ * right away.
+ */
+extern void xktimer_quit();
+
+/**
+ * \brief			Lock the timers against the event loop
+ *
+ * Threads other than the one running xktimer_run() must hold this lock while
+ * calling any other XKTimer function. The lock is recursive.
+ */
+extern void xktimer_lock();
+
+//! Release the lock taken by xktimer_lock()
+extern void xktimer_unlock();
+#endif
+
+#ifdef XKTIMER_TICKLESS
+/**
+ * \brief			Handle the compare interrupt of the hardware timer
+ *
+ * Must be called from the interrupt handler. Runs xktimer_task(), or only
+ * flags the timers as due with XKTIMER_TICKLESS_DEFER. Please see
+ * \ref timer-tickless.
+ */
+extern void xktimer_isr();
+
+/**
+ * \brief			Check whether xktimer_task() has timers to handle
+ *
+ * \return true		A timer is due, so the main loop must not sleep
+ * \return false	The compare interrupt will wake the main loop up
+ */
+extern bool xktimer_pending();
+#endif
+
+#ifdef XKTIMER_FD
+/**
+ * \brief			Get a file descriptor that is readable when a timer is due
+ *
+ * The timerfd is created by the first call and armed for the earliest
+ * deadline. It is closed by xktimer_ctx_destroy(). Please see
+ * \ref timer-fd.
+ *
+ * \return			The file descriptor, or -1 if it could not be created
+ */
+extern int xktimer_fd();
+
+/**
+ * \brief			Handle the timers once the file descriptor of xktimer_fd()
+ * 					is readable
+ *
+ * This reads the timerfd, runs xktimer_task() and arms the timerfd again for
+ * the next deadline.
+ */
+extern void xktimer_on_readable();
+#endif
+
+#ifdef XKTIMER_CMD_QUEUE
+/**
+ * \brief			Start a timer from any thread
+ *
+ * Same as xktimer_start(), but the timer is started by the next
+ * xktimer_task() pass of the context the timer was added to. This never
+ * blocks and can be called from any thread. Please see \ref timer-queue.
+ *
+ * \param timer		A pointer to the timer to start
+ *
+ * \return true		The command was posted
+ * \return false	The timer was not added or the queue is full
+ */
+extern bool xktimer_post_start(xktimer_ptr_t timer);
+
+/**
+ * \brief			Stop a timer from any thread
+ *
+ * Same as xktimer_stop(), but run by the next xktimer_task() pass.
+ *
+ * \param timer		A pointer to the timer to stop
+ *
+ * \return true		The command was posted
+ * \return false	The timer was not added or the queue is full
+ */
+extern bool xktimer_post_stop(xktimer_ptr_t timer);
+
+/**
+ * \brief			Set the timeout of a timer from any thread
+ *
+ * Same as xktimer_set_timeout(), but run by the next xktimer_task() pass.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param timeout	The timeout value to set.
+ *
+ * \return true		The command was posted
+ * \return false	The timer was not added or the queue is full
+ */
+extern bool xktimer_post_set_timeout(xktimer_ptr_t timer, uint32_t timeout);
+
+/**
+ * \brief			Set the timeouts of a dual-state timer from any thread
+ *
+ * Same as xktimer_set_timeout_dual(), but run by the next xktimer_task()
+ * pass.
+ *
+ * \param timer		A pointer to the timer to modify
+ * \param timeout	The first timeout value
+ * \param timeout2	The second timeout value
+ *
+ * \return true		The command was posted
+ * \return false	The timer was not added or the queue is full
+ */
+extern bool xktimer_post_set_timeout_dual(xktimer_ptr_t timer,
+										  uint32_t timeout,
+										  uint32_t timeout2);
+#endif
+
+#ifdef XKTIMER_DISPATCH
+/**
+ * \brief			Start the worker threads of a pool
+ *
+ * \param pool		A pointer to the pool to start
+ * \param workers	The number of worker threads, from 1 to
+ * 					XKTIMER_DISPATCH_MAX_WORKERS
+ *
+ * \return true		The workers were started
+ * \return false	A thread could not be created
+ */
+extern bool xktimer_pool_start(xktimer_pool_t * pool, int workers);
+
+/**
+ * \brief			Stop the worker threads of a pool
+ *
+ * This waits for the callbacks that were already queued to run and then
+ * joins the worker threads. The pool must not be used by any context
+ * afterwards.
+ *
+ * \param pool		A pointer to the pool to stop
+ */
+extern void xktimer_pool_stop(xktimer_pool_t * pool);
+
+/**
+ * \brief			Get the number of expiries dropped by a pool
+ *
+ * An expiry is dropped when a timer times out while XKTIMER_DISPATCH_BACKLOG
+ * earlier expiries of it are still waiting for their callbacks.
+ *
+ * \param pool		A pointer to the pool
+ *
+ * \return			The number of dropped expiries
+ */
+extern unsigned long xktimer_pool_dropped(xktimer_pool_t * pool);
+
+/**
+ * \brief			Run the callbacks of the default context in a pool
+ *
+ * \param pool		A pointer to a started pool, or NULL to run the callbacks
+ * 					in xktimer_task() again
+ */
+extern void xktimer_set_pool(xktimer_pool_t * pool);
+#endif
+
+#ifdef XKTIMER_SERVICE
+/**
+ * \brief			Start a sharded timer service
+ *
+ * This starts one shard per core, each with its own context, event loop
+ * thread and callback worker pinned to that core.
+ *
+ * \param service	A pointer to the service to start
+ * \param shards		The number of shards, or 0 for one per online core. This
+ * 					is limited to XKTIMER_SERVICE_MAX_SHARDS.
+ *
+ * \return true		The service was started
+ * \return false	A thread could not be created
+ */
+extern bool xktimer_service_start(xktimer_service_t * service, int shards);
+
+/**
+ * \brief			Stop a sharded timer service
+ *
+ * This stops the event loops, waits for the callbacks that are still queued
+ * and frees the shards. The timers that were added to the service must not be
+ * used afterwards.
+ *
+ * \param service	A pointer to the service to stop
+ */
+extern void xktimer_service_stop(xktimer_service_t * service);
+
+/**
+ * \brief			Get the shard for timers added by the calling thread
+ *
+ * This is the shard of the calling thread when it is called from the event
+ * loop of a shard, and otherwise the shard of the core the thread runs on.
+ * Since the workers are pinned to the core of their shard, the callbacks
+ * usually get their own shard as well.
+ *
+ * \param service	A pointer to the service
+ *
+ * \return			The context of the shard
+ */
+extern xktimer_ctx_t * xktimer_service_local(xktimer_service_t * service);
+
+/**
+ * \brief			Add a timer to the local shard of a service
+ *
+ * Same as xktimer_add(), but the timer is added to the shard returned by
+ * xktimer_service_local(). This can be called from any thread.
+ */
+extern bool xktimer_service_add(xktimer_service_t * service,
+								xktimer_ptr_t timer,
+								uint8_t type,
+								uint32_t timeout,
+								void (*callback)());
+
+/**
+ * \brief			Add a dual-state timer to the local shard of a service
+ *
+ * Same as xktimer_add_dual(), but the timer is added to the shard returned by
+ * xktimer_service_local(). This can be called from any thread.
+ */
+extern bool xktimer_service_add_dual(xktimer_service_t * service,
+									 xktimer_ptr_t timer,
+									 uint32_t timeout,
+									 uint32_t timeout2,
+									 void (*callback)(int));
+
+//! Same as xktimer_service_add_dual(), for a sequence timer
+extern bool xktimer_service_add_sequence(xktimer_service_t * service,
+										 xktimer_ptr_t timer,
+										 const uint32_t * sequence,
+										 uint8_t count,
+										 void (*callback)(int));
+#endif
+
+#ifdef XKTIMER_PERSIST
+/**
+ * \brief			Map a file of persistent timers
+ *
+ * The file is created if it does not exist. Only the header is read, and the
+ * timers are not added until xktimer_persist_restore(). Please see
+ * \ref timer-persist.
+ *
+ * \param store		The store to set up
+ * \param path		The path of the file
+ * \param timers	The timers, one for each record, which must stay valid
+ * 					until xktimer_persist_close(). They are cleared, so none
+ * 					of them may be added to the context yet.
+ * \param count		The number of timers, which must match the file if it
+ * 					exists
+ *
+ * \return true		The file is mapped
+ * \return false	The file could not be mapped, has another layout or
+ * 					number of records, or one of the timers is added
+ */
+extern bool xktimer_persist_open(xktimer_persist_t * store,
+								 const char * path,
+								 xktimer_t * timers,
+								 uint32_t count);
+
+/**
+ * \brief			Unmap the file of a store
+ *
+ * The timers are removed from their context, but their records are kept, so
+ * they are restored by the next xktimer_persist_restore().
+ */
+extern void xktimer_persist_close(xktimer_persist_t * store);
+
+/**
+ * \brief			Register the callback of an ID
+ *
+ * \param store		The store
+ * \param id		The ID kept in the records, from 1 to
+ * 					XKTIMER_PERSIST_CALLBACKS - 1
+ * \param callback	The callback of the timers with this ID
+ *
+ * \return true		The callback was registered
+ * \return false	The ID is out of range
+ */
+extern bool xktimer_persist_callback(xktimer_persist_t * store,
+									 uint16_t id,
+									 void (*callback)(int));
+
+/**
+ * \brief			Add the timers of the records of a store
+ *
+ * Each timer gets its state back, and the time left until its deadline. The
+ * records whose callback ID is not registered are left alone.
+ *
+ * \return			The number of timers added
+ */
+extern size_t xktimer_persist_restore(xktimer_persist_t * store);
+
+/**
+ * \brief			Add a new persistent timer
+ *
+ * Same as xktimer_add() or xktimer_add_dual(), but the timer is taken from
+ * a free record of the store. The timer must be started like any other.
+ *
+ * \param store		The store
+ * \param key		A value to find the timer with xktimer_persist_find()
+ * \param type		XKTIMER_SINGLE_SHOT, XKTIMER_PERIODIC or
+ * 					XKTIMER_DUAL_STATE
+ * \param timeout	The timeout in ms
+ * \param timeout2	The second timeout in ms, for a dual-state timer
+ * \param callback	A callback ID registered with xktimer_persist_callback()
+ *
+ * \return			The timer, or NULL if the store is full or the type or
+ * 					the callback ID are not valid
+ */
+extern xktimer_ptr_t xktimer_persist_add(xktimer_persist_t * store,
+										 uint64_t key,
+										 uint8_t type,
+										 uint32_t timeout,
+										 uint32_t timeout2,
+										 uint16_t callback);
+
+/**
+ * \brief			Find a timer of a store by its key
+ *
+ * \return			The timer, or NULL if no record has this key
+ */
+extern xktimer_ptr_t xktimer_persist_find(xktimer_persist_t * store, 
+										  uint64_t key);
+
+/**
+ * \brief			Write the mapped file to the disk
+ *
+ * \return true		The records are on the disk
+ * \return false	msync() failed
+ */
+extern bool xktimer_persist_flush(xktimer_persist_t * store);
+#endif
+
+#ifdef XKTIMER_STATS
+/**
+ * \brief			Keep the statistics of a single timer
+ *
+ * The statistics of the timer are added to the given struct, as well as to
+ * the statistics of its context. Please see \ref timer-stats. xktimer_add()
+ * and xktimer_add_dual() clear this, so it must be called after the timer is
+ * added.
+ *
+ * \param timer		A pointer to the timer
+ * \param stats		The zeroed struct to add to, or NULL to stop
+ */
+extern void xktimer_set_stats(xktimer_ptr_t timer, xktimer_stats_t * stats);
+
+/**
+ * \brief			Copy the statistics of all timers
+ *
+ * \param out		The struct to copy the statistics to
+ */
+extern void xktimer_stats_snapshot(xktimer_stats_t * out);
+
+//! Clear the statistics of all timers
+extern void xktimer_stats_reset();
+
+/**
+ * \brief			Find a percentile in a histogram of an xktimer_stats_t
+ *
+ * \param hist		The late or run histogram
+ * \param percent	The percentile, from 0 to 100
+ *
+ * \return			The largest value of the bucket the percentile falls in,
+ * 					UINT64_MAX if that is the last bucket, or 0 if the
+ * 					histogram is empty
+ */
+extern uint64_t xktimer_stats_percentile(const uint32_t * hist, 
+										 unsigned int percent);
+
+/**
+ * \brief			Print a summary of the given statistics with printf()
+ *
+ * \param stats		The statistics, from xktimer_stats_snapshot() or given
+ * 					to xktimer_set_stats()
+ */
+extern void xktimer_stats_dump(const xktimer_stats_t * stats);
+#endif
+
+#ifdef XKTIMER_TRACE
+/**
+ * \brief			Write the recorded events as Chrome trace JSON
+ *
+ * The events of each thread are written from the oldest to the newest.
+ * Events recorded while this runs can be written half updated, so it is
+ * best called while the timers are quiet. Please see \ref timer-trace.
+ *
+ * \param out		The file to write to
+ *
+ * \return true		The events were written
+ * \return false	Writing to the file failed
+ */
+extern bool xktimer_trace_dump(FILE * out);
+
+/**
+ * \brief			Drop all of the recorded events
+ *
+ * No other thread may record events while this runs.
+ */
+extern void xktimer_trace_reset();
+#endif
+
+/**
+ * \name Timer Contexts
+ *
+ * These are the same as the functions above, but work on the given context
+ * instead of the default one. Please see \ref timer-ctx.
+ */
+//! @{
+
+/**
+ * \brief			Get the default context
+ *
+ * \return			The context used by the functions that do not take one
+ */
+extern xktimer_ctx_t * xktimer_default_ctx();
+
+/**
+ * \brief			Initialize a context
+ *
+ * This must be called before adding timers to the context. Unlike
+ * xktimer_init(), this does not free the memory of a context that was
+ * already in use, so a context must be destroyed before it is initialized
+ * again.
+ *
+ * \param ctx		A pointer to the context to initialize
+ */
+extern void xktimer_ctx_init(xktimer_ctx_t * ctx);
+
+/**
+ * \brief			Free the resources of a context
+ *
+ * The timers that were added to the context must not be used with it
+ * afterwards.
+ *
+ * \param ctx		A pointer to the context to destroy
+ */
+extern void xktimer_ctx_destroy(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_add(), for the given context
+extern bool xktimer_ctx_add(xktimer_ctx_t * ctx,
+							xktimer_ptr_t timer,
+							uint8_t type,
+							uint32_t timeout,
+							void (*callback)());
+
+//! Same as xktimer_add_dual(), for the given context
+extern bool xktimer_ctx_add_dual(xktimer_ctx_t * ctx,
+								 xktimer_ptr_t timer,
+								 uint32_t timeout,
+								 uint32_t timeout2,
+								 void (*callback)(int));
+
+//! Same as xktimer_add_sequence(), for the given context
+extern bool xktimer_ctx_add_sequence(xktimer_ctx_t * ctx,
+									 xktimer_ptr_t timer,
+									 const uint32_t * sequence,
+									 uint8_t count,
+									 void (*callback)(int));
+
+//! Same as xktimer_add_many(), for the given context
+extern size_t xktimer_ctx_add_many(xktimer_ctx_t * ctx,
+								   const xktimer_spec_t * specs,
+								   size_t count);
+
+//! Same as xktimer_reserve(), for the given context
+extern bool xktimer_ctx_reserve(xktimer_ctx_t * ctx, int count);
+
+//! Same as xktimer_now(), for the given context
+extern xktimer_tick_t xktimer_ctx_now(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_next_deadline(), for the given context
+extern xktimer_tick_t xktimer_ctx_next_deadline(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_task(), for the given context
+extern void xktimer_ctx_task(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_set_default_slack(), for the given context
+extern void xktimer_ctx_set_default_slack(xktimer_ctx_t * ctx, 
+										  uint32_t slack);
+
+//! Same as xktimer_collect_expired(), for the given context
+extern size_t xktimer_ctx_collect_expired(xktimer_ctx_t * ctx,
+										  xktimer_ptr_t * out,
+										  size_t cap,
+										  xktimer_tick_t now);
+
+#ifdef XKTIMER_BUDGET
+//! Same as xktimer_task_budget(), for the given context
+extern size_t xktimer_ctx_task_budget(xktimer_ctx_t * ctx,
+									  unsigned int max_callbacks,
+									  uint32_t max_us);
+#endif
+
+#ifdef XKTIMER_DISPATCH
+//! Same as xktimer_set_pool(), for the given context
+extern void xktimer_ctx_set_pool(xktimer_ctx_t * ctx, xktimer_pool_t * pool);
+#endif
+
+#ifdef XKTIMER_STATS
+//! Same as xktimer_stats_snapshot(), for the given context
+extern void xktimer_ctx_stats_snapshot(xktimer_ctx_t * ctx, 
+									   xktimer_stats_t * out);
+
+//! Same as xktimer_stats_reset(), for the given context
+extern void xktimer_ctx_stats_reset(xktimer_ctx_t * ctx);
+#endif
+
+#ifdef XKTIMER_EVENT_LOOP
+//! Same as xktimer_run(), for the given context
+extern void xktimer_ctx_run(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_run_until(), for the given context
+extern void xktimer_ctx_run_until(xktimer_ctx_t * ctx, 
+								  xktimer_tick_t deadline);
+
+//! Same as xktimer_quit(), for the given context
+extern void xktimer_ctx_quit(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_lock(), for the given context
+extern void xktimer_ctx_lock(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_unlock(), for the given context
+extern void xktimer_ctx_unlock(xktimer_ctx_t * ctx);
+#endif
+
+#ifdef XKTIMER_PERSIST
+//! Same as xktimer_persist_open(), adding the timers to the given context
+extern bool xktimer_ctx_persist_open(xktimer_ctx_t * ctx,
+									 xktimer_persist_t * store,
+									 const char * path,
+									 xktimer_t * timers,
+									 uint32_t count);
+#endif
+
+#ifdef XKTIMER_FD
+//! Same as xktimer_fd(), for the given context
+extern int xktimer_ctx_fd(xktimer_ctx_t * ctx);
+
+//! Same as xktimer_on_readable(), for the given context
+extern void xktimer_ctx_on_readable(xktimer_ctx_t * ctx);
+#endif
+//! @}
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,495 @@
+/*
+ * This file is part of the XKLib project.
+ *
+ * xktimer_bench.c
+ *
+ * Copyright (C) 2011 Jesse L. Zamora <xtremekforever@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief The XKTimer Module (Benchmark)
+ *
+ * Measures the cost of xktimer_add(), xktimer_start(), xktimer_stop() and
+ * xktimer_remove(), of restarting a running timer with xktimer_start() and
+ * with xktimer_touch_at(), of adding and starting all of the timers with
+ * xktimer_add_many(), a mix of starts and stops with passes in between,
+ * the time of an xktimer_task() pass with 0%, 1% and 100% of the timers
+ * timing out, and the lateness of the timeouts of periodic timers. The
+ * number of timers goes from 10 up to 1000000, or the limit given as the
+ * first argument.
+ *
+ * The backend is chosen at compile time, so the benchmark has to be built
+ * once for each backend, with the same flags for both files:
+ *
+ * \code
+ * for flags in "" -DXKTIMER_WHEEL -DXKTIMER_HEAP -DXKTIMER_INTRUSIVE \
+ *              "-DXKTIMER_HEAP -DXKTIMER_INTRUSIVE" "-DXKTIMER_SOA -mavx2"; do
+ *     cc -O2 -DXKTIMER_CLOCK=1 $flags xktimer.c xktimer_bench.c -o bench
+ *     ./bench 1000000
+ * done
+ * \endcode
+ *
+ * The lateness is only measured with a clock source that follows the wall
+ * clock, like XKTIMER_CLOCK_MONOTONIC. With XKTIMER_CLOCK_TSC, the benchmark
+ * also checks that the calibrated clock keeps up with CLOCK_MONOTONIC over a
+ * sleep, and exits with a non-zero status if it does not. The random numbers
+ * use a fixed seed, so every run does the same work.
+ *
+ * \author 				Jesse L. Zamora - xtremekforever@gmail.com
+ *
+ ******************************************************************************/
+
+/* Standard Library Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Time Includes */
+#include <time.h>
+
+#include "includes.h"
+
+#include "xktimer.h"
+
+//! The timeout of the timers that should not time out during a benchmark
+#define BENCH_IDLE_TIMEOUT		3600000
+
+//! The number of starts and stops in the mixed benchmark
+#define BENCH_MIX_OPS			100000
+
+//! The number of starts and stops between two passes in the mixed benchmark
+#define BENCH_MIX_BATCH			1024
+
+//! The number of timers used to measure the lateness
+#define BENCH_LATE_TIMERS		1000
+
+//! The time in ms spent measuring the lateness
+#define BENCH_LATE_MS			2000
+
+//! The time in ms the TSC clock source is compared with CLOCK_MONOTONIC
+#define BENCH_DRIFT_MS			2000
+
+//! How far apart the TSC clock source and CLOCK_MONOTONIC may drift, in ppm
+#define BENCH_DRIFT_PPM			50
+
+#if defined(XKTIMER_WHEEL)
+#define BENCH_BACKEND			"timing wheel"
+#elif defined(XKTIMER_HEAP) && defined(XKTIMER_INTRUSIVE)
+#define BENCH_BACKEND			"pairing heap"
+#elif defined(XKTIMER_HEAP)
+#define BENCH_BACKEND			"4-ary heap"
+#elif defined(XKTIMER_INTRUSIVE)
+#define BENCH_BACKEND			"intrusive list"
+#elif defined(XKTIMER_SOA)
+#define BENCH_BACKEND			"SoA scan"
+#else
+#define BENCH_BACKEND			"linear scan"
+#endif
+
+//! A periodic timer whose lateness is measured
+typedef struct bench_late_s {
+	xktimer_t timer;
+
+	//! The deadline of the next timeout
+	xktimer_tick_t due;
+} bench_late_t;
+
+static unsigned long bench_fired;
+static uint32_t bench_seed = 2463534242u;
+
+//! The monotonic time in ns
+static uint64_t bench_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//! A xorshift random number, the same sequence on every run
+static uint32_t bench_rand()
+{
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+
+	return bench_seed;
+}
+
+static void bench_callback(int state)
+{
+	(void)state;
+
+	bench_fired++;
+}
+
+//! Start count timers at the front of the array with a timeout of 1 ms
+static void bench_set_due(xktimer_t * timers, size_t n, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		xktimer_stop(&timers[i]);
+		xktimer_set_timeout(&timers[i], i < count ? 1 : BENCH_IDLE_TIMEOUT);
+		xktimer_start(&timers[i]);
+	}
+}
+
+//! The average time of a pass in us, with count of the n timers timing out
+static double bench_pass(xktimer_t * timers, size_t n, size_t count)
+{
+	// About the same amount of work for every n
+	size_t passes = 2000000 / n;
+	uint64_t total = 0, start;
+	size_t i, j;
+
+	if (passes < 5) {
+		passes = 5;
+	} else if (passes > 200) {
+		passes = 200;
+	}
+
+	bench_set_due(timers, n, count);
+
+	// Warm up the caches
+	xktimer_task();
+	bench_fired = 0;
+
+	for (i = 0; i < passes; i++) {
+		xktimer_tick_t now;
+
+		for (j = 0; j < count; j++) {
+			xktimer_start(&timers[j]);
+		}
+
+		// Wait for the last timer that was started to time out
+		now = xktimer_clock();
+		while (!xktimer_reached(xktimer_clock(), now + XKTIMER_TICKS_PER_MS)) {
+		}
+
+		start = bench_ns();
+		xktimer_task();
+		total += bench_ns() - start;
+	}
+
+	if (bench_fired != passes * count) {
+		printf("warning: %lu timeouts instead of %lu\n", bench_fired,
+			   (unsigned long)(passes * count));
+	}
+
+	return total / 1000.0 / passes;
+}
+
+//! The average time in ns of a random start or stop, with passes in between
+static double bench_mix(xktimer_t * timers, size_t n)
+{
+	uint64_t start;
+	size_t i;
+
+	bench_set_due(timers, n, 0);
+
+	start = bench_ns();
+	for (i = 0; i < BENCH_MIX_OPS; i++) {
+		xktimer_ptr_t timer = &timers[bench_rand() % n];
+
+		if (xktimer_running(timer)) {
+			xktimer_stop(timer);
+		} else {
+			xktimer_set_timeout(timer, 1 + bench_rand() % 1000);
+			xktimer_start(timer);
+		}
+
+		if (i % BENCH_MIX_BATCH == BENCH_MIX_BATCH - 1) {
+			xktimer_task();
+		}
+	}
+
+	return (double)(bench_ns() - start) / BENCH_MIX_OPS;
+}
+
+static void bench_size(size_t n)
+{
+	xktimer_t * timers = calloc(n, sizeof(xktimer_t));
+	double add, start, restart, touch, stop, remove, many, mix, pass[3];
+	xktimer_spec_t * specs = calloc(n, sizeof(xktimer_spec_t));
+	xktimer_tick_t now;
+	uint64_t t;
+	size_t i;
+
+	if (timers == NULL || specs == NULL) {
+		printf("%9lu  out of memory\n", (unsigned long)n);
+		free(timers);
+		free(specs);
+		return;
+	}
+
+	xktimer_init();
+
+	t = bench_ns();
+	for (i = 0; i < n; i++) {
+		xktimer_add(&timers[i], XKTIMER_PERIODIC, BENCH_IDLE_TIMEOUT,
+					bench_callback);
+	}
+	add = (double)(bench_ns() - t) / n;
+
+	t = bench_ns();
+	for (i = 0; i < n; i++) {
+		xktimer_start(&timers[i]);
+	}
+	start = (double)(bench_ns() - t) / n;
+
+	t = bench_ns();
+	for (i = 0; i < n; i++) {
+		xktimer_start(&timers[bench_rand() % n]);
+	}
+	restart = (double)(bench_ns() - t) / n;
+
+	// One clock read for all of the touches, like for a batch of packets
+	t = bench_ns();
+	now = xktimer_now();
+	for (i = 0; i < n; i++) {
+		xktimer_touch_at(&timers[bench_rand() % n], now);
+	}
+	touch = (double)(bench_ns() - t) / n;
+
+	t = bench_ns();
+	for (i = 0; i < n; i++) {
+		xktimer_stop(&timers[i]);
+	}
+	stop = (double)(bench_ns() - t) / n;
+
+	pass[0] = bench_pass(timers, n, 0);
+	pass[1] = bench_pass(timers, n, (n + 99) / 100);
+	pass[2] = bench_pass(timers, n, n);
+	mix = bench_mix(timers, n);
+
+	t = bench_ns();
+	for (i = 0; i < n; i++) {
+		xktimer_remove(&timers[i]);
+	}
+	remove = (double)(bench_ns() - t) / n;
+
+	for (i = 0; i < n; i++) {
+		specs[i].timer = &timers[i];
+		specs[i].type = XKTIMER_PERIODIC;
+		specs[i].start = true;
+		specs[i].timeout = BENCH_IDLE_TIMEOUT - bench_rand() % 1000;
+		specs[i].callback = bench_callback;
+	}
+
+	t = bench_ns();
+	xktimer_add_many(specs, n);
+	many = (double)(bench_ns() - t) / n;
+
+	for (i = 0; i < n; i++) {
+		xktimer_remove(&timers[i]);
+	}
+
+	printf("%9lu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %10.2f "
+		   "%10.2f %10.2f\n", (unsigned long)n, add, start, restart, touch, 
+		   stop, remove, many, mix, pass[0], pass[1], pass[2]);
+	fflush(stdout);
+
+	free(timers);
+	free(specs);
+}
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC_COARSE || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+//! The lateness of each timeout in us
+static uint32_t * bench_late;
+static size_t bench_late_len;
+static size_t bench_late_cap;
+
+//! Record how late a timer timed out, in us
+static void bench_late_handler(xktimer_ptr_t timer)
+{
+	bench_late_t * late = timer->data;
+	int64_t us = ((int64_t)bench_ns() - 
+				  (int64_t)late->due * XKTIMER_NS_PER_TICK) / 1000;
+
+	late->due = timer->ticks;
+
+	if (bench_late_len < bench_late_cap) {
+		bench_late[bench_late_len++] = us < 0 ? 0 : (uint32_t)us;
+	}
+}
+
+static int bench_compare(const void * a, const void * b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void bench_lateness(size_t n)
+{
+	bench_late_t * timers = calloc(n, sizeof(bench_late_t));
+	uint64_t end, total = 0;
+	size_t i;
+
+	bench_late_cap = n * (BENCH_LATE_MS + 1);
+	bench_late = malloc(bench_late_cap * sizeof(uint32_t));
+	bench_late_len = 0;
+
+	if (timers == NULL || bench_late == NULL) {
+		printf("lateness: out of memory\n");
+		free(timers);
+		free(bench_late);
+		return;
+	}
+
+	xktimer_init();
+
+	for (i = 0; i < n; i++) {
+		xktimer_add(&timers[i].timer, XKTIMER_PERIODIC, 1 + i % 16, NULL);
+		xktimer_set_handler(&timers[i].timer, bench_late_handler, &timers[i]);
+		xktimer_start(&timers[i].timer);
+		timers[i].due = timers[i].timer.ticks;
+	}
+
+	end = bench_ns() + BENCH_LATE_MS * 1000000ULL;
+	while (bench_ns() < end) {
+		xktimer_task();
+	}
+
+	for (i = 0; i < n; i++) {
+		xktimer_remove(&timers[i].timer);
+	}
+
+	if (bench_late_len > 0) {
+		qsort(bench_late, bench_late_len, sizeof(uint32_t), bench_compare);
+
+		for (i = 0; i < bench_late_len; i++) {
+			total += bench_late[i];
+		}
+
+		printf("\nLateness of %lu periodic timers of 1-16 ms over %d ms, "
+			   "in us (the clock has %ld ns steps):\n", (unsigned long)n,
+			   BENCH_LATE_MS, (long)XKTIMER_NS_PER_TICK);
+		printf("timeouts %lu, mean %.1f, p50 %lu, p99 %lu, p99.9 %lu, "
+			   "max %lu\n", (unsigned long)bench_late_len,
+			   (double)total / bench_late_len,
+			   (unsigned long)bench_late[bench_late_len / 2],
+			   (unsigned long)bench_late[bench_late_len * 99 / 100],
+			   (unsigned long)bench_late[bench_late_len * 999 / 1000],
+			   (unsigned long)bench_late[bench_late_len - 1]);
+	}
+
+	free(timers);
+	free(bench_late);
+}
+#endif
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+//! Wait for the clock to tick, returns the monotonic time in ns it did at
+static uint64_t bench_tick_edge(xktimer_tick_t * ticks)
+{
+	xktimer_tick_t start = xktimer_clock();
+
+	while ((*ticks = xktimer_clock()) == start) {
+	}
+
+	return bench_ns();
+}
+
+/**
+ * \brief			Check that the TSC clock runs at the rate of CLOCK_MONOTONIC
+ *
+ * Both ends of the sleep are taken at a tick of the clock, so its resolution
+ * does not hide the drift. Returns false if it is above BENCH_DRIFT_PPM.
+ */
+static bool bench_drift()
+{
+	struct timespec ts = { BENCH_DRIFT_MS / 1000, 
+						   (BENCH_DRIFT_MS % 1000) * 1000000L };
+	xktimer_tick_t start, end;
+	uint64_t start_ns, ns;
+	double ppm;
+
+	xktimer_init();
+
+	start_ns = bench_tick_edge(&start);
+	nanosleep(&ts, NULL);
+	ns = bench_tick_edge(&end) - start_ns;
+
+	ppm = ((double)xktimer_diff(end, start) * XKTIMER_NS_PER_TICK - ns) * 
+		  1e6 / ns;
+
+	printf("\nTSC clock against CLOCK_MONOTONIC over %d ms: %+.1f ppm\n", 
+		   BENCH_DRIFT_MS, ppm);
+
+	if (ppm > BENCH_DRIFT_PPM || ppm < -BENCH_DRIFT_PPM) {
+		printf("The TSC clock drifts more than %d ppm\n", BENCH_DRIFT_PPM);
+		return false;
+	}
+
+	return true;
+}
+#endif
+
+int main(int argc, char * argv[])
+{
+	unsigned long max = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	size_t n;
+
+#ifdef XKTIMER_NO_MALLOC
+	if (max > XKTIMER_MAX_TIMERS) {
+		max = XKTIMER_MAX_TIMERS;
+	}
+#endif
+
+	printf("XKTimer benchmark, %s%s\n", BENCH_BACKEND,
+#ifdef XKTIMER_NO_MALLOC
+		   ", XKTIMER_NO_MALLOC"
+#else
+		   ""
+#endif
+		   );
+	printf("add, start, restart, touch, stop, remove and mix in ns per call, "
+		   "add many in ns per timer, passes in us with 0%%, 1%% and 100%% "
+		   "timing out\n\n");
+	printf("%9s %8s %8s %8s %8s %8s %8s %8s %8s %10s %10s %10s\n", "timers", 
+		   "add", "start", "restart", "touch", "stop", "remove", "add many",
+		   "mix", "pass 0%", "pass 1%", "pass 100%");
+
+	for (n = 10; n <= max; n *= 10) {
+		bench_size(n);
+	}
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_MONOTONIC_COARSE || \
+	XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+	bench_lateness(max < BENCH_LATE_TIMERS ? max : BENCH_LATE_TIMERS);
+#else
+	printf("\nLateness not measured, it needs a monotonic clock source\n");
+#endif
+
+#if XKTIMER_CLOCK == XKTIMER_CLOCK_TSC
+	if (!bench_drift()) {
+		return EXIT_FAILURE;
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,777 @@
+/*
+ * This file is part of the XKLib project.
+ *
+ * xktimer_test.c
+ *
+ * Copyright (C) 2011 Jesse L. Zamora <xtremekforever@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief The XKTimer Module (Tests)
+ *
+ * Checks when single-shot, periodic, dual-state and sequence timers time
+ * out, removing timers from their own callbacks and from the callbacks of
+ * other timers, xktimer_touch(), the timer slack, the overrun policies,
+ * xktimer_add_many() and xktimer_start_many(), xktimer_next_deadline(),
+ * timeouts in us and ns, and, when compiled with XKTIMER_PERSIST, the
+ * persistent store.
+ *
+ * The tests drive the module with a fake clock, so they need
+ * XKTIMER_CLOCK_CUSTOM. Every backend and resolution must give the same
+ * results, so the tests are built and run once for each of them, with the
+ * same flags for both files:
+ *
+ * \code
+ * for res in 1000 1000000 1000000000; do
+ * for flags in "" -DXKTIMER_WHEEL -DXKTIMER_HEAP -DXKTIMER_INTRUSIVE \
+ *              "-DXKTIMER_HEAP -DXKTIMER_INTRUSIVE" -DXKTIMER_SOA \
+ *              "-DXKTIMER_PERSIST -DXKTIMER_HEAP"; do
+ *     cc -DXKTIMER_CLOCK=5 -DXKTIMER_RESOLUTION=$res $flags \
+ *        xktimer.c xktimer_test.c -o test || break 2
+ *     ./test || break 2
+ * done
+ * done
+ * \endcode
+ *
+ * The program prints each check that fails and exits with a non-zero status
+ * if any did.
+ *
+ * \author 				Jesse L. Zamora - xtremekforever@gmail.com
+ *
+ ******************************************************************************/
+
+// mkstemp() is POSIX, so it is hidden by a strict -std=c99 or -std=c11
+#if defined(XKTIMER_PERSIST) && !defined(_POSIX_C_SOURCE) && \
+	!defined(_GNU_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* Standard Library Includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "includes.h"
+
+#include "xktimer.h"
+
+#ifdef XKTIMER_PERSIST
+#include <unistd.h>
+#endif
+
+#if XKTIMER_CLOCK != XKTIMER_CLOCK_CUSTOM
+#error "The tests need a fake clock, please build them with XKTIMER_CLOCK=5"
+#endif
+
+//! The number of timers used by the tests with many timers
+#if defined(XKTIMER_NO_MALLOC) && XKTIMER_MAX_TIMERS < 64
+#define TEST_TIMERS				(XKTIMER_MAX_TIMERS & ~1)
+#else
+#define TEST_TIMERS				64
+#endif
+
+//! The most timeouts recorded by a test
+#define TEST_FIRES				64
+
+//! A time in ms, in ticks of the fake clock
+#define TEST_MS(ms)				((xktimer_tick_t)XKTIMER_MS_TICKS(ms))
+
+//! Check a condition and report it if it does not hold
+#define TEST_CHECK(cond)	\
+	test_check((cond), #cond, __FILE__, __LINE__)
+
+//! A timeout seen by a test callback
+typedef struct test_fire_s {
+	//! The time of the pass that called the callback
+	xktimer_tick_t now;
+
+	//! The state passed to the callback
+	int state;
+} test_fire_t;
+
+static xktimer_tick_t test_now;
+
+static unsigned int test_checks;
+static unsigned int test_failed;
+
+static test_fire_t test_fires[TEST_FIRES];
+static unsigned int test_fires_len;
+
+static xktimer_t test_timers[TEST_TIMERS];
+
+//! The timer that test_remove_callback() removes
+static xktimer_ptr_t test_victim;
+
+static xktimer_tick_t test_clock()
+{
+	return test_now;
+}
+
+static void test_check(bool ok, const char * what, const char * file, int line)
+{
+	test_checks++;
+
+	if (!ok) {
+		test_failed++;
+		printf("%s:%d: check failed: %s\n", file, line, what);
+	}
+}
+
+static void test_callback(int state)
+{
+	if (test_fires_len < TEST_FIRES) {
+		test_fires[test_fires_len].now = test_now;
+		test_fires[test_fires_len].state = state;
+	}
+
+	test_fires_len++;
+}
+
+//! Removes test_victim, which may be the timer that timed out
+static void test_remove_callback(int state)
+{
+	test_callback(state);
+
+	if (test_victim) {
+		xktimer_remove(test_victim);
+		test_victim = NULL;
+	}
+}
+
+//! Restarts the first test timer with a zero timeout, so it is due again
+static void test_restart_callback(int state)
+{
+	test_callback(state);
+
+	xktimer_set_timeout(&test_timers[0], 0);
+	xktimer_start(&test_timers[0]);
+}
+
+//! Start each test with an empty module and the clock at 0
+static void test_reset()
+{
+	memset(test_timers, 0, sizeof(test_timers));
+	memset(test_fires, 0, sizeof(test_fires));
+	test_fires_len = 0;
+	test_victim = NULL;
+
+	test_now = 0;
+	xktimer_set_clock(test_clock);
+	xktimer_init();
+}
+
+//! Remove the timers used by a test
+static void test_cleanup()
+{
+	int i;
+
+	for (i = 0; i < TEST_TIMERS; i++) {
+		xktimer_remove(&test_timers[i]);
+	}
+}
+
+//! Run one pass for each ms up to the given time in ms
+static void test_run(uint32_t until)
+{
+	while (test_now < TEST_MS(until)) {
+		test_now += TEST_MS(1);
+		xktimer_task();
+	}
+}
+
+//! Run one pass for each tick up to the given time in ticks
+static void test_run_ticks(xktimer_tick_t until)
+{
+	while (test_now < until) {
+		test_now++;
+		xktimer_task();
+	}
+}
+
+static void test_single_shot()
+{
+	xktimer_ptr_t timer = &test_timers[0];
+
+	test_reset();
+
+	TEST_CHECK(xktimer_add(timer, XKTIMER_SINGLE_SHOT, 10, test_callback));
+	TEST_CHECK(!xktimer_add(timer, XKTIMER_SINGLE_SHOT, 10, test_callback));
+	TEST_CHECK(xktimer_next_deadline() == XKTIMER_NO_DEADLINE);
+
+	xktimer_start(timer);
+	TEST_CHECK(xktimer_running(timer));
+	TEST_CHECK(xktimer_next_deadline() == TEST_MS(10));
+
+	test_run(9);
+	TEST_CHECK(test_fires_len == 0);
+
+	test_run(30);
+	TEST_CHECK(test_fires_len == 1 && test_fires[0].now == TEST_MS(10));
+	TEST_CHECK(!xktimer_running(timer));
+	TEST_CHECK(xktimer_next_deadline() == XKTIMER_NO_DEADLINE);
+
+	// A stopped timer does not time out
+	xktimer_start(timer);
+	test_run(35);
+	xktimer_stop(timer);
+	test_run(60);
+	TEST_CHECK(test_fires_len == 1);
+
+	test_cleanup();
+}
+
+static void test_periodic()
+{
+	xktimer_ptr_t timer = &test_timers[0];
+	unsigned int i;
+
+	test_reset();
+
+	xktimer_add(timer, XKTIMER_PERIODIC, 10, test_callback);
+	xktimer_start(timer);
+	test_run(55);
+
+	TEST_CHECK(test_fires_len == 5);
+	for (i = 0; i < 5 && i < test_fires_len; i++) {
+		TEST_CHECK(test_fires[i].now == TEST_MS((i + 1) * 10));
+	}
+
+	// Without an overrun policy, a late pass pushes the next timeouts back
+	test_now = TEST_MS(73);
+	xktimer_task();
+	test_run(90);
+	TEST_CHECK(test_fires_len == 7 && test_fires[6].now == TEST_MS(83));
+
+	test_cleanup();
+}
+
+static void test_dual_state()
+{
+	static const uint32_t when[] = { 5, 20, 25, 40 };
+	static const int state[] = { 1, 0, 1, 0 };
+	xktimer_ptr_t timer = &test_timers[0];
+	unsigned int i;
+
+	test_reset();
+
+	xktimer_add_dual(timer, 5, 15, test_callback);
+	xktimer_start(timer);
+	test_run(44);
+
+	TEST_CHECK(test_fires_len == 4);
+	for (i = 0; i < 4 && i < test_fires_len; i++) {
+		TEST_CHECK(test_fires[i].now == TEST_MS(when[i]));
+		TEST_CHECK(test_fires[i].state == state[i]);
+	}
+
+	test_cleanup();
+}
+
+static void test_sequence()
+{
+	static const uint32_t sequence[] = { 3, 4, 5 };
+	static const uint32_t when[] = { 3, 7, 12, 15 };
+	static const int state[] = { 1, 2, 0, 1 };
+	xktimer_ptr_t timer = &test_timers[0];
+	unsigned int i;
+
+	test_reset();
+
+	TEST_CHECK(!xktimer_add_sequence(timer, sequence, 0, test_callback));
+	TEST_CHECK(xktimer_add_sequence(timer, sequence, 3, test_callback));
+	xktimer_start(timer);
+	test_run(18);
+
+	TEST_CHECK(test_fires_len == 4);
+	for (i = 0; i < 4 && i < test_fires_len; i++) {
+		TEST_CHECK(test_fires[i].now == TEST_MS(when[i]));
+		TEST_CHECK(test_fires[i].state == state[i]);
+	}
+
+	test_cleanup();
+}
+
+static void test_remove()
+{
+	unsigned int before;
+	int i;
+
+	test_reset();
+
+	for (i = 0; i < 4; i++) {
+		xktimer_add(&test_timers[i], XKTIMER_PERIODIC, 10,
+					i == 0 ? test_remove_callback : test_callback);
+		xktimer_start(&test_timers[i]);
+	}
+
+	// The first timer removes another one that is due in the same pass,
+	// which then only times out if the pass got to it first
+	test_victim = &test_timers[2];
+	test_run(10);
+	TEST_CHECK(test_victim == NULL);
+	TEST_CHECK(test_fires_len == 3 || test_fires_len == 4);
+	TEST_CHECK(!xktimer_remove(&test_timers[2]));
+
+	before = test_fires_len;
+	test_run(20);
+	TEST_CHECK(test_fires_len == before + 3);
+
+	// A timer that removes itself
+	before = test_fires_len;
+	test_victim = &test_timers[0];
+	test_run(30);
+	TEST_CHECK(test_fires_len == before + 3);
+	test_run(60);
+	TEST_CHECK(test_fires_len == before + 3 + 3 * 2);
+
+	// The slot of a removed timer is free for a new one
+	TEST_CHECK(xktimer_add(&test_timers[2], XKTIMER_SINGLE_SHOT, 5,
+						   test_callback));
+	xktimer_start(&test_timers[2]);
+	test_run(65);
+	TEST_CHECK(test_fires_len == before + 3 + 3 * 2 + 1);
+
+	test_cleanup();
+}
+
+static void test_touch()
+{
+	xktimer_ptr_t timer = &test_timers[0];
+
+	test_reset();
+
+	xktimer_add(timer, XKTIMER_SINGLE_SHOT, 10, test_callback);
+
+	// Touching a stopped timer starts it
+	xktimer_touch(timer);
+	TEST_CHECK(xktimer_running(timer));
+
+	test_run(5);
+	xktimer_touch(timer);
+	test_run(12);
+	xktimer_touch(timer);
+	test_run(21);
+	TEST_CHECK(test_fires_len == 0);
+
+	test_run(30);
+	TEST_CHECK(test_fires_len == 1 && test_fires[0].now == TEST_MS(22));
+
+	test_cleanup();
+}
+
+static void test_slack()
+{
+	xktimer_ptr_t coarse = &test_timers[0];
+	xktimer_ptr_t exact = &test_timers[1];
+
+	test_reset();
+
+	xktimer_add(coarse, XKTIMER_SINGLE_SHOT, 4, test_callback);
+	xktimer_add(exact, XKTIMER_SINGLE_SHOT, 4, test_callback);
+	xktimer_set_slack(coarse, 10);
+
+	test_run(3);
+	xktimer_start(coarse);
+	xktimer_start(exact);
+	test_run(20);
+
+	// The deadline of 7 is rounded up to the next multiple of the slack
+	TEST_CHECK(test_fires_len == 2);
+	TEST_CHECK(test_fires[0].now == TEST_MS(7) &&
+			   test_fires[1].now == TEST_MS(10));
+
+	test_cleanup();
+}
+
+static void test_catch_up()
+{
+	xktimer_ptr_t periodic = &test_timers[0];
+	xktimer_ptr_t single = &test_timers[1];
+	unsigned int i;
+
+	test_reset();
+
+	xktimer_add(periodic, XKTIMER_PERIODIC, 10, test_callback);
+	xktimer_set_overrun(periodic, XKTIMER_OVERRUN_CATCH_UP);
+	xktimer_start(periodic);
+	xktimer_add(single, XKTIMER_SINGLE_SHOT, 45, test_callback);
+	xktimer_start(single);
+
+	// The first pass is 45 ms late for the periodic timer
+	test_now = TEST_MS(55);
+	xktimer_task();
+
+	// The periodic timer is behind, but the single-shot timer that is due
+	// must not wait until the next deadline of the periodic one is after it
+	TEST_CHECK(test_fires_len == 2);
+	TEST_CHECK(!xktimer_running(single));
+	TEST_CHECK(xktimer_missed(periodic) == 4);
+
+	// Then the missed deadlines of 20 to 50 run one per pass
+	for (i = 0; i < 4; i++) {
+		xktimer_task();
+	}
+	TEST_CHECK(test_fires_len == 6);
+	TEST_CHECK(xktimer_missed(periodic) == 0);
+
+	xktimer_task();
+	TEST_CHECK(test_fires_len == 6);
+
+	// And the timer is back on its grid
+	test_run(60);
+	TEST_CHECK(test_fires_len == 7 && test_fires[6].now == TEST_MS(60));
+
+	test_cleanup();
+}
+
+//! A catch-up timer that fell more than 2^31 ms behind is still found
+static void test_long_stall()
+{
+	xktimer_ptr_t periodic = &test_timers[0];
+	unsigned int i;
+
+	// The ticks can not hold the stall
+	if (sizeof(xktimer_tick_t) < 8) return;
+
+	test_reset();
+
+	xktimer_add(periodic, XKTIMER_PERIODIC, 10, test_callback);
+	xktimer_set_overrun(periodic, XKTIMER_OVERRUN_CATCH_UP);
+	xktimer_start(periodic);
+
+	test_now = TEST_MS(0x80000000u) + TEST_MS(25);
+
+	for (i = 0; i < 3; i++) {
+		xktimer_task();
+	}
+	TEST_CHECK(test_fires_len == 3);
+	TEST_CHECK(periodic->ticks == TEST_MS(40));
+
+	test_cleanup();
+}
+
+static void test_restart()
+{
+	xktimer_ptr_t again = &test_timers[0];
+	xktimer_ptr_t other = &test_timers[1];
+	unsigned int before;
+
+	test_reset();
+
+	xktimer_add(again, XKTIMER_SINGLE_SHOT, 5, test_restart_callback);
+	xktimer_add(other, XKTIMER_SINGLE_SHOT, 8, test_remove_callback);
+	xktimer_start(again);
+	xktimer_start(other);
+
+	// A timer restarted with a zero timeout times out once per pass, and
+	// does not hold up the other timer that is due
+	test_now = TEST_MS(10);
+	xktimer_task();
+	TEST_CHECK(test_fires_len == 2);
+	xktimer_task();
+	TEST_CHECK(test_fires_len == 3);
+
+	// The other timer removes it, which with the heap is after it timed
+	// out again in the same pass
+	test_now = TEST_MS(11);
+	xktimer_set_timeout(other, 1);
+	xktimer_start(other);
+	test_victim = again;
+	test_now = TEST_MS(12);
+	xktimer_task();
+	TEST_CHECK(test_fires_len == 4 || test_fires_len == 5);
+	TEST_CHECK(test_victim == NULL && !xktimer_running(again));
+
+	before = test_fires_len;
+	test_run(30);
+	TEST_CHECK(test_fires_len == before);
+	TEST_CHECK(xktimer_next_deadline() == XKTIMER_NO_DEADLINE);
+
+	test_cleanup();
+}
+
+static void test_overrun()
+{
+	xktimer_ptr_t coalesce = &test_timers[0];
+	xktimer_ptr_t skip = &test_timers[1];
+
+	test_reset();
+
+	xktimer_add(coalesce, XKTIMER_PERIODIC, 10, test_callback);
+	xktimer_set_overrun(coalesce, XKTIMER_OVERRUN_COALESCE);
+	xktimer_add(skip, XKTIMER_PERIODIC, 10, test_callback);
+	xktimer_set_overrun(skip, XKTIMER_OVERRUN_SKIP);
+	xktimer_start(coalesce);
+	xktimer_start(skip);
+
+	test_now = TEST_MS(35);
+	xktimer_task();
+	xktimer_task();
+
+	// One call for all of the missed deadlines, or none with SKIP
+	TEST_CHECK(test_fires_len == 1);
+	TEST_CHECK(xktimer_missed(coalesce) == 2 && xktimer_missed(skip) == 2);
+
+	// Both carry on from their grid
+	test_run(40);
+	TEST_CHECK(test_fires_len == 3);
+	TEST_CHECK(test_fires[1].now == TEST_MS(40) &&
+			   test_fires[2].now == TEST_MS(40));
+
+	test_cleanup();
+}
+
+static void test_many()
+{
+	xktimer_spec_t specs[TEST_TIMERS];
+	xktimer_ptr_t timers[TEST_TIMERS];
+	int i;
+
+	test_reset();
+
+	for (i = 0; i < TEST_TIMERS; i++) {
+		specs[i].timer = &test_timers[i];
+		specs[i].type = i % 2 ? XKTIMER_SINGLE_SHOT : XKTIMER_DUAL_STATE;
+		specs[i].start = i < TEST_TIMERS / 2;
+		specs[i].timeout = 1 + i;
+		specs[i].timeout2 = 1000;
+		specs[i].callback = test_callback;
+	}
+
+	TEST_CHECK(xktimer_add_many(specs, TEST_TIMERS) == TEST_TIMERS);
+
+	// The timers that were already added are skipped
+	TEST_CHECK(xktimer_add_many(specs, 4) == 0);
+	TEST_CHECK(xktimer_next_deadline() == TEST_MS(1));
+
+	test_run(TEST_TIMERS / 2);
+	TEST_CHECK(test_fires_len == TEST_TIMERS / 2);
+
+	for (i = 0; i < TEST_TIMERS / 2; i++) {
+		timers[i] = &test_timers[TEST_TIMERS / 2 + i];
+	}
+
+	xktimer_start_many(timers, TEST_TIMERS / 2);
+	TEST_CHECK(xktimer_next_deadline() == TEST_MS(TEST_TIMERS / 2 +
+												  TEST_TIMERS / 2 + 1));
+
+	test_run(TEST_TIMERS * 2);
+	TEST_CHECK(test_fires_len == TEST_TIMERS);
+
+	test_cleanup();
+}
+
+//! Timeouts in us and ns, which are rounded up to the next tick
+static void test_sub_ms()
+{
+	xktimer_ptr_t timer = &test_timers[0];
+	xktimer_span_t period = XKTIMER_US_TICKS(250);
+	unsigned int i;
+
+	test_reset();
+
+	xktimer_add(timer, XKTIMER_PERIODIC, 0, test_callback);
+	xktimer_set_timeout_us(timer, 250);
+	xktimer_start(timer);
+	TEST_CHECK(xktimer_next_deadline() == (xktimer_tick_t)period);
+
+	test_run_ticks(4 * period);
+	TEST_CHECK(test_fires_len == 4);
+	for (i = 0; i < 4 && i < test_fires_len; i++) {
+		TEST_CHECK(test_fires[i].now == (xktimer_tick_t)((i + 1) * period));
+	}
+
+	test_cleanup();
+	test_reset();
+
+	// 1.5 ms is 2 ticks in ms, and 1.5 us is 2 ticks in us
+	xktimer_add(&test_timers[0], XKTIMER_SINGLE_SHOT, 0, test_callback);
+	xktimer_set_timeout_us(&test_timers[0], 1500);
+	xktimer_add(&test_timers[1], XKTIMER_SINGLE_SHOT, 0, test_callback);
+	xktimer_set_timeout_ns(&test_timers[1], 1500);
+	xktimer_start(&test_timers[0]);
+	xktimer_start(&test_timers[1]);
+
+	test_run_ticks(XKTIMER_US_TICKS(1500));
+	TEST_CHECK(test_fires_len == 2);
+	TEST_CHECK(test_fires[0].now == (xktimer_tick_t)XKTIMER_NS_TICKS(1500));
+	TEST_CHECK(test_fires[1].now == (xktimer_tick_t)XKTIMER_US_TICKS(1500));
+
+	test_cleanup();
+}
+
+static void test_uninitialized()
+{
+	static const uint32_t sequence[] = { 2, 3 };
+	xktimer_ptr_t timer;
+	int i;
+
+	test_reset();
+
+	// Timers that were never zeroed, like the ones from malloc()
+	for (i = 0; i < 4; i++) {
+		memset(&test_timers[i], i % 2 ? 0x11 : 0xAA, sizeof(xktimer_t));
+	}
+
+	TEST_CHECK(xktimer_add(&test_timers[0], XKTIMER_SINGLE_SHOT, 5,
+						   test_callback));
+	TEST_CHECK(xktimer_add_dual(&test_timers[1], 5, 5, test_callback));
+	TEST_CHECK(xktimer_add_sequence(&test_timers[2], sequence, 2,
+									test_callback));
+
+	// The fields are set now, so adding them again is caught
+	TEST_CHECK(!xktimer_add(&test_timers[0], XKTIMER_SINGLE_SHOT, 5,
+							test_callback));
+	TEST_CHECK(!xktimer_add_dual(&test_timers[1], 5, 5, test_callback));
+
+	for (i = 0; i < 3; i++) {
+		xktimer_start(&test_timers[i]);
+	}
+
+	test_run(5);
+	TEST_CHECK(test_fires_len == 4);
+
+	// And the same for xktimer_add_many()
+	{
+		xktimer_spec_t spec;
+
+		memset(&spec, 0, sizeof(spec));
+		spec.timer = timer = &test_timers[3];
+		spec.type = XKTIMER_SINGLE_SHOT;
+		spec.start = true;
+		spec.timeout = 1;
+		spec.callback = test_callback;
+
+		TEST_CHECK(xktimer_add_many(&spec, 1) == 1);
+		TEST_CHECK(xktimer_add_many(&spec, 1) == 0);
+		TEST_CHECK(xktimer_running(timer));
+	}
+
+	test_run(6);
+	TEST_CHECK(test_fires_len == 5);
+
+	for (i = 0; i < 4; i++) {
+		TEST_CHECK(xktimer_remove(&test_timers[i]));
+	}
+
+	test_cleanup();
+}
+
+#ifdef XKTIMER_PERSIST
+static void test_persist()
+{
+	char path[] = "/tmp/xktimer_test.XXXXXX";
+	xktimer_persist_t store;
+	xktimer_ptr_t first, second, gone;
+	int fd = mkstemp(path);
+
+	test_reset();
+
+	TEST_CHECK(fd >= 0);
+	if (fd < 0) return;
+	close(fd);
+
+	// mkstemp() leaves an empty file, which is a new store
+	TEST_CHECK(xktimer_persist_open(&store, path, test_timers, TEST_TIMERS));
+	TEST_CHECK(xktimer_persist_callback(&store, 1, test_callback));
+	TEST_CHECK(!xktimer_persist_callback(&store, 0, test_callback));
+
+	TEST_CHECK(xktimer_persist_add(&store, 7, XKTIMER_SINGLE_SHOT, 10, 0,
+								   2) == NULL);
+	first = xktimer_persist_add(&store, 1, XKTIMER_SINGLE_SHOT, 1000, 0, 1);
+	second = xktimer_persist_add(&store, 2, XKTIMER_DUAL_STATE, 5, 2000, 1);
+	gone = xktimer_persist_add(&store, 3, XKTIMER_PERIODIC, 10, 0, 1);
+	TEST_CHECK(first && second && gone);
+	if (!first || !second || !gone) return;
+
+	xktimer_start(first);
+	xktimer_start(second);
+	test_run(6);
+	TEST_CHECK(test_fires_len == 1 && second->state == 1);
+
+	// A removed timer frees its record
+	TEST_CHECK(xktimer_persist_find(&store, 3) == gone);
+	xktimer_remove(gone);
+	TEST_CHECK(xktimer_persist_find(&store, 3) == NULL);
+	TEST_CHECK(xktimer_persist_flush(&store));
+	xktimer_persist_close(&store);
+
+	// The timers of a store are cleared, so they must not be added yet
+	TEST_CHECK(xktimer_add(&test_timers[5], XKTIMER_SINGLE_SHOT, 10, 
+						   test_callback));
+	TEST_CHECK(!xktimer_persist_open(&store, path, test_timers, TEST_TIMERS));
+	TEST_CHECK(test_timers[5].timeout == TEST_MS(10));
+	xktimer_remove(&test_timers[5]);
+
+	// A store can only be opened with the number of records it was made for
+	TEST_CHECK(!xktimer_persist_open(&store, path, test_timers,
+									 TEST_TIMERS / 2));
+
+	test_reset();
+	TEST_CHECK(xktimer_persist_open(&store, path, test_timers, TEST_TIMERS));
+	xktimer_persist_callback(&store, 1, test_callback);
+	TEST_CHECK(xktimer_persist_restore(&store) == 2);
+
+	first = xktimer_persist_find(&store, 1);
+	second = xktimer_persist_find(&store, 2);
+	TEST_CHECK(first && second && xktimer_persist_find(&store, 3) == NULL);
+
+	if (first && second) {
+		TEST_CHECK(xktimer_running(first) && xktimer_running(second));
+		TEST_CHECK(second->state == 1);
+		TEST_CHECK(xktimer_timeout(second) == 5 &&
+				   xktimer_timeout2(second) == 2000);
+
+		// The deadlines are kept in wall clock time, which barely moved
+		TEST_CHECK(first->ticks > TEST_MS(900) &&
+				   first->ticks <= TEST_MS(1000));
+	}
+
+	xktimer_persist_close(&store);
+	unlink(path);
+}
+#endif
+
+int main()
+{
+	test_single_shot();
+	test_periodic();
+	test_dual_state();
+	test_sequence();
+	test_remove();
+	test_touch();
+	test_slack();
+	test_catch_up();
+	test_long_stall();
+	test_restart();
+	test_overrun();
+	test_many();
+	test_sub_ms();
+	test_uninitialized();
+#ifdef XKTIMER_PERSIST
+	test_persist();
+#endif
+
+	printf("%u of %u checks failed\n", test_failed, test_checks);
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
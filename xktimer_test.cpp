@@ -0,0 +1,317 @@
+/*
+ * This file is part of the XKLib project.
+ *
+ * xktimer_test.cpp
+ *
+ * Copyright (C) 2011 Jesse L. Zamora <xtremekforever@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+
+ * You should have received a copy of the GNU Library General Public License
+ * along with this library; see the file COPYING.LIB.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*This file has been prepared for Doxygen automatic documentation generation.*/
+/*! \file *********************************************************************
+ *
+ * \brief The XKTimer Module (C++ Tests)
+ *
+ * Checks the C++ wrappers of XKTimer+.h: the timeouts, slack and overrun
+ * policy that an xk::TimerSet keeps when a timer is added to it, the
+ * hyperperiod of an xk::StaticTimers schedule with single shot timers, and,
+ * with coroutine support, awaiting tasks that were started before with or
+ * without a timeout.
+ *
+ * Like xktimer_test.c, the tests drive the module with a fake clock, so they
+ * need XKTIMER_CLOCK_CUSTOM, and XKTimer+.h needs C++20:
+ *
+ * \code
+ * cc -DXKTIMER_CLOCK=5 -c xktimer.c -o xktimer.o
+ * c++ -std=c++20 -DXKTIMER_CLOCK=5 xktimer_test.cpp xktimer.o -o test++
+ * ./test++
+ * \endcode
+ *
+ * The program prints each check that fails and exits with a non-zero status
+ * if any did.
+ *
+ * \author 				Jesse L. Zamora - xtremekforever@gmail.com
+ *
+ ******************************************************************************/
+
+/* Standard Library Includes */
+#include <cstdio>
+#include <cstdlib>
+
+#include "includes.h"
+
+#include "XKTimer+.h"
+
+#if XKTIMER_CLOCK != XKTIMER_CLOCK_CUSTOM
+#error "The tests need a fake clock, please build them with XKTIMER_CLOCK=5"
+#endif
+
+using namespace std::chrono_literals;
+
+//! Check a condition and report it if it does not hold
+#define TEST_CHECK(cond)	\
+	test_check((cond), #cond, __FILE__, __LINE__)
+
+static xktimer_tick_t test_now;
+
+static unsigned int test_checks;
+static unsigned int test_failed;
+
+//! The times at which the timers of a test timed out, in ticks
+static xktimer_tick_t test_fires[16];
+static unsigned int test_fires_len;
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+//! The number of times test_sleeper() woke up from its sleep
+static unsigned int test_wakes;
+
+//! Set by the coroutines that await test_sleeper()
+static int test_result;
+#endif
+
+static xktimer_tick_t test_clock()
+{
+	return test_now;
+}
+
+static void test_check(bool ok, const char * what, const char * file, int line)
+{
+	test_checks++;
+
+	if (!ok) {
+		test_failed++;
+		std::printf("%s:%d: check failed: %s\n", file, line, what);
+	}
+}
+
+static void test_fire()
+{
+	if (test_fires_len < 16) {
+		test_fires[test_fires_len] = test_now;
+	}
+
+	test_fires_len++;
+}
+
+static void test_reset()
+{
+	test_now = 0;
+	test_fires_len = 0;
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+	test_wakes = 0;
+	test_result = 0;
+#endif
+
+	xktimer_set_clock(test_clock);
+	xktimer_init();
+}
+
+//! Advance the fake clock one tick at a time, with a pass of the set on each
+static void test_run(xk::TimerSet & set, xktimer_tick_t until)
+{
+	while (test_now < until) {
+		test_now++;
+		set.task();
+	}
+}
+
+//! The timeouts and settings of a timer are kept when it is added to a set
+static void test_timer_set()
+{
+	test_reset();
+
+	xk::TimerSet set;
+
+	xk::Timer periodic(xk::Type::Periodic, 250us, [] { test_fire(); });
+	xk::Timer dual(2ms, 3ms, [](int) { test_fire(); });
+
+	periodic.set_overrun(xk::Overrun::Skip);
+	dual.set_slack(4ms);
+
+	TEST_CHECK(set.add(periodic) && set.add(dual));
+	TEST_CHECK(!set.add(periodic));
+	TEST_CHECK(periodic.get()->timeout == XKTIMER_US_TICKS(250));
+	TEST_CHECK(dual.get()->timeout == XKTIMER_MS_TICKS(2) &&
+			   dual.get()->timeout2 == XKTIMER_MS_TICKS(3));
+	TEST_CHECK(periodic.get()->overrun == XKTIMER_OVERRUN_SKIP);
+	TEST_CHECK(dual.get()->slack == XKTIMER_MS_TICKS(4));
+
+	// The dual-state timer is due at 2 ms, which the slack rounds up to 4
+	dual.start();
+	test_run(set, XKTIMER_MS_TICKS(5));
+	TEST_CHECK(test_fires_len == 1 &&
+			   test_fires[0] == xktimer_tick_t(XKTIMER_MS_TICKS(4)));
+	dual.stop();
+
+	test_fires_len = 0;
+	periodic.start();
+	test_run(set, test_now + 2 * XKTIMER_US_TICKS(250));
+	TEST_CHECK(test_fires_len == 2);
+}
+
+//! The times at which the single shot timer of test_static() timed out
+static xktimer_tick_t test_once[4];
+static unsigned int test_once_len;
+
+static void test_once_fire()
+{
+	if (test_once_len < 4) {
+		test_once[test_once_len] = test_now;
+	}
+
+	test_once_len++;
+}
+
+//! A single shot timer does not stretch the hyperperiod of a schedule
+static void test_static()
+{
+	test_reset();
+	test_once_len = 0;
+
+	xk::StaticTimers<
+		xk::Entry<xk::Type::Periodic, 4, test_fire>,
+		xk::Entry<xk::Type::SingleShot, 7, test_once_fire>
+	> timers;
+
+	static_assert(decltype(timers)::hyperperiod() == 4);
+	static_assert(decltype(timers)::size() == 2);
+
+	timers.start();
+
+	while (test_now < xktimer_tick_t(XKTIMER_MS_TICKS(30))) {
+		test_now++;
+		timers.task();
+	}
+
+	TEST_CHECK(test_once_len == 1 &&
+			   test_once[0] == xktimer_tick_t(XKTIMER_MS_TICKS(7)));
+	TEST_CHECK(test_fires_len == 7 &&
+			   test_fires[6] == xktimer_tick_t(XKTIMER_MS_TICKS(28)));
+	TEST_CHECK(timers.running());
+
+	// A late call runs the missed timeouts of both tables in order
+	test_reset();
+	test_once_len = 0;
+	timers.start();
+
+	test_now = XKTIMER_MS_TICKS(9);
+	timers.task();
+	TEST_CHECK(test_fires_len == 2 && test_once_len == 1);
+	TEST_CHECK(timers.next_deadline() == xktimer_tick_t(XKTIMER_MS_TICKS(12)));
+
+	// A schedule of single shot timers stops after they ran
+	xk::StaticTimers<
+		xk::Entry<xk::Type::SingleShot, 3, test_once_fire>,
+		xk::Entry<xk::Type::SingleShot, 5, test_once_fire>
+	> once;
+
+	static_assert(decltype(once)::hyperperiod() == 1);
+
+	test_reset();
+	test_once_len = 0;
+	once.start();
+	TEST_CHECK(once.next_deadline() == xktimer_tick_t(XKTIMER_MS_TICKS(3)));
+
+	while (test_now < xktimer_tick_t(XKTIMER_MS_TICKS(10))) {
+		test_now++;
+		once.task();
+	}
+
+	TEST_CHECK(test_once_len == 2 && !once.running());
+}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+//! Advance the fake clock one tick at a time, with a pass on every tick
+static void test_run(xktimer_tick_t until)
+{
+	while (test_now < until) {
+		test_now++;
+		xktimer_task();
+	}
+}
+
+static xk::Task<int> test_sleeper()
+{
+	co_await xk::sleep_for(10ms);
+	test_wakes++;
+
+	co_return 7;
+}
+
+static xk::Task<> test_await(xk::Task<int> & op)
+{
+	test_result = co_await std::move(op);
+}
+
+static xk::Task<> test_await_timeout(xk::Task<int> & op)
+{
+	std::optional<int> result = co_await xk::with_timeout(std::move(op), 50ms);
+
+	test_result = result ? *result : -1;
+}
+
+//! Await a task that was started and waits on a timer already
+static void test_await_started()
+{
+	test_reset();
+
+	xk::Task<int> op = test_sleeper();
+	op.start();
+
+	xk::Task<> waiter = test_await(op);
+	waiter.start();
+
+	// Awaiting must not resume the task before its sleep is over
+	TEST_CHECK(test_wakes == 0 && !waiter.done());
+
+	test_run(XKTIMER_MS_TICKS(20));
+	TEST_CHECK(test_wakes == 1);
+	TEST_CHECK(test_result == 7 && waiter.done());
+}
+
+//! The same, with a timeout that does not run out
+static void test_timeout_started()
+{
+	test_reset();
+
+	xk::Task<int> op = test_sleeper();
+	op.start();
+
+	xk::Task<> waiter = test_await_timeout(op);
+	waiter.start();
+
+	TEST_CHECK(test_wakes == 0 && !waiter.done());
+
+	test_run(XKTIMER_MS_TICKS(100));
+	TEST_CHECK(test_wakes == 1);
+	TEST_CHECK(test_result == 7 && waiter.done());
+}
+#endif
+
+int main()
+{
+	test_timer_set();
+	test_static();
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+	test_await_started();
+	test_timeout_started();
+#endif
+
+	std::printf("%u of %u checks failed\n", test_failed, test_checks);
+
+	return test_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}